@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "encoder.h"
+#include "jobs.h"
+#include "utils.h"
+
+#define WIDTH  1920
+#define HEIGHT 1080
+#define FPS    60
+#define FRAMES 600
+#define OUTPUT "bench_roi.mkv"
+
+static const int roi_cases[] = { 0, 4, 8, 12 };
+
+// A mostly static desktop: panels, text-like stripes and a gradient, like
+// bench_scale. draw_activity adds what usually moves on one: a line of
+// typing and a small window being dragged around.
+static void fill_desktop(unsigned char* buf, int w, int h) {
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            unsigned char* p = buf + ((size_t)y * w + x) * 4;
+            int panel = (x / 320 + y / 240) & 1;
+            int text  = (y % 18 < 12) && (x % 7 < 4) && (x / 320) % 3 == 1;
+            p[0] = (unsigned char)(text ? 20 : panel ? 240 : (x * 255 / w));
+            p[1] = (unsigned char)(text ? 20 : panel ? 240 : (y * 255 / h));
+            p[2] = (unsigned char)(text ? 20 : panel ? 235 : 128);
+            p[3] = 255;
+        }
+    }
+}
+
+static void fill_rect(unsigned char* buf, int x0, int y0, int w, int h, unsigned v) {
+    for (int y = y0; y < y0 + h && y < HEIGHT; y++)
+        for (int x = x0; x < x0 + w && x < WIDTH; x++)
+            memcpy(buf + ((size_t)y * WIDTH + x) * 4, &v, 4);
+}
+
+static void draw_activity(unsigned char* frame, const unsigned char* background, int i) {
+    memcpy(frame, background, (size_t)WIDTH * HEIGHT * 4);
+
+    // One glyph every other frame along a text line, wrapping.
+    const int glyphs = (i / 2) % 120;
+    for (int g = 0; g < glyphs; g++)
+        fill_rect(frame, 400 + g * 9, 700 + (g % 3), 6, 12, 0xFF202020u);
+
+    // A 320x200 window drifting across the screen.
+    const int wx = 100 + (i * 3) % (WIDTH - 520);
+    const int wy = 200 + (i * 2) % (HEIGHT - 400);
+    fill_rect(frame, wx, wy, 320, 200, 0xFF3060A0u);
+    fill_rect(frame, wx + 10, wy + 30, 300, 160, 0xFFF0F0F0u);
+}
+
+static long long file_size(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return 0;
+    fseek(f, 0, SEEK_END);
+    long long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+int main(void) {
+    unsigned char* background = malloc((size_t)WIDTH * HEIGHT * 4);
+    unsigned char* frame      = malloc((size_t)WIDTH * HEIGHT * 4);
+    if (!background || !frame) return 1;
+    fill_desktop(background, WIDTH, HEIGHT);
+    jobs_init(0);
+
+    printf("%dx%d@%d, %d frames, libx264 veryfast crf 23\n", WIDTH, HEIGHT, FPS, FRAMES);
+    printf("%-8s %12s %12s %10s\n", "roi", "encode/frm", "bitrate", "size");
+
+    for (size_t c = 0; c < sizeof(roi_cases) / sizeof(roi_cases[0]); c++) {
+        EncoderConfig cfg = {
+            .filename = OUTPUT,
+            .width    = WIDTH,
+            .height   = HEIGHT,
+            .fps      = FPS,
+            .codec    = "libx264",
+            .preset   = "veryfast",
+            .crf      = 23,
+            .gop      = 120,
+            .roi_qp   = roi_cases[c],
+        };
+        if (!init_encoder(&cfg)) return 1;
+
+        long long encode_us = 0;
+        const long long origin = encoder_clock_origin();
+        for (int i = 0; i < FRAMES; i++) {
+            draw_activity(frame, background, i);
+            long long start = time_now_us();
+            encode_frame(frame, WIDTH * 4, origin + (long long)i * 1000000 / FPS);
+            encode_us += time_now_us() - start;
+        }
+        long long start = time_now_us();
+        cleanup_encoder();
+        encode_us += time_now_us() - start;
+
+        const long long size = file_size(OUTPUT);
+        char name[16];
+        snprintf(name, sizeof(name), roi_cases[c] ? "qp %d" : "off", roi_cases[c]);
+        printf("%-8s %10.2fms %8.0fkbps %8.1fMB\n", name,
+               encode_us / 1000.0 / FRAMES,
+               size * 8.0 / 1000.0 / ((double)FRAMES / FPS),
+               size / 1048576.0);
+        remove(OUTPUT);
+    }
+
+    jobs_shutdown();
+    free(frame);
+    free(background);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <libswscale/swscale.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/frame.h>
+#include "frame_alloc.h"
+#include "scale.h"
+#include "utils.h"
+
+#define ITERATIONS 200
+
+typedef struct {
+    int src_w, src_h;
+    int dst_w, dst_h;
+} Case;
+
+static const Case cases[] = {
+    { 1920, 1080, 1280,  720 },
+    { 1920, 1080,  960,  540 },
+    { 3840, 2160, 2560, 1440 },
+    { 3840, 2160, 1920, 1080 },
+};
+
+// Flat panels, text-like stripes and a gradient, roughly what a desktop
+// capture looks like.
+static void fill_desktop(uint8_t* buf, int w, int h) {
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            uint8_t* p = buf + ((size_t)y * w + x) * 4;
+            int panel = (x / 320 + y / 240) & 1;
+            int text  = (y % 18 < 12) && (x % 7 < 4) && (x / 320) % 3 == 1;
+            p[0] = (uint8_t)(text ? 20 : panel ? 240 : (x * 255 / w));
+            p[1] = (uint8_t)(text ? 20 : panel ? 240 : (y * 255 / h));
+            p[2] = (uint8_t)(text ? 20 : panel ? 235 : 128);
+            p[3] = 255;
+        }
+    }
+}
+
+static double bench_sws(const uint8_t* src, const Case* c, int flags, AVFrame* out) {
+    struct SwsContext* sws = sws_getContext(c->src_w, c->src_h, AV_PIX_FMT_BGRA,
+                                            c->dst_w, c->dst_h, AV_PIX_FMT_YUV420P,
+                                            flags, NULL, NULL, NULL);
+    const uint8_t* data[1] = { src };
+    int linesize[1] = { c->src_w * 4 };
+
+    long long start = time_now_us();
+    for (int i = 0; i < ITERATIONS; i++)
+        sws_scale(sws, data, linesize, 0, c->src_h, out->data, out->linesize);
+    long long elapsed = time_now_us() - start;
+
+    sws_freeContext(sws);
+    return (double)elapsed / ITERATIONS / 1000.0;
+}
+
+static double bench_fast(const uint8_t* src, const Case* c, AVFrame* out) {
+    ScaleMode mode = scale_pick_mode(c->src_w, c->src_h, c->dst_w, c->dst_h);
+    uint8_t* tmp = malloc((size_t)c->dst_w * c->dst_h * 4);
+    const size_t scratch_size = scale_scratch_size(mode, c->dst_w);
+    void* scratch = scratch_size ? mem_aligned_alloc(scratch_size, FRAME_ALIGN) : NULL;
+    struct SwsContext* sws = sws_getContext(c->dst_w, c->dst_h, AV_PIX_FMT_BGRA,
+                                            c->dst_w, c->dst_h, AV_PIX_FMT_YUV420P,
+                                            SWS_BILINEAR, NULL, NULL, NULL);
+    const uint8_t* data[1] = { tmp };
+    int linesize[1] = { c->dst_w * 4 };
+
+    long long start = time_now_us();
+    for (int i = 0; i < ITERATIONS; i++) {
+        scale_bgra_rows(mode, src, c->src_w * 4, tmp, c->dst_w * 4, c->dst_w, 0, c->dst_h,
+                        scratch);
+        sws_scale(sws, data, linesize, 0, c->dst_h, out->data, out->linesize);
+    }
+    long long elapsed = time_now_us() - start;
+
+    sws_freeContext(sws);
+    mem_aligned_free(scratch);
+    free(tmp);
+    return (double)elapsed / ITERATIONS / 1000.0;
+}
+
+int main(void) {
+    printf("%-22s %10s %10s %10s %8s\n",
+           "case", "bicubic", "fast_bil", "castr", "speedup");
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        const Case* c = &cases[i];
+        uint8_t* src = malloc((size_t)c->src_w * c->src_h * 4);
+        AVFrame* out = av_frame_alloc();
+        out->format = AV_PIX_FMT_YUV420P;
+        out->width  = c->dst_w;
+        out->height = c->dst_h;
+        if (!src || av_frame_get_buffer(out, 0) < 0) return 1;
+        fill_desktop(src, c->src_w, c->src_h);
+
+        double bicubic  = bench_sws(src, c, SWS_BICUBIC, out);
+        double bilinear = bench_sws(src, c, SWS_FAST_BILINEAR, out);
+        double fast     = bench_fast(src, c, out);
+
+        char name[32];
+        snprintf(name, sizeof(name), "%dx%d->%dx%d", c->src_w, c->src_h, c->dst_w, c->dst_h);
+        printf("%-22s %8.2fms %8.2fms %8.2fms %7.2fx\n",
+               name, bicubic, bilinear, fast, bicubic / fast);
+
+        av_frame_free(&out);
+        free(src);
+    }
+    return 0;
+}
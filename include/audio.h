@@ -0,0 +1,56 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdbool.h>
+#include "threading.h"
+
+typedef struct AudioSource AudioSource;
+
+struct AudioSource {
+    int   sample_rate;
+    int   channels;
+    // Blocks until `frames` interleaved float frames are read. Returns the
+    // number of frames read, 0 at end of stream, < 0 on error.
+    int  (*read)(AudioSource* src, float* out, int frames);
+    void (*destroy)(AudioSource* src);
+    void* impl;
+};
+
+// "sine[:HZ]", "wav:PATH" or "pulse[:DEVICE]" (PulseAudio / pipewire-pulse;
+// use "pulse:@DEFAULT_MONITOR@" for desktop audio).
+AudioSource* audio_source_open(const char* spec);
+AudioSource* audio_source_sine(int sample_rate, int channels, double freq);
+AudioSource* audio_source_wav(const char* path);
+AudioSource* audio_source_pulse(const char* device, int sample_rate, int channels);
+void         audio_source_close(AudioSource* src);
+
+// Lock-free single-producer/single-consumer ring of interleaved float frames.
+typedef struct {
+    float*     data;
+    int        channels;
+    long long  capacity;
+    atomic_i64 write_pos;
+    atomic_i64 read_pos;
+} AudioRing;
+
+int       audio_ring_init(AudioRing* ring, int channels, long long capacity);
+long long audio_ring_write(AudioRing* ring, const float* in, long long frames);
+long long audio_ring_read(AudioRing* ring, float* out, long long frames);
+long long audio_ring_available(AudioRing* ring);
+void      audio_ring_free(AudioRing* ring);
+
+typedef struct {
+    unsigned long long underruns;      // times silence was inserted
+    unsigned long long overruns;       // frames dropped on a full ring
+    unsigned long long dropped_frames; // frames skipped to catch up
+    double             drift_ms;       // source clock minus monotonic clock
+} AudioStats;
+
+// Starts the capture and encode threads and takes ownership of `src`.
+// `clock_origin_us` is the time_now_us() value that maps to pts 0 in the
+// muxer, shared with the video stream.
+int  audio_start(AudioSource* src, long long clock_origin_us);
+void audio_stop(void);
+void audio_get_stats(AudioStats* stats);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+
+typedef struct {
+    int x, y;
+    int width, height; // 0 = to the edge of the output
+} CaptureRegion;
+
+typedef struct {
+    int           output; // monitor index, 0 = primary/first
+    CaptureRegion region; // relative to the output's top-left corner
+    const char*   window; // window title; follows the window, overrides region
+    int           fps;    // grab rate for backends without change notification
+} CaptureConfig;
+
+typedef struct CaptureSource CaptureSource;
+
+// grab() result when the output or window changed size: width and height
+// already hold the new size and nothing was written. The caller resizes
+// its buffers and grabs again.
+#define CAPTURE_RESIZED 2
+
+// Frames are BGRA, width x height, cropped at the source so only the region
+// is copied out of the compositor.
+struct CaptureSource {
+    const char* name;
+    int         width, height;
+    // Waits up to `timeout_ms` for a new frame and writes it to `out`.
+    // Returns 1 for a new frame, 0 if nothing changed, CAPTURE_RESIZED,
+    // or < 0 on a fatal error.
+    int  (*grab)(CaptureSource* src, unsigned char* out, int stride, int timeout_ms);
+    // Capture thread. Asks for another size, delivered as CAPTURE_RESIZED by
+    // the next grab. NULL where the size follows the output or window.
+    int  (*resize)(CaptureSource* src, int width, int height);
+    void (*destroy)(CaptureSource* src);
+    void* impl;
+};
+
+// "desktop" picks the platform backend: DXGI desktop duplication on
+// Windows, XShm on X11. "test" is a synthetic source that stamps a frame ID
+// and capture time into every frame (see test_pattern.h); its size is the
+// region size, 1280x720 if unset.
+CaptureSource* capture_open(const char* name, const CaptureConfig* cfg);
+void           capture_close(CaptureSource* src);
+
+CaptureSource* capture_open_test(const CaptureConfig* cfg);
+#ifdef _WIN32
+CaptureSource* capture_open_dxgi(const CaptureConfig* cfg);
+#endif
+#ifdef CASTR_HAVE_X11
+CaptureSource* capture_open_x11(const CaptureConfig* cfg);
+#endif
+
+/**
+ * Clip a requested region to an output and round it down to even sizes
+ * @param region Requested region, rewritten in place
+ * @param output_w Output width
+ * @param output_h Output height
+ * @return 1 if a non-empty region remains, 0 otherwise
+ */
+int capture_clip_region(CaptureRegion* region, int output_w, int output_h);
+
+/**
+ * Sleep until the next grab is due for sources without change notification
+ * @param next_us Due time, advanced by one interval when it returns 1
+ * @param interval_us Grab interval
+ * @param timeout_ms Longest the caller may block
+ * @return 1 when a grab is due, 0 if the timeout ran out first
+ */
+int capture_pace(long long* next_us, long long interval_us, int timeout_ms);
+
+// Parallel row copy out of a mapped surface, shared by the backends.
+void capture_copy(unsigned char* dst, size_t dst_pitch,
+                  const unsigned char* src, size_t src_pitch,
+                  size_t row_bytes, int rows);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef CAPTURE_WORKER_H
+#define CAPTURE_WORKER_H
+
+#include <stdbool.h>
+#include "capture.h"
+#include "frame_alloc.h"
+#include "threading.h"
+
+// One capture thread per source, each grabbing at its own pace. Frames are
+// handed over through a triple buffer: the worker fills its back buffer and
+// swaps it with the middle one, the consumer swaps the middle one for its
+// front buffer when it holds a newer frame. Neither side ever waits for the
+// other; a consumer that falls behind simply gets the newest frame.
+typedef struct {
+    CaptureSource* source;
+    int            index;
+    FrameBuffer    buffers[3];
+    long long      timestamps[3]; // time_now_us() when each buffer was grabbed
+    atomic_i32     middle;        // buffer index, plus a flag while it is unseen
+    int            back;          // worker side
+    int            front;         // consumer side
+    atomic_i32     running;
+    atomic_i64     resize;        // pending capture_worker_resize, w << 32 | h
+    Thread         thread;
+    bool           started;
+    int            cpu, priority;
+
+    atomic_i64     grabbed;       // frames grabbed, written by the worker
+
+    // Consumer side, for capture_worker_log_stats
+    long long      taken, age_us;
+    long long      last_grabbed, last_taken, last_age_us, last_log_us;
+} CaptureWorker;
+
+/**
+ * Take over an open source and allocate its frame buffers
+ * @return 1 on success, 0 if the buffers could not be allocated
+ */
+int  capture_worker_init(CaptureWorker* w, CaptureSource* source, int index);
+
+/**
+ * Start the worker thread
+ * @param cpu CPU to pin it to, -1 to leave it to the OS
+ * @param priority ThreadPriority for the thread
+ * @return 1 on success, 0 if the thread could not be created
+ */
+int  capture_worker_start(CaptureWorker* w, int cpu, int priority);
+
+// Asks the thread to finish without waiting for it, so that several
+// workers wind down together.
+void capture_worker_stop(CaptureWorker* w);
+
+// Stops and joins the thread; frees the buffers and closes the source.
+void capture_worker_destroy(CaptureWorker* w);
+
+// Ask the source for another size from the worker thread. Sources without
+// a resize hook log a warning.
+void capture_worker_resize(CaptureWorker* w, int width, int height);
+
+/**
+ * Consumer side: swap in the newest frame if one arrived since the last call
+ * @param timestamp_us Set to the frame's grab time if not NULL
+ * @return The frame, owned by the consumer until the next call; NULL if
+ *         nothing new arrived
+ */
+const FrameBuffer* capture_worker_take(CaptureWorker* w, long long* timestamp_us);
+
+// Consumer side: the frame the last successful take returned (blank before
+// the first one).
+const FrameBuffer* capture_worker_current(const CaptureWorker* w);
+
+// Consumer side: grab rate, frames taken and their age since the last call.
+void capture_worker_log_stats(CaptureWorker* w);
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef CASTR_SHM_H
+#define CASTR_SHM_H
+
+// Reader side of the shared-memory frame export (--shm NAME). Built as the
+// standalone castr_shm library; it depends on nothing else in Castr.
+//
+// Castr publishes every composited frame into a ring of CastrShmHeader.slot_count
+// slots in a shared-memory object. A small directory object, "/castr-NAME"
+// under /dev/shm on Linux and "Local\castr-NAME" on Windows, names the
+// current ring, "castr-NAME.GENERATION". The producer never waits for
+// readers: each slot is a sequence lock, odd while it is being written,
+// and readers detect (and retry) a frame that was overwritten while they
+// copied it. A reader that falls more than slot_count frames behind
+// simply skips to the newest one; the gap shows in CastrShmFrame.sequence.
+// When the canvas is resized the producer closes the ring and creates a
+// new one under the next generation: castr_shm_read returns -1 and the
+// reader opens NAME again. A ring still mapped by a reader is never reused.
+//
+// Typical use:
+//
+//     CastrShmReader* r = castr_shm_open("cam0");
+//     CastrShmFrame f;
+//     uint8_t* buf = malloc(castr_shm_frame_size(r));
+//     for (;;) {
+//         int n = castr_shm_read(r, buf, castr_shm_frame_size(r), &f);
+//         if (n < 0) break;            // producer exited
+//         if (n == 0) { sleep a bit; continue; }
+//         consume(buf, &f);
+//     }
+//     castr_shm_close(r);
+//
+// castr_shm_peek/castr_shm_valid avoid the copy: work on the slot in place,
+// then discard the result if castr_shm_valid says it was overwritten.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CASTR_SHM_MAGIC     0x4D485343u // "CSHM"
+#define CASTR_SHM_DIR_MAGIC 0x44485343u // "CSHD"
+#define CASTR_SHM_VERSION   2
+#define CASTR_SHM_ALIGN     64
+
+typedef enum {
+    CASTR_SHM_BGRA = 1, // one plane, 4 bytes per pixel, top-down
+    CASTR_SHM_NV12 = 2, // Y plane then interleaved UV at half height, BT.601 limited range;
+                        // an odd canvas width or height loses its last column or row
+} CastrShmFormat;
+
+// The whole directory object, kept for the producer's lifetime.
+typedef struct {
+    uint32_t          magic;        // CASTR_SHM_DIR_MAGIC
+    uint32_t          version;
+    volatile uint32_t generation;   // current ring
+    volatile uint32_t closed;       // set when the producer stops
+    uint32_t          producer_pid;
+} CastrShmDirectory;
+
+// At offset 0 of a ring. Fixed for the ring's lifetime except for `latest`
+// and `closed`.
+typedef struct {
+    uint32_t          magic;
+    uint32_t          version;
+    uint32_t          format;      // CastrShmFormat
+    uint32_t          width, height;
+    uint32_t          stride;      // bytes per row of every plane
+    uint32_t          slot_count;
+    uint32_t          slot_offset; // first slot, from the start of the mapping
+    uint64_t          slot_size;   // slot header plus pixels, CASTR_SHM_ALIGN multiple
+    uint64_t          frame_size;  // pixel bytes per frame
+    volatile uint64_t latest;      // sequence of the newest complete frame, 0 before the first
+    volatile uint32_t closed;      // set when the producer stops or moves to a new ring
+    uint32_t          producer_pid;
+    uint32_t          generation;
+} CastrShmHeader;
+
+// Starts every slot; pixels follow at CASTR_SHM_ALIGN.
+typedef struct {
+    volatile uint64_t lock;         // 2 * sequence when complete, odd while writing
+    int64_t           timestamp_us; // producer's monotonic clock at capture
+} CastrShmSlot;
+
+typedef struct {
+    uint64_t sequence;     // 1 for the first published frame, no gaps on the producer side
+    int64_t  timestamp_us;
+    uint32_t format;
+    uint32_t width, height;
+    uint32_t stride;
+    uint64_t size;
+} CastrShmFrame;
+
+typedef struct CastrShmReader CastrShmReader;
+
+/**
+ * Map a running producer's current ring read-only
+ * @param name The NAME given to --shm
+ * @return NULL if there is no such producer or its layout is unknown
+ */
+CastrShmReader* castr_shm_open(const char* name);
+void            castr_shm_close(CastrShmReader* reader);
+
+const CastrShmHeader* castr_shm_header(const CastrShmReader* reader);
+size_t                castr_shm_frame_size(const CastrShmReader* reader);
+
+/**
+ * Copy the newest frame if it is newer than the last one returned
+ * @param dst At least castr_shm_frame_size() bytes, rows at header stride
+ * @return 1 with a frame, 0 if nothing new, -1 once the producer has closed
+ */
+int castr_shm_read(CastrShmReader* reader, void* dst, size_t dst_size, CastrShmFrame* frame);
+
+/**
+ * Point at the newest complete frame in place, without copying
+ * @return The pixels, or NULL if no frame has been published
+ */
+const uint8_t* castr_shm_peek(CastrShmReader* reader, CastrShmFrame* frame);
+
+/**
+ * Check that a frame from castr_shm_peek was not overwritten while in use
+ * @return 1 if everything read from it since the peek is intact
+ */
+int castr_shm_valid(CastrShmReader* reader, const CastrShmFrame* frame);
+
+#endif
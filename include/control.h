@@ -0,0 +1,41 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Runtime reconfiguration (--control): commands on stdin, one per line.
+//   source WxH        ask the capture source for another size
+//   canvas WxH        resize the compositor canvas
+//   output-size WxH   reopen the encoder at another output size
+//   bitrate KBPS      new target bitrate, with --bitrate
+//   crf N             new constant rate factor, without --bitrate
+//   snapshot PATH     write the next canvas frame to PATH (.qoi/.png/.jpg)
+// Each pipeline thread takes and applies its own part between frames, so
+// no thread is stopped for a change.
+
+typedef struct {
+    int out_w, out_h;  // 0 for unchanged
+    int bitrate_kbps;  // 0 for unchanged
+    int crf;           // -1 for unchanged
+} ControlEncoder;
+
+/**
+ * Start reading commands from stdin on a background thread
+ * @return 1 on success, 0 if the thread could not be started
+ */
+int  control_start(void);
+
+// Capture worker 0. A pending source size; false if there is none.
+bool control_take_source(int* width, int* height);
+
+// Compositor thread. A pending canvas size; false if there is none.
+bool control_take_canvas(int* width, int* height);
+
+// Encoder thread. Pending encoder changes; false if there are none.
+bool control_take_encoder(ControlEncoder* req);
+
+// Encoder thread. A pending snapshot path; false if there is none.
+bool control_take_snapshot(char* path, size_t size);
+
+#endif
@@ -1,8 +1,61 @@
 #ifndef ENCODER_H
 #define ENCODER_H
 
-void init_encoder(const char *filename, int width, int height);
-void encode_frame(unsigned char *bgra_data);
+typedef struct {
+    const char* filename;
+    int         width, height;         // canvas size handed to encode_frame
+    int         out_width, out_height; // encoded size, 0 to match the canvas
+    const char* scaler;                // "fast" (default) or "bicubic"
+    int         fps;
+    const char* codec;
+    const char* preset;
+    int         crf;
+    int         bitrate_kbps;
+    int         gop;
+    int         adaptive;    // allow encoder_reconfigure() mid-stream
+    int         reconfigurable; // same, for runtime changes asked for by the user
+    int         roi_qp;      // QP offset between changed and static tiles, 0 for off
+    const char* intermediate; // "raw" (NV12) or "lossless" (x264 qp 0) for
+                              // transcoding later; overrides codec settings
+    double      rotate_sec;   // start a new segment after this long, 0 for never
+    long long   rotate_bytes; // ...or once a segment reaches this size
+    const char* audio_codec; // NULL for video only
+    int         audio_sample_rate;
+    int         audio_channels;
+    int         audio_bitrate_kbps;
+} EncoderConfig;
+
+int init_encoder(const EncoderConfig *cfg);
+void encode_frame(const unsigned char *bgra_data, int stride, long long timestamp_us);
+void encode_audio(const float *samples, int frames, long long pts);
+int encoder_audio_frame_size(void);
+long long encoder_clock_origin(void);
+
+// Runtime changes, encoder thread only. A new CRF or bitrate is picked up
+// by libx264 on the next frame. encoder_reconfigure drains and reopens the
+// video encoder with another preset and/or output size; with rotation on it
+// starts a new segment, otherwise the stream carries on and relies on the
+// in-band parameter sets that `adaptive` and `reconfigurable` turn on.
+// The output size only changes with rotation on (encoder_can_resize):
+// each file's headers describe a single size.
+int encoder_set_crf(int crf);
+int encoder_set_bitrate(int kbps);
+int encoder_reconfigure(const char *preset, int width, int height);
+int encoder_can_resize(void);
+int encoder_set_output_size(int width, int height);
+int encoder_has_option(const char *name);
+
+// Encoder thread. The canvas handed to encode_frame changed size; the
+// conversion is rebuilt to scale it to the unchanged output size, so the
+// stream itself is not touched.
+int encoder_set_input_size(int width, int height);
+
+// Called after each video packet is muxed, with its pts in 1/fps ticks and
+// the time_now_us() of the write. Set before init_encoder.
+typedef void (*EncoderPacketHook)(long long pts, long long muxed_us);
+void encoder_set_packet_hook(EncoderPacketHook hook);
+
+// Drains the encoders and finalizes every segment.
 void cleanup_encoder();
 
-#endif
\ No newline at end of file
+#endif
@@ -3,13 +3,38 @@
 
 #include <glad/glad.h>
 
+#define FONT_ATLAS_SIZE 512
+
 typedef struct {
 	GLuint texture;
 	float size;
 	void* chardata;
 } Font;
 
+// Glyph coverage and metrics before they reach the GPU. Baking touches no
+// GL state, so it can run on any thread while the context is created.
+typedef struct {
+	unsigned char* bitmap; // FONT_ATLAS_SIZE x FONT_ATLAS_SIZE coverage
+	void* chardata;
+	float size;
+} FontAtlas;
+
+/**
+ * Bake printable ASCII from a TTF into an atlas
+ * Atlases are cached on disk, keyed by a hash of the font file and the
+ * size, so later runs skip the rasterizing.
+ * @return 1 on success, 0 if the font could not be read
+ */
+int font_bake(FontAtlas* atlas, const char* path, float size);
+void font_atlas_free(FontAtlas* atlas);
+
+/**
+ * Upload a baked atlas on the GL thread; the font takes over its metrics
+ * @return 1 on success, 0 on failure (the atlas is freed either way)
+ */
+int font_upload(Font* font, FontAtlas* atlas);
+
 int font_init(Font* font, const char* path, float size);
 void font_draw(Font* font, const char* text, float x, float y);
 
-#endif
\ No newline at end of file
+#endif
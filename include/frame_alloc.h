@@ -0,0 +1,51 @@
+#ifndef FRAME_ALLOC_H
+#define FRAME_ALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define FRAME_ALIGN 64
+
+typedef enum {
+    FRAME_PAGES_NORMAL,
+    FRAME_PAGES_TRANSPARENT, // THP requested with madvise, not guaranteed
+    FRAME_PAGES_HUGE,        // MAP_HUGETLB / MEM_LARGE_PAGES
+} FramePages;
+
+typedef struct {
+    unsigned char* data;
+    int            width, height;
+    int            stride; // bytes, multiple of FRAME_ALIGN
+    size_t         size;
+    size_t         mapped; // bytes actually reserved
+    FramePages     pages;
+} FrameBuffer;
+
+typedef struct {
+    long long buffers;
+    long long bytes;
+    long long huge_bytes;
+    long long peak_bytes;
+} FrameAllocStats;
+
+/**
+ * Allocate a pre-faulted BGRA frame
+ * Rows are padded to FRAME_ALIGN bytes. Huge pages are tried first and
+ * normal pages used as a fallback.
+ * @return 1 on success, 0 if memory could not be committed
+ */
+int  frame_alloc(FrameBuffer* fb, int width, int height);
+int  frame_alloc_bytes(FrameBuffer* fb, size_t size);
+void frame_free(FrameBuffer* fb);
+
+/**
+ * Heap allocation aligned to `align` (a power of two) for scratch rows
+ * and SIMD temporaries; release with mem_aligned_free
+ */
+void* mem_aligned_alloc(size_t size, size_t align);
+void  mem_aligned_free(void* p);
+
+void frame_alloc_get_stats(FrameAllocStats* stats);
+void frame_alloc_log_stats(void);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#define JOBS_MAX_WORKERS 32
+
+typedef void (*JobFunc)(void* ctx, int index);
+typedef void (*JobRowsFunc)(void* ctx, int y0, int y1);
+
+typedef struct {
+    double             busy_pct;
+    unsigned long long jobs;
+    unsigned long long steals;
+} JobWorkerStats;
+
+/**
+ * Start the worker pool
+ * @param workers Number of workers, 0 for one per core minus the caller
+ * @return 1 on success, 0 on failure
+ */
+int  jobs_init(int workers);
+void jobs_shutdown(void);
+int  jobs_worker_count(void);
+
+/**
+ * Run fn(ctx, 0..count-1) across the pool and wait for all of them
+ * The calling thread works on the batch too, so this is safe to call from
+ * any thread, including a worker. Without a pool it runs inline.
+ */
+void jobs_parallel_for(int count, JobFunc fn, void* ctx);
+
+/**
+ * Split rows [0, rows) into bands and run fn on each in parallel
+ * @param align Band heights are multiples of this (2 for 4:2:0 chroma)
+ */
+void jobs_parallel_rows(int rows, int align, JobRowsFunc fn, void* ctx);
+
+int  jobs_get_stats(JobWorkerStats* stats, int max);
+void jobs_log_stats(void);
+
+#endif
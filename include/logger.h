@@ -16,18 +16,19 @@ typedef enum {
 
 void log_output(log_lvl level, const char *file, int line, const char *fmt, ...);
 
+// Release builds keep warnings and up: they report what changed behind
+// the user's back (refused settings, quality steps) and never fire per frame.
 #ifdef CASTR_RELEASE
   #define log_trace(...) ((void)0)
   #define log_debug(...) ((void)0)
   #define log_info(...)  ((void)0)
-  #define log_warn(...)  ((void)0)
 #else
   #define log_trace(...) log_output(LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__)
   #define log_debug(...) log_output(LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
   #define log_info(...)  log_output(LOG_INFO, __FILE__, __LINE__, __VA_ARGS__)
-  #define log_warn(...)  log_output(LOG_WARN, __FILE__, __LINE__, __VA_ARGS__)
 #endif
 
+#define log_warn(...)  log_output(LOG_WARN, __FILE__, __LINE__, __VA_ARGS__)
 #define log_error(...) log_output(LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
 #define log_fatal(...) log_output(LOG_FATAL, __FILE__, __LINE__, __VA_ARGS__)
 
@@ -0,0 +1,82 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <stdbool.h>
+
+// Pipeline threads that --affinity and --priority apply to
+typedef enum {
+    CASTR_THREAD_CAPTURE,
+    CASTR_THREAD_COMPOSITOR,
+    CASTR_THREAD_ENCODER,
+    CASTR_THREAD_COUNT,
+} CastrThread;
+
+#define CASTR_MAX_SOURCES 8
+
+// A capture source from --add-source, composited beside the first one.
+typedef struct {
+    const char* name;          // "desktop" or "test"
+    int         monitor;
+    char        window[128];   // title, empty for the whole output
+    int         width, height; // test source size, 0 for the default
+    int         fps;           // grab rate, 0 for --fps
+} CastrSourceSpec;
+
+typedef struct {
+    const char* source;
+    int         monitor;
+    int         region_x, region_y;
+    int         region_w, region_h;
+    const char* window;
+    CastrSourceSpec extra_sources[CASTR_MAX_SOURCES - 1];
+    int         extra_source_count;
+    const char* output;
+    const char* font_path;
+    int         width, height;
+    int         out_width, out_height;
+    const char* scaler;
+    int         fps;
+    int         preview_fps; // cap on preview redraws
+    const char* codec;
+    const char* preset;
+    int         crf;
+    int         bitrate_kbps;
+    int         gop;
+    int         readback_depth;
+    int         jobs;
+    int         thread_cpu[CASTR_THREAD_COUNT];      // -1 leaves it to the OS
+    int         thread_priority[CASTR_THREAD_COUNT]; // ThreadPriority
+    bool        adaptive;
+    int         roi_qp;      // 0 leaves x264 without region hints
+    const char* intermediate;
+    double      rotate_sec;
+    int         rotate_mb;
+    const char* transcode;   // input of the transcode command, NULL to record
+    double      segment_sec;
+    const char* shm;         // shared-memory export name, NULL for none
+    const char* shm_format;
+    const char* snapshot;    // still images of the canvas, NULL for none
+    double      snapshot_sec;
+    int         snapshot_w, snapshot_h; // 0 for the canvas size
+    int         snapshot_quality;       // JPEG, 1-100
+    const char* audio;
+    const char* audio_codec;
+    int         audio_bitrate_kbps;
+    double      duration;
+    bool        headless;
+    bool        no_gl;
+    bool        probe;       // record the test source and verify the output
+    bool        control;     // take reconfiguration commands on stdin
+} CastrOptions;
+
+void options_defaults(CastrOptions* opts);
+
+/**
+ * Parse command-line arguments over the defaults
+ * @param opts Options to fill, must be initialised with options_defaults
+ * @return 1 to continue, 0 if help was printed, -1 on a bad argument
+ */
+int options_parse(CastrOptions* opts, int argc, char** argv);
+void options_usage(const char* argv0);
+
+#endif
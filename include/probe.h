@@ -0,0 +1,26 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+// End-to-end check for recordings of the "test" capture source. While
+// recording, the mux time of every video packet is kept; afterwards the
+// output is decoded, the stamp in each frame is read back and compared
+// with a regenerated reference.
+
+/**
+ * Start collecting packet mux times, call before init_encoder
+ * @param width Source frame size (the stamp is read relative to it)
+ * @param height Source frame height
+ * @param fps Encoder frame rate
+ * @param duration Recording length in seconds, sizes the table
+ * @return 1 on success, 0 on allocation failure
+ */
+int probe_begin(int width, int height, int fps, double duration);
+
+/**
+ * Decode a finished recording and report latency, drops and PSNR
+ * Prints a summary to stdout and writes per-frame rows to PATH.probe.csv.
+ * @return 1 if the recording passes, 0 otherwise
+ */
+int probe_analyze(const char* path);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef QUALITY_H
+#define QUALITY_H
+
+#include <stdbool.h>
+
+typedef struct {
+    const char* preset;        // starting preset
+    int         crf;           // starting CRF, unused when bitrate_kbps is set
+    int         bitrate_kbps;
+    int         width, height; // full output size
+    int         fps;
+    int         queue_limit;   // mean frames waiting on the encoder that count as backlog
+} QualityConfig;
+
+// One rung of the ladder. Level 0 is the configured quality; each step down
+// changes a single knob.
+typedef struct {
+    int preset; // index into the x264 preset list, -1 to keep the configured one
+    int crf;
+    int width, height;
+    int fps_divisor;
+} QualityLevel;
+
+/**
+ * Enable the controller and build the ladder from the encoder's capabilities
+ * Call after init_encoder; without it the other calls are no-ops.
+ */
+void quality_init(const QualityConfig* cfg);
+
+// Encoder thread. False for frames the current frame-rate divisor skips.
+bool quality_keep_frame(void);
+
+// Encoder thread. Feeds one encoded frame into the current window and, once
+// per window, steps the ladder up or down.
+void quality_frame_encoded(long long encode_us, int queue_depth);
+
+// Any thread. Frames lost before they reached the encoder.
+void quality_note_drops(long long frames);
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef READBACK_H
+#define READBACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <glad/glad.h>
+#include "threading.h"
+
+#define READBACK_MAX_SLOTS 8
+
+typedef enum {
+    READBACK_FREE,
+    READBACK_PENDING,  // glReadPixels issued, waiting on the fence
+    READBACK_READY,    // transfer complete, mapped, waiting for the encoder
+    READBACK_ENCODING, // held by the encoder thread
+    READBACK_DONE,     // released by the encoder, GL thread must recycle it
+} ReadbackSlotState;
+
+typedef struct {
+    GLuint            buffer;
+    GLsync            fence;
+    unsigned char*    mapped;
+    size_t            capacity;      // bytes allocated for the PBO
+    int               width, height; // of the frame it holds
+    size_t            stride;
+    long long         timestamp_us;
+    ReadbackSlotState state;
+} ReadbackSlot;
+
+typedef struct {
+    ReadbackSlot       slots[READBACK_MAX_SLOTS];
+    int                count;
+    int                width, height; // size of the next submit
+    size_t             stride;
+    size_t             size;
+    bool               persistent;
+    int                write_index;
+    int                read_index;
+    bool               closed;
+    unsigned long long dropped;
+    Mutex              lock;
+    Cond               ready;
+} ReadbackRing;
+
+// GL thread. Creates `count` PBOs (clamped to READBACK_MAX_SLOTS), persistently
+// mapped when the context supports GL 4.4 / ARB_buffer_storage.
+int  readback_init(ReadbackRing* ring, int width, int height, int count);
+
+// GL thread. Frames submitted from now on are width x height. Slots still
+// holding the old size are drained as usual, and a PBO that is too small is
+// reallocated the next time it is free.
+void readback_resize(ReadbackRing* ring, int width, int height);
+
+// GL thread, canvas FBO bound. Queues an async glReadPixels into the next
+// slot. Returns false and counts a drop if the encoder still holds it.
+bool readback_submit(ReadbackRing* ring);
+
+// GL thread. Moves slots whose fence has signalled to READY and recycles the
+// ones the encoder has released. Never blocks.
+void readback_poll(ReadbackRing* ring);
+
+// Encoder thread. Blocks until the oldest submitted frame is ready and
+// returns its top row; rows are bottom-up in the PBO so *stride is negative.
+// *timestamp_us is the time_now_us() of the submit. Returns NULL once the
+// ring is closed and drained.
+const unsigned char* readback_wait(ReadbackRing* ring, int* slot, int* stride,
+                                   long long* timestamp_us);
+void readback_release(ReadbackRing* ring, int slot);
+
+// Encoder thread. Size of the frame held in `slot` since readback_wait.
+void readback_frame_size(const ReadbackRing* ring, int slot, int* width, int* height);
+
+// Any thread. Frames read back and waiting for the encoder.
+int  readback_queued(ReadbackRing* ring);
+
+// GL thread. Finishes in-flight transfers and wakes the encoder so it can
+// drain the remaining frames and exit.
+void readback_close(ReadbackRing* ring);
+void readback_destroy(ReadbackRing* ring);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef ROI_H
+#define ROI_H
+
+#include <stdbool.h>
+#include "frame_alloc.h"
+
+// Changed-tile tracking for region-of-interest encoding. Each frame is
+// compared against the last one in ROI_TILE x ROI_TILE tiles; the encoder
+// turns the changed tiles into quantizer offsets.
+#define ROI_TILE 64
+
+typedef struct {
+    int            width, height;
+    int            cols, rows;
+    unsigned char* dirty;       // cols * rows, 1 where the tile changed
+    int            dirty_count; // of the last roi_update
+    FrameBuffer    prev;        // last frame, only changed tiles are copied
+    bool           primed;
+    long long      frames;
+    long long      dirty_total;
+} RoiTracker;
+
+/**
+ * Allocate the tracker for frames of the given size
+ * @return 1 on success, 0 if memory could not be committed
+ */
+int  roi_init(RoiTracker* roi, int width, int height);
+void roi_free(RoiTracker* roi);
+
+/**
+ * Compare a BGRA frame with the previous one and mark the changed tiles
+ * Every tile counts as changed on the first frame.
+ * @return Number of changed tiles
+ */
+int  roi_update(RoiTracker* roi, const unsigned char* bgra, int stride);
+
+static inline bool roi_dirty(const RoiTracker* roi, int col, int row) {
+    return roi->dirty[row * roi->cols + col] != 0;
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef SCALE_H
+#define SCALE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    SCALE_NONE,       // same size, convert only
+    SCALE_HALF,       // 1:2, 2x2 box filter
+    SCALE_TWO_THIRDS, // 2:3, 3x3 -> 2x2 area filter
+    SCALE_GENERIC,    // any other ratio, left to swscale
+} ScaleMode;
+
+ScaleMode scale_pick_mode(int src_w, int src_h, int dst_w, int dst_h);
+const char* scale_mode_name(ScaleMode mode);
+
+/**
+ * Downscale BGRA for SCALE_HALF or SCALE_TWO_THIRDS
+ * Strides are in bytes and may be negative for bottom-up images. Allocates
+ * its scratch line per call; per-frame callers use scale_bgra_rows.
+ * @param dst_w Output width, dst_h output height; the source must be
+ *              exactly 2x or 1.5x that size
+ */
+void scale_bgra(ScaleMode mode,
+                const uint8_t* src, int src_stride,
+                uint8_t* dst, int dst_stride, int dst_w, int dst_h);
+
+// Bytes of scratch scale_bgra_rows needs for `dst_w`, 0 if none.
+size_t scale_scratch_size(ScaleMode mode, int dst_w);
+
+// Output rows [y0, y1) only, for banding; y0 and y1 must be even for
+// SCALE_TWO_THIRDS. `scratch` holds scale_scratch_size() bytes, aligned to
+// FRAME_ALIGN, and is not shared between concurrent calls.
+void scale_bgra_rows(ScaleMode mode,
+                     const uint8_t* src, int src_stride,
+                     uint8_t* dst, int dst_stride, int dst_w, int y0, int y1,
+                     void* scratch);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef SHM_EXPORT_H
+#define SHM_EXPORT_H
+
+// Producer side of the shared-memory frame ring described in castr_shm.h.
+// One publisher thread at a time.
+
+/**
+ * Create the named ring for canvas-sized frames
+ * @param format "bgra" or "nv12"
+ * @return 1 on success, 0 if the object could not be created
+ */
+int  shm_export_open(const char* name, const char* format, int width, int height);
+
+/**
+ * Publish a canvas frame, converting to the ring's format
+ * Never waits for readers. Does nothing if the ring is not open.
+ * @param stride Bytes per row, negative for a bottom-up image
+ */
+void shm_export_publish(const unsigned char* bgra, int stride, long long timestamp_us);
+
+/**
+ * Follow a canvas size change with a ring under the next generation
+ * Readers see the old ring closed and open NAME again to find the new one;
+ * the old ring's name is not reused while they still map it.
+ * @return 1 if the ring is open at the new size (or not open at all)
+ */
+int  shm_export_resize(int width, int height);
+void shm_export_close(void);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+// Still images of the canvas (--snapshot). When one is due the encoder
+// thread copies the frame it already holds, straight from the readback
+// ring; scaling and QOI, PNG or JPEG encoding happen on a snapshot thread,
+// so neither capture nor encoding waits for it. A snapshot that finds both
+// frame copies still in use is dropped rather than queued.
+
+typedef struct {
+    const char* path;          // NULL for requests only; a "%d" numbers the
+                               // files, otherwise the file is replaced
+    double      interval_sec;  // 0 for requests only
+    int         width, height; // output size, 0 for the frame size
+    int         jpeg_quality;  // 1-100
+} SnapshotConfig;
+
+/**
+ * Start the snapshot thread
+ * @param width Frame size to allocate the copies for up front, 0 to
+ *              allocate them on the first snapshot
+ * @return 1 on success, 0 if the thread could not be started
+ */
+int  snapshot_start(const SnapshotConfig* cfg, int width, int height);
+
+// Writes what is queued, joins the thread and logs the totals.
+void snapshot_stop(void);
+
+/**
+ * Check a snapshot path: a known extension (.qoi, .png, .jpg or .jpeg)
+ * and at most one %d-style counter
+ * @return 1 if usable, 0 otherwise
+ */
+int  snapshot_path_ok(const char* path);
+
+// Encoder thread. Take the next frame offered to `path`, whatever the
+// interval; `path` must pass snapshot_path_ok and numbers its files from
+// the same counter.
+void snapshot_request(const char* path);
+
+// Encoder thread, for every frame. Copies it if a snapshot is due.
+void snapshot_offer(const unsigned char* bgra, int stride, int width, int height,
+                    long long timestamp_us);
+
+// Snapshots written and dropped, encode time and queue depth.
+void snapshot_log_stats(void);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef TEST_PATTERN_H
+#define TEST_PATTERN_H
+
+#include <stdint.h>
+
+// The stamp is a 16x6 grid of black/white cells in the top-left corner:
+// 32 bits of frame ID, the low 48 bits of the capture time in microseconds
+// and a 16-bit check. Cells are width/32 wide, so the stamp survives lossy
+// encoding and any aspect-preserving rescale.
+#define TEST_STAMP_COLS 16
+#define TEST_STAMP_ROWS 6
+#define TEST_STAMP_TS_BITS 48
+
+/**
+ * Render the synthetic frame for an ID and capture time
+ * The picture is a pure function of both, so it can be regenerated as the
+ * reference for a decoded frame.
+ */
+void test_pattern_draw(unsigned char* bgra, int stride, int width, int height,
+                       uint32_t frame_id, long long timestamp_us);
+
+/**
+ * Read the stamp back from a luma plane
+ * @param luma Y plane of a decoded frame (same aspect as the source)
+ * @param timestamp48 Low 48 bits of the capture time
+ * @return 1 if the check matches, 0 if the stamp is unreadable
+ */
+int test_pattern_read(const unsigned char* luma, int linesize, int width, int height,
+                      uint32_t* frame_id, long long* timestamp48);
+
+#endif
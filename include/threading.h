@@ -1,17 +1,160 @@
 #ifndef THREADING_H
 #define THREADING_H
 
-#include <windows.h>
 #include <stdbool.h>
 
-typedef struct {
-    unsigned char* frame_buffer;
-    bool has_new_frame;
-    bool encoder_has_work;
-    bool running;
-    CRITICAL_SECTION lock;
-    CONDITION_VARIABLE data_ready;
-    int width, height;
-} SharedState;
+// Threads, locks and counters over Win32 or pthreads. The Win32 types are
+// kept opaque (SRW locks and condition variables are one pointer each) so
+// <windows.h> stays out of everything that includes this.
+#ifdef _WIN32
+#include <intrin.h>
+typedef struct { void* impl; } Mutex;
+typedef struct { void* impl; } Cond;
+typedef void*                  Thread;
+#else
+#include <pthread.h>
+typedef pthread_mutex_t        Mutex;
+typedef pthread_cond_t         Cond;
+typedef pthread_t              Thread;
+#endif
+
+typedef void (*ThreadFunc)(void* arg);
+
+typedef enum {
+    THREAD_PRIO_NORMAL,
+    THREAD_PRIO_HIGH,     // above normal; a negative nice value on Linux
+    THREAD_PRIO_REALTIME, // TIME_CRITICAL on Windows, SCHED_FIFO on Linux
+} ThreadPriority;
+
+/**
+ * Start a thread running fn(arg)
+ * @return 1 on success, 0 if the thread could not be created
+ */
+int  thread_create(Thread* thread, ThreadFunc fn, void* arg);
+void thread_join(Thread thread);
+void thread_yield(void);
+
+/**
+ * Pin the calling thread to one logical CPU
+ * @return 1 on success, 0 (with a warning) if the OS refused
+ */
+int  thread_set_affinity(int cpu);
+
+/**
+ * Change the calling thread's scheduling priority
+ * HIGH and REALTIME usually need privileges (CAP_SYS_NICE, or an
+ * rtprio limit, on Linux).
+ * @return 1 on success, 0 (with a warning) if the OS refused
+ */
+int  thread_set_priority(ThreadPriority priority);
+
+// Logical CPUs available to the process
+int  cpu_count(void);
+
+void mutex_init(Mutex* m);
+void mutex_destroy(Mutex* m);
+void mutex_lock(Mutex* m);
+void mutex_unlock(Mutex* m);
+
+void cond_init(Cond* c);
+void cond_destroy(Cond* c);
+void cond_wait(Cond* c, Mutex* m);
+void cond_signal(Cond* c);
+void cond_broadcast(Cond* c);
+
+// Sequentially consistent counters for single-producer/single-consumer
+// handoff and flags shared between threads without taking a lock.
+#ifdef _WIN32
+typedef volatile long long atomic_i64;
+typedef volatile long      atomic_i32;
+
+static inline long long atomic_load_i64(atomic_i64* p) {
+    return _InterlockedCompareExchange64(p, 0, 0);
+}
+
+static inline void atomic_store_i64(atomic_i64* p, long long v) {
+    _InterlockedExchange64(p, v);
+}
+
+static inline long long atomic_add_i64(atomic_i64* p, long long v) {
+    return _InterlockedExchangeAdd64(p, v) + v;
+}
+
+// Stores v and returns the previous value.
+static inline long long atomic_exchange_i64(atomic_i64* p, long long v) {
+    return _InterlockedExchange64(p, v);
+}
+
+// Stores v if *p equals expected; returns the value *p held before.
+static inline long long atomic_cas_i64(atomic_i64* p, long long expected, long long v) {
+    return _InterlockedCompareExchange64(p, v, expected);
+}
+
+static inline int atomic_load_i32(atomic_i32* p) {
+    return (int)_InterlockedCompareExchange(p, 0, 0);
+}
+
+static inline void atomic_store_i32(atomic_i32* p, int v) {
+    _InterlockedExchange(p, v);
+}
+
+static inline int atomic_add_i32(atomic_i32* p, int v) {
+    return (int)_InterlockedExchangeAdd(p, v) + v;
+}
+
+static inline int atomic_exchange_i32(atomic_i32* p, int v) {
+    return (int)_InterlockedExchange(p, v);
+}
+
+// Full barrier; interlocked operations are one on every Windows target.
+static inline void atomic_fence(void) {
+    volatile long v = 0;
+    _InterlockedExchange(&v, 1);
+}
+#else
+typedef volatile long long atomic_i64;
+typedef volatile int       atomic_i32;
+
+static inline long long atomic_load_i64(atomic_i64* p) {
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_store_i64(atomic_i64* p, long long v) {
+    __atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+static inline long long atomic_add_i64(atomic_i64* p, long long v) {
+    return __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST);
+}
+
+static inline long long atomic_exchange_i64(atomic_i64* p, long long v) {
+    return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+static inline long long atomic_cas_i64(atomic_i64* p, long long expected, long long v) {
+    __atomic_compare_exchange_n(p, &expected, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return expected;
+}
+
+static inline int atomic_load_i32(atomic_i32* p) {
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_store_i32(atomic_i32* p, int v) {
+    __atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+static inline int atomic_add_i32(atomic_i32* p, int v) {
+    return __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST);
+}
+
+static inline int atomic_exchange_i32(atomic_i32* p, int v) {
+    return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_fence(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+#endif
 
 #endif
@@ -0,0 +1,26 @@
+#ifndef TRANSCODE_H
+#define TRANSCODE_H
+
+typedef struct {
+    const char* input;  // intermediate written with --intermediate
+    const char* output;
+    const char* codec;
+    const char* preset;
+    int         crf;
+    int         bitrate_kbps;
+    int         gop;
+    const char* audio_codec;
+    int         audio_bitrate_kbps;
+    double      segment_sec; // target segment length, 0 for automatic
+} TranscodeConfig;
+
+/**
+ * Re-encode an intermediate recording in parallel
+ * The input is split at keyframes into segments, each segment is encoded by
+ * its own encoder on the job system, audio is encoded alongside, and the
+ * results are joined into the output. Call jobs_init first.
+ * @return 1 on success, 0 on failure
+ */
+int transcode_run(const TranscodeConfig* cfg);
+
+#endif
@@ -30,4 +30,16 @@ unsigned long long fibonacci(int n);
  */
 int gcd(int a, int b);
 
+/**
+ * Read the monotonic high-resolution clock
+ * @return Microseconds since an arbitrary fixed point
+ */
+long long time_now_us(void);
+
+/**
+ * Sleep the calling thread
+ * @param ms Milliseconds to sleep, values <= 0 yield
+ */
+void time_sleep_ms(int ms);
+
 #endif // UTILS_H
\ No newline at end of file
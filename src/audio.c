@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <string.h>
+#include "audio.h"
+#include "encoder.h"
+#include "logger.h"
+#include "utils.h"
+
+#define AUDIO_BLOCK_MS   10
+#define AUDIO_RING_MS    2000
+#define AUDIO_RESYNC_MS  80
+#define AUDIO_REPORT_US  10000000LL
+
+typedef struct {
+    AudioSource*     src;
+    AudioRing        ring;
+    Thread           capture_thread;
+    Thread           encode_thread;
+    atomic_i32       running;
+    atomic_i32       source_ended;
+    atomic_i64       anchor_us;
+    long long        origin_us;
+    Mutex            stats_lock;
+    AudioStats       stats;
+} AudioState;
+
+static AudioState g_audio = {0};
+
+int audio_ring_init(AudioRing* ring, int channels, long long capacity) {
+    long long cap = 1;
+    while (cap < capacity) cap <<= 1;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->data = malloc(sizeof(float) * (size_t)(cap * channels));
+    if (!ring->data) return 0;
+    ring->channels = channels;
+    ring->capacity = cap;
+    return 1;
+}
+
+long long audio_ring_write(AudioRing* ring, const float* in, long long frames) {
+    long long w    = atomic_load_i64(&ring->write_pos);
+    long long r    = atomic_load_i64(&ring->read_pos);
+    long long space = ring->capacity - (w - r);
+    if (frames > space) frames = space;
+
+    long long idx   = w & (ring->capacity - 1);
+    long long first = ring->capacity - idx < frames ? ring->capacity - idx : frames;
+    memcpy(ring->data + idx * ring->channels, in,
+           sizeof(float) * (size_t)(first * ring->channels));
+    memcpy(ring->data, in + first * ring->channels,
+           sizeof(float) * (size_t)((frames - first) * ring->channels));
+
+    atomic_store_i64(&ring->write_pos, w + frames);
+    return frames;
+}
+
+long long audio_ring_read(AudioRing* ring, float* out, long long frames) {
+    long long r     = atomic_load_i64(&ring->read_pos);
+    long long avail = atomic_load_i64(&ring->write_pos) - r;
+    if (frames > avail) frames = avail;
+
+    long long idx   = r & (ring->capacity - 1);
+    long long first = ring->capacity - idx < frames ? ring->capacity - idx : frames;
+    if (out) {
+        memcpy(out, ring->data + idx * ring->channels,
+               sizeof(float) * (size_t)(first * ring->channels));
+        memcpy(out + first * ring->channels, ring->data,
+               sizeof(float) * (size_t)((frames - first) * ring->channels));
+    }
+
+    atomic_store_i64(&ring->read_pos, r + frames);
+    return frames;
+}
+
+long long audio_ring_available(AudioRing* ring) {
+    return atomic_load_i64(&ring->write_pos) - atomic_load_i64(&ring->read_pos);
+}
+
+void audio_ring_free(AudioRing* ring) {
+    free(ring->data);
+    ring->data = NULL;
+}
+
+static void audio_capture_func(void* arg) {
+    (void)arg;
+    AudioSource* src   = g_audio.src;
+    const int    block = src->sample_rate * AUDIO_BLOCK_MS / 1000;
+    float*       buf   = malloc(sizeof(float) * (size_t)block * src->channels);
+    if (!buf) {
+        atomic_store_i32(&g_audio.source_ended, 1);
+        return;
+    }
+
+    while (atomic_load_i32(&g_audio.running)) {
+        int n = src->read(src, buf, block);
+        if (n <= 0) {
+            if (n < 0) log_error("Audio source read failed");
+            else       log_info("Audio source reached end of stream");
+            break;
+        }
+
+        if (!atomic_load_i64(&g_audio.anchor_us))
+            atomic_store_i64(&g_audio.anchor_us,
+                time_now_us() - (long long)n * 1000000 / src->sample_rate);
+
+        long long written = audio_ring_write(&g_audio.ring, buf, n);
+        if (written < n) {
+            mutex_lock(&g_audio.stats_lock);
+            g_audio.stats.overruns += (unsigned long long)(n - written);
+            mutex_unlock(&g_audio.stats_lock);
+        }
+    }
+
+    atomic_store_i32(&g_audio.source_ended, 1);
+    free(buf);
+}
+
+static void log_stats(void) {
+    AudioStats stats;
+    audio_get_stats(&stats);
+    log_info("Audio: drift %.1f ms, %llu underruns, %llu overrun frames, %llu frames skipped",
+             stats.drift_ms, stats.underruns, stats.overruns, stats.dropped_frames);
+}
+
+// Timestamps come from counting samples, anchored to the monotonic time of
+// the first captured sample. When the source clock wanders more than
+// AUDIO_RESYNC_MS from the monotonic clock we insert silence (source behind,
+// an underrun) or skip samples (source ahead) so audio stays on the video
+// timeline.
+static void audio_encode_func(void* arg) {
+    (void)arg;
+    const int rate       = g_audio.src->sample_rate;
+    const int channels   = g_audio.src->channels;
+    const int frame_size = encoder_audio_frame_size();
+    const long long resync = (long long)rate * AUDIO_RESYNC_MS / 1000;
+
+    float* buf = calloc((size_t)frame_size * channels, sizeof(float));
+    if (!buf) return;
+
+    long long anchor = 0, pts = 0;
+    long long next_report = time_now_us() + AUDIO_REPORT_US;
+
+    while (atomic_load_i32(&g_audio.running)) {
+        if (!anchor) {
+            anchor = atomic_load_i64(&g_audio.anchor_us);
+            if (!anchor) {
+                if (atomic_load_i32(&g_audio.source_ended)) break;
+                time_sleep_ms(2);
+                continue;
+            }
+            pts = (anchor - g_audio.origin_us) * rate / 1000000;
+            if (pts < 0) pts = 0;
+        }
+
+        long long now      = time_now_us();
+        long long expected = (now - g_audio.origin_us) * rate / 1000000;
+        long long buffered = audio_ring_available(&g_audio.ring);
+        long long drift    = pts + buffered - expected;
+
+        mutex_lock(&g_audio.stats_lock);
+        g_audio.stats.drift_ms = (double)drift * 1000.0 / rate;
+        mutex_unlock(&g_audio.stats_lock);
+
+        if (now >= next_report) {
+            log_stats();
+            next_report = now + AUDIO_REPORT_US;
+        }
+
+        if (buffered >= frame_size && drift > resync) {
+            audio_ring_read(&g_audio.ring, NULL, frame_size);
+            mutex_lock(&g_audio.stats_lock);
+            g_audio.stats.dropped_frames += (unsigned long long)frame_size;
+            mutex_unlock(&g_audio.stats_lock);
+        } else if (buffered >= frame_size) {
+            audio_ring_read(&g_audio.ring, buf, frame_size);
+            encode_audio(buf, frame_size, pts);
+            pts += frame_size;
+        } else if (drift < -resync && !atomic_load_i32(&g_audio.source_ended)) {
+            long long have = audio_ring_read(&g_audio.ring, buf, buffered);
+            memset(buf + have * channels, 0,
+                   sizeof(float) * (size_t)((frame_size - have) * channels));
+            encode_audio(buf, frame_size, pts);
+            pts += frame_size;
+            mutex_lock(&g_audio.stats_lock);
+            g_audio.stats.underruns++;
+            mutex_unlock(&g_audio.stats_lock);
+        } else if (atomic_load_i32(&g_audio.source_ended)) {
+            break;
+        } else {
+            time_sleep_ms(2);
+        }
+    }
+
+    while (audio_ring_available(&g_audio.ring) >= frame_size) {
+        audio_ring_read(&g_audio.ring, buf, frame_size);
+        encode_audio(buf, frame_size, pts);
+        pts += frame_size;
+    }
+
+    free(buf);
+}
+
+int audio_start(AudioSource* src, long long clock_origin_us) {
+    memset(&g_audio, 0, sizeof(g_audio));
+    g_audio.src       = src;
+    g_audio.origin_us = clock_origin_us;
+    g_audio.running   = 1;
+
+    long long capacity = (long long)src->sample_rate * AUDIO_RING_MS / 1000;
+    if (!audio_ring_init(&g_audio.ring, src->channels, capacity)) {
+        log_error("Failed to allocate audio ring");
+        audio_source_close(src);
+        g_audio.src = NULL;
+        return 0;
+    }
+    mutex_init(&g_audio.stats_lock);
+
+    if (!thread_create(&g_audio.capture_thread, audio_capture_func, NULL)) {
+        log_error("Failed to start audio capture thread");
+        goto fail;
+    }
+    if (!thread_create(&g_audio.encode_thread, audio_encode_func, NULL)) {
+        log_error("Failed to start audio encode thread");
+        atomic_store_i32(&g_audio.running, 0);
+        thread_join(g_audio.capture_thread);
+        goto fail;
+    }
+
+    log_info("Audio started: %d Hz, %d channels", src->sample_rate, src->channels);
+    return 1;
+
+fail:
+    mutex_destroy(&g_audio.stats_lock);
+    audio_ring_free(&g_audio.ring);
+    audio_source_close(src);
+    g_audio.src = NULL;
+    return 0;
+}
+
+void audio_stop(void) {
+    if (!g_audio.src) return;
+
+    atomic_store_i32(&g_audio.running, 0);
+    thread_join(g_audio.capture_thread);
+    thread_join(g_audio.encode_thread);
+
+    log_stats();
+
+    audio_ring_free(&g_audio.ring);
+    audio_source_close(g_audio.src);
+    mutex_destroy(&g_audio.stats_lock);
+    g_audio.src = NULL;
+}
+
+void audio_get_stats(AudioStats* stats) {
+    if (!g_audio.src) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    mutex_lock(&g_audio.stats_lock);
+    *stats = g_audio.stats;
+    mutex_unlock(&g_audio.stats_lock);
+}
@@ -0,0 +1,284 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "audio.h"
+#include "logger.h"
+#include "utils.h"
+
+#ifdef CASTR_HAVE_PULSE
+#include <pulse/simple.h>
+#include <pulse/error.h>
+#endif
+
+#define AUDIO_DEFAULT_RATE     48000
+#define AUDIO_DEFAULT_CHANNELS 2
+
+// Paces file and generator sources to real time so they behave like a
+// capture device.
+typedef struct {
+    long long start_us;
+    long long frames;
+} Pacer;
+
+static void pacer_wait(Pacer* p, int sample_rate, int frames) {
+    if (!p->start_us) p->start_us = time_now_us();
+    p->frames += frames;
+    long long due  = p->start_us + p->frames * 1000000 / sample_rate;
+    long long wait = due - time_now_us();
+    if (wait > 0) time_sleep_ms((int)(wait / 1000));
+}
+
+static AudioSource* source_alloc(int sample_rate, int channels, size_t impl_size) {
+    AudioSource* src = calloc(1, sizeof(AudioSource));
+    if (!src) return NULL;
+    src->impl = calloc(1, impl_size);
+    if (!src->impl) {
+        free(src);
+        return NULL;
+    }
+    src->sample_rate = sample_rate;
+    src->channels    = channels;
+    return src;
+}
+
+static void source_free(AudioSource* src) {
+    free(src->impl);
+    free(src);
+}
+
+/* Sine generator */
+
+typedef struct {
+    Pacer  pacer;
+    double phase;
+    double step;
+} SineSource;
+
+static int sine_read(AudioSource* src, float* out, int frames) {
+    SineSource* s = src->impl;
+    for (int i = 0; i < frames; i++) {
+        float v = (float)(0.25 * sin(s->phase));
+        s->phase += s->step;
+        if (s->phase > 2.0 * 3.14159265358979323846) s->phase -= 2.0 * 3.14159265358979323846;
+        for (int c = 0; c < src->channels; c++)
+            *out++ = v;
+    }
+    pacer_wait(&s->pacer, src->sample_rate, frames);
+    return frames;
+}
+
+AudioSource* audio_source_sine(int sample_rate, int channels, double freq) {
+    AudioSource* src = source_alloc(sample_rate, channels, sizeof(SineSource));
+    if (!src) return NULL;
+    SineSource* s = src->impl;
+    s->step      = 2.0 * 3.14159265358979323846 * freq / sample_rate;
+    src->read    = sine_read;
+    src->destroy = source_free;
+    return src;
+}
+
+/* WAV file: PCM 16/24/32-bit or 32-bit float */
+
+typedef struct {
+    Pacer          pacer;
+    FILE*          file;
+    int            format;
+    int            bits;
+    long           remaining;
+    unsigned char* raw;
+    int            raw_frames;
+} WavSource;
+
+static unsigned read_u32(const unsigned char* p) {
+    return (unsigned)p[0] | (unsigned)p[1] << 8 | (unsigned)p[2] << 16 | (unsigned)p[3] << 24;
+}
+
+static unsigned read_u16(const unsigned char* p) {
+    return (unsigned)p[0] | (unsigned)p[1] << 8;
+}
+
+static int wav_read(AudioSource* src, float* out, int frames) {
+    WavSource* w     = src->impl;
+    int        bytes = w->bits / 8;
+    int        frame = bytes * src->channels;
+
+    if (frames > w->raw_frames) {
+        unsigned char* raw = realloc(w->raw, (size_t)frames * frame);
+        if (!raw) return -1;
+        w->raw        = raw;
+        w->raw_frames = frames;
+    }
+    if ((long)frames * frame > w->remaining)
+        frames = (int)(w->remaining / frame);
+    if (frames <= 0) return 0;
+
+    size_t got = fread(w->raw, frame, (size_t)frames, w->file);
+    w->remaining -= (long)got * frame;
+    if (got == 0) return 0;
+
+    const unsigned char* p = w->raw;
+    for (size_t i = 0; i < got * src->channels; i++, p += bytes) {
+        if (w->format == 3) {
+            float f;
+            memcpy(&f, p, sizeof(f));
+            out[i] = f;
+        } else if (bytes == 2) {
+            out[i] = (float)(short)read_u16(p) / 32768.0f;
+        } else if (bytes == 3) {
+            int v = (int)((unsigned)p[0] << 8 | (unsigned)p[1] << 16 | (unsigned)p[2] << 24) >> 8;
+            out[i] = (float)v / 8388608.0f;
+        } else {
+            out[i] = (float)((double)(int)read_u32(p) / 2147483648.0);
+        }
+    }
+
+    pacer_wait(&w->pacer, src->sample_rate, (int)got);
+    return (int)got;
+}
+
+static void wav_destroy(AudioSource* src) {
+    WavSource* w = src->impl;
+    if (w->file) fclose(w->file);
+    free(w->raw);
+    source_free(src);
+}
+
+AudioSource* audio_source_wav(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        log_error("WAV file not found: %s", path);
+        return NULL;
+    }
+
+    unsigned char hdr[12];
+    if (fread(hdr, 1, 12, f) != 12 || memcmp(hdr, "RIFF", 4) || memcmp(hdr + 8, "WAVE", 4)) {
+        log_error("Not a RIFF/WAVE file: %s", path);
+        fclose(f);
+        return NULL;
+    }
+
+    int format = 0, channels = 0, rate = 0, bits = 0;
+    long data_size = -1;
+    unsigned char chunk[8];
+    while (fread(chunk, 1, 8, f) == 8) {
+        unsigned size = read_u32(chunk + 4);
+        if (!memcmp(chunk, "fmt ", 4)) {
+            unsigned char fmt[40] = {0};
+            if (size < 16 || fread(fmt, 1, size < sizeof(fmt) ? size : sizeof(fmt), f) < 16)
+                break;
+            if (size > sizeof(fmt)) fseek(f, (long)(size - sizeof(fmt)), SEEK_CUR);
+            format   = (int)read_u16(fmt);
+            channels = (int)read_u16(fmt + 2);
+            rate     = (int)read_u32(fmt + 4);
+            bits     = (int)read_u16(fmt + 14);
+            if (format == 0xFFFE && size >= 26) format = (int)read_u16(fmt + 24);
+        } else if (!memcmp(chunk, "data", 4)) {
+            data_size = (long)size;
+            break;
+        } else {
+            fseek(f, (long)(size + (size & 1)), SEEK_CUR);
+        }
+    }
+
+    bool supported = (format == 1 && (bits == 16 || bits == 24 || bits == 32)) ||
+                     (format == 3 && bits == 32);
+    if (data_size < 0 || !supported || channels < 1 || channels > 2 || rate <= 0) {
+        log_error("Unsupported WAV (format %d, %d bits, %d channels): %s",
+                  format, bits, channels, path);
+        fclose(f);
+        return NULL;
+    }
+
+    AudioSource* src = source_alloc(rate, channels, sizeof(WavSource));
+    if (!src) {
+        fclose(f);
+        return NULL;
+    }
+    WavSource* w = src->impl;
+    w->file      = f;
+    w->format    = format;
+    w->bits      = bits;
+    w->remaining = data_size;
+    src->read    = wav_read;
+    src->destroy = wav_destroy;
+    return src;
+}
+
+/* PulseAudio (also served by pipewire-pulse) */
+
+#ifdef CASTR_HAVE_PULSE
+static int pulse_read(AudioSource* src, float* out, int frames) {
+    int err;
+    if (pa_simple_read((pa_simple*)src->impl, out,
+                       sizeof(float) * (size_t)frames * src->channels, &err) < 0) {
+        log_error("pa_simple_read failed: %s", pa_strerror(err));
+        return -1;
+    }
+    return frames;
+}
+
+static void pulse_destroy(AudioSource* src) {
+    pa_simple_free((pa_simple*)src->impl);
+    free(src);
+}
+
+AudioSource* audio_source_pulse(const char* device, int sample_rate, int channels) {
+    pa_sample_spec spec = {
+        .format   = PA_SAMPLE_FLOAT32LE,
+        .rate     = (uint32_t)sample_rate,
+        .channels = (uint8_t)channels,
+    };
+    pa_buffer_attr attr = {
+        .maxlength = (uint32_t)-1,
+        .fragsize  = (uint32_t)(sizeof(float) * channels * sample_rate / 100),
+    };
+
+    int err;
+    pa_simple* pa = pa_simple_new(NULL, "Castr", PA_STREAM_RECORD, device,
+                                  "capture", &spec, NULL, &attr, &err);
+    if (!pa) {
+        log_error("pa_simple_new failed: %s", pa_strerror(err));
+        return NULL;
+    }
+
+    AudioSource* src = calloc(1, sizeof(AudioSource));
+    if (!src) {
+        pa_simple_free(pa);
+        return NULL;
+    }
+    src->sample_rate = sample_rate;
+    src->channels    = channels;
+    src->impl        = pa;
+    src->read        = pulse_read;
+    src->destroy     = pulse_destroy;
+    return src;
+}
+#else
+AudioSource* audio_source_pulse(const char* device, int sample_rate, int channels) {
+    (void)device; (void)sample_rate; (void)channels;
+    log_error("Castr was built without PulseAudio support");
+    return NULL;
+}
+#endif
+
+AudioSource* audio_source_open(const char* spec) {
+    const char* arg = strchr(spec, ':');
+    size_t      len = arg ? (size_t)(arg - spec) : strlen(spec);
+    if (arg) arg++;
+
+    if (len == 4 && !strncmp(spec, "sine", 4))
+        return audio_source_sine(AUDIO_DEFAULT_RATE, AUDIO_DEFAULT_CHANNELS,
+                                 arg ? atof(arg) : 440.0);
+    if (len == 3 && !strncmp(spec, "wav", 3) && arg)
+        return audio_source_wav(arg);
+    if (len == 5 && !strncmp(spec, "pulse", 5))
+        return audio_source_pulse(arg, AUDIO_DEFAULT_RATE, AUDIO_DEFAULT_CHANNELS);
+
+    log_error("Unknown audio source: %s", spec);
+    return NULL;
+}
+
+void audio_source_close(AudioSource* src) {
+    if (src) src->destroy(src);
+}
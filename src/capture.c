@@ -0,0 +1,89 @@
+#include <string.h>
+#include "capture.h"
+#include "jobs.h"
+#include "logger.h"
+#include "utils.h"
+
+CaptureSource* capture_open(const char* name, const CaptureConfig* cfg) {
+    CaptureSource* src = NULL;
+    if (!strcmp(name, "desktop")) {
+#if defined(_WIN32)
+        src = capture_open_dxgi(cfg);
+#elif defined(CASTR_HAVE_X11)
+        src = capture_open_x11(cfg);
+#else
+        log_error("No desktop capture backend in this build");
+#endif
+    } else if (!strcmp(name, "test")) {
+        src = capture_open_test(cfg);
+    } else {
+        log_error("Unknown capture source: %s", name);
+    }
+
+    if (src)
+        log_info("Capture: %s %dx%d", src->name, src->width, src->height);
+    return src;
+}
+
+void capture_close(CaptureSource* src) {
+    if (src) src->destroy(src);
+}
+
+int capture_clip_region(CaptureRegion* region, int output_w, int output_h) {
+    if (region->x < 0) region->x = 0;
+    if (region->y < 0) region->y = 0;
+    if (region->x >= output_w || region->y >= output_h) return 0;
+
+    int max_w = output_w - region->x;
+    int max_h = output_h - region->y;
+    if (region->width  <= 0 || region->width  > max_w) region->width  = max_w;
+    if (region->height <= 0 || region->height > max_h) region->height = max_h;
+
+    // 4:2:0 encoding needs even dimensions.
+    region->width  &= ~1;
+    region->height &= ~1;
+    return region->width > 0 && region->height > 0;
+}
+
+int capture_pace(long long* next_us, long long interval_us, int timeout_ms) {
+    long long now = time_now_us();
+    if (now < *next_us) {
+        long long wait = *next_us - now;
+        if (wait > (long long)timeout_ms * 1000) {
+            time_sleep_ms(timeout_ms);
+            return 0;
+        }
+        time_sleep_ms((int)(wait / 1000));
+    }
+    *next_us += interval_us;
+    if (*next_us <= now) *next_us = now + interval_us;
+    return 1;
+}
+
+typedef struct {
+    unsigned char*       dst;
+    size_t               dst_pitch;
+    const unsigned char* src;
+    size_t               src_pitch;
+    size_t               row_bytes;
+} CopyJob;
+
+static void copy_rows(void* ctx, int y0, int y1) {
+    const CopyJob* job = ctx;
+    for (int row = y0; row < y1; row++)
+        memcpy(job->dst + row * job->dst_pitch, job->src + row * job->src_pitch,
+               job->row_bytes);
+}
+
+void capture_copy(unsigned char* dst, size_t dst_pitch,
+                  const unsigned char* src, size_t src_pitch,
+                  size_t row_bytes, int rows) {
+    CopyJob job = {
+        .dst       = dst,
+        .dst_pitch = dst_pitch,
+        .src       = src,
+        .src_pitch = src_pitch,
+        .row_bytes = row_bytes,
+    };
+    jobs_parallel_rows(rows, 1, copy_rows, &job);
+}
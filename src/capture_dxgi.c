@@ -0,0 +1,376 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <windows.h>
+#include <d3d11.h>
+#include <dxgi1_2.h>
+
+#include "capture.h"
+#include "logger.h"
+
+typedef struct {
+    ID3D11Device*           device;
+    ID3D11DeviceContext*    context;
+    IDXGIOutput1*           output;
+    IDXGIOutputDuplication* duplication;
+    ID3D11Texture2D*        staging_tex;
+    RECT                    bounds;    // output rectangle on the virtual desktop
+    CaptureRegion           requested; // --region as given, re-clipped on mode changes
+    CaptureRegion           region;    // crop, relative to the output
+    HWND                    window;
+} DxgiCapture;
+
+// Outputs are numbered across all adapters in enumeration order. With a
+// window, the output showing most of it is picked instead.
+static int find_output(int index, HWND window, IDXGIAdapter1** adapter_out,
+                       IDXGIOutput** output_out) {
+    IDXGIFactory1* factory = NULL;
+    HRESULT hr = CreateDXGIFactory1(&IID_IDXGIFactory1, (void**)&factory);
+    if (FAILED(hr)) {
+        log_error("CreateDXGIFactory1 failed: 0x%08X", hr);
+        return 0;
+    }
+
+    HMONITOR monitor = window ? MonitorFromWindow(window, MONITOR_DEFAULTTONEAREST) : NULL;
+    IDXGIAdapter1* adapter = NULL;
+    int n = 0, found = 0;
+
+    for (UINT a = 0; !found &&
+         factory->lpVtbl->EnumAdapters1(factory, a, &adapter) != DXGI_ERROR_NOT_FOUND; a++) {
+        IDXGIOutput* output = NULL;
+        for (UINT o = 0;
+             adapter->lpVtbl->EnumOutputs(adapter, o, &output) != DXGI_ERROR_NOT_FOUND; o++) {
+            DXGI_OUTPUT_DESC desc;
+            output->lpVtbl->GetDesc(output, &desc);
+            if (monitor ? desc.Monitor == monitor : n == index) {
+                *adapter_out = adapter;
+                *output_out  = output;
+                found = 1;
+                break;
+            }
+            output->lpVtbl->Release(output);
+            n++;
+        }
+        if (!found) adapter->lpVtbl->Release(adapter);
+    }
+    factory->lpVtbl->Release(factory);
+
+    if (!found)
+        log_error("Display output %d not found (%d available)", index, n);
+    return found;
+}
+
+static int create_duplication(DxgiCapture* c) {
+    if (c->duplication) {
+        c->duplication->lpVtbl->Release(c->duplication);
+        c->duplication = NULL;
+    }
+
+    HRESULT hr = c->output->lpVtbl->DuplicateOutput(
+        c->output, (IUnknown*)c->device, &c->duplication);
+    if (FAILED(hr)) {
+        log_error("DuplicateOutput failed: 0x%08X", hr);
+        c->duplication = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+// Keeps the crop over a window as it moves. Size changes go through
+// refresh_geometry instead, since every downstream buffer is sized from it.
+static int track_window(DxgiCapture* c) {
+    RECT rc;
+    if (!IsWindow(c->window) || !GetWindowRect(c->window, &rc)) return 0;
+
+    int out_w = c->bounds.right - c->bounds.left;
+    int out_h = c->bounds.bottom - c->bounds.top;
+    int x = rc.left - c->bounds.left;
+    int y = rc.top - c->bounds.top;
+    if (x > out_w - c->region.width)  x = out_w - c->region.width;
+    if (y > out_h - c->region.height) y = out_h - c->region.height;
+    c->region.x = x < 0 ? 0 : x;
+    c->region.y = y < 0 ? 0 : y;
+    return 1;
+}
+
+static int create_staging(DxgiCapture* c, int width, int height) {
+    D3D11_TEXTURE2D_DESC tex_desc = {0};
+    tex_desc.Width                = (UINT)width;
+    tex_desc.Height               = (UINT)height;
+    tex_desc.MipLevels            = 1;
+    tex_desc.ArraySize            = 1;
+    tex_desc.Format               = DXGI_FORMAT_B8G8R8A8_UNORM;
+    tex_desc.SampleDesc.Count     = 1;
+    tex_desc.Usage                = D3D11_USAGE_STAGING;
+    tex_desc.BindFlags            = 0;
+    tex_desc.CPUAccessFlags       = D3D11_CPU_ACCESS_READ;
+    tex_desc.MiscFlags            = 0;
+    HRESULT hr = c->device->lpVtbl->CreateTexture2D(c->device, &tex_desc, NULL, &c->staging_tex);
+    if (FAILED(hr)) {
+        log_error("CreateTexture2D (staging) failed: 0x%08X", hr);
+        c->staging_tex = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+static int output_size(DxgiCapture* c, int* w, int* h) {
+    *w = c->bounds.right - c->bounds.left;
+    *h = c->bounds.bottom - c->bounds.top;
+    return *w > 0 && *h > 0;
+}
+
+// Captured size for the current window rectangle, before it is tracked.
+static bool window_resized(DxgiCapture* c) {
+    RECT rc;
+    int out_w, out_h;
+    if (!GetWindowRect(c->window, &rc) || !output_size(c, &out_w, &out_h))
+        return false; // a closed window is reported by track_window
+    CaptureRegion r = { 0, 0, rc.right - rc.left, rc.bottom - rc.top };
+    capture_clip_region(&r, out_w, out_h);
+    return r.width != c->region.width || r.height != c->region.height;
+}
+
+// Re-reads the output bounds and the window after a mode change or a
+// window resize. A new capture size replaces the staging texture and is
+// reported as CAPTURE_RESIZED.
+static int refresh_geometry(CaptureSource* src) {
+    DxgiCapture* c = src->impl;
+    DXGI_OUTPUT_DESC desc;
+    c->output->lpVtbl->GetDesc(c->output, &desc);
+    c->bounds = desc.DesktopCoordinates;
+
+    int out_w, out_h;
+    output_size(c, &out_w, &out_h);
+    CaptureRegion region = c->requested;
+    if (c->window) {
+        RECT rc;
+        if (!IsWindow(c->window) || !GetWindowRect(c->window, &rc)) {
+            log_error("Captured window was closed");
+            return -1;
+        }
+        // Only the size; track_window keeps the position inside the output.
+        region = (CaptureRegion){ 0, 0, rc.right - rc.left, rc.bottom - rc.top };
+    }
+    if (!capture_clip_region(&region, out_w, out_h)) {
+        log_error("Capture region is outside the output (%dx%d)", out_w, out_h);
+        return -1;
+    }
+
+    const bool resized = region.width != src->width || region.height != src->height;
+    if (resized) {
+        if (c->staging_tex) c->staging_tex->lpVtbl->Release(c->staging_tex);
+        c->staging_tex = NULL;
+        if (!create_staging(c, region.width, region.height)) return -1;
+        src->width  = region.width;
+        src->height = region.height;
+    }
+    if (c->window) {
+        c->region.width  = region.width;
+        c->region.height = region.height;
+        track_window(c);
+    } else {
+        c->region = region;
+    }
+
+    if (resized)
+        log_info("DXGI output %dx%d, capture resized to %dx%d", out_w, out_h,
+                 src->width, src->height);
+    return resized ? CAPTURE_RESIZED : 0;
+}
+
+static int dxgi_grab(CaptureSource* src, unsigned char* out, int stride, int timeout_ms) {
+    DxgiCapture* c = src->impl;
+
+    if (!c->duplication && !create_duplication(c)) {
+        Sleep(timeout_ms);
+        return 0;
+    }
+
+    if (c->window && window_resized(c))
+        return refresh_geometry(src);
+
+    IDXGIResource*          res  = NULL;
+    DXGI_OUTDUPL_FRAME_INFO info = {0};
+
+    HRESULT hr = c->duplication->lpVtbl->AcquireNextFrame(
+        c->duplication, timeout_ms, &info, &res);
+
+    if (hr == DXGI_ERROR_WAIT_TIMEOUT) return 0;
+
+    // Mode changes, among others, end the duplication.
+    if (hr == DXGI_ERROR_ACCESS_LOST) {
+        log_error("Desktop duplication access lost, recreating...");
+        if (!create_duplication(c)) return 0;
+        return refresh_geometry(src);
+    }
+
+    if (FAILED(hr)) {
+        log_error("AcquireNextFrame failed: 0x%08X", hr);
+        return 0;
+    }
+
+    if (info.LastPresentTime.QuadPart == 0) {
+        res->lpVtbl->Release(res);
+        c->duplication->lpVtbl->ReleaseFrame(c->duplication);
+        return 0;
+    }
+
+    if (c->window && !track_window(c)) {
+        res->lpVtbl->Release(res);
+        c->duplication->lpVtbl->ReleaseFrame(c->duplication);
+        log_error("Captured window was closed");
+        return -1;
+    }
+
+    ID3D11Texture2D* tex = NULL;
+    hr = res->lpVtbl->QueryInterface(res, &IID_ID3D11Texture2D, (void**)&tex);
+    if (FAILED(hr) || !tex) {
+        res->lpVtbl->Release(res);
+        c->duplication->lpVtbl->ReleaseFrame(c->duplication);
+        return 0;
+    }
+
+    // The staging texture and everything after it are 8-bit BGRA; an HDR or
+    // 10-bit desktop hands out other formats that cannot be copied into it.
+    D3D11_TEXTURE2D_DESC tex_desc;
+    tex->lpVtbl->GetDesc(tex, &tex_desc);
+    if (tex_desc.Format != DXGI_FORMAT_B8G8R8A8_UNORM &&
+        tex_desc.Format != DXGI_FORMAT_B8G8R8A8_UNORM_SRGB) {
+        tex->lpVtbl->Release(tex);
+        res->lpVtbl->Release(res);
+        c->duplication->lpVtbl->ReleaseFrame(c->duplication);
+        log_error("Desktop format %d is not 8-bit BGRA (HDR or 10-bit output?), "
+                  "which DXGI capture does not support", (int)tex_desc.Format);
+        return -1;
+    }
+
+    // Only the region leaves the desktop image; the staging texture is
+    // region-sized.
+    D3D11_BOX box = {
+        .left   = (UINT)c->region.x,
+        .top    = (UINT)c->region.y,
+        .front  = 0,
+        .right  = (UINT)(c->region.x + c->region.width),
+        .bottom = (UINT)(c->region.y + c->region.height),
+        .back   = 1,
+    };
+    c->context->lpVtbl->CopySubresourceRegion(
+        c->context, (ID3D11Resource*)c->staging_tex, 0, 0, 0, 0,
+        (ID3D11Resource*)tex, 0, &box);
+
+    tex->lpVtbl->Release(tex);
+    res->lpVtbl->Release(res);
+    c->duplication->lpVtbl->ReleaseFrame(c->duplication);
+
+    D3D11_MAPPED_SUBRESOURCE mapped = {0};
+    hr = c->context->lpVtbl->Map(
+        c->context, (ID3D11Resource*)c->staging_tex,
+        0, D3D11_MAP_READ, 0, &mapped);
+    if (FAILED(hr)) {
+        log_error("Map failed: 0x%08X", hr);
+        return 0;
+    }
+
+    capture_copy(out, (size_t)stride, (const unsigned char*)mapped.pData,
+                 mapped.RowPitch, (size_t)src->width * 4, src->height);
+
+    c->context->lpVtbl->Unmap(c->context, (ID3D11Resource*)c->staging_tex, 0);
+    return 1;
+}
+
+static void dxgi_destroy(CaptureSource* src) {
+    DxgiCapture* c = src->impl;
+    if (c->staging_tex) c->staging_tex->lpVtbl->Release(c->staging_tex);
+    if (c->duplication) c->duplication->lpVtbl->Release(c->duplication);
+    if (c->output)      c->output->lpVtbl->Release(c->output);
+    if (c->context)     c->context->lpVtbl->Release(c->context);
+    if (c->device)      c->device->lpVtbl->Release(c->device);
+    free(c);
+    free(src);
+}
+
+CaptureSource* capture_open_dxgi(const CaptureConfig* cfg) {
+    HWND window = NULL;
+    if (cfg->window) {
+        window = FindWindowA(NULL, cfg->window);
+        if (!window) {
+            log_error("Window not found: %s", cfg->window);
+            return NULL;
+        }
+    }
+
+    IDXGIAdapter1* adapter = NULL;
+    IDXGIOutput*   output  = NULL;
+    if (!find_output(cfg->output, window, &adapter, &output)) return NULL;
+
+    CaptureSource* src = calloc(1, sizeof(CaptureSource));
+    DxgiCapture*   c   = calloc(1, sizeof(DxgiCapture));
+    if (!src || !c) {
+        free(src);
+        free(c);
+        output->lpVtbl->Release(output);
+        adapter->lpVtbl->Release(adapter);
+        return NULL;
+    }
+    src->name    = "dxgi";
+    src->grab    = dxgi_grab;
+    src->destroy = dxgi_destroy;
+    src->impl    = c;
+    c->window    = window;
+
+    // The device has to live on the output's adapter for DuplicateOutput.
+    D3D_FEATURE_LEVEL fl;
+    HRESULT hr = D3D11CreateDevice(
+        (IDXGIAdapter*)adapter, D3D_DRIVER_TYPE_UNKNOWN, NULL, 0,
+        NULL, 0, D3D11_SDK_VERSION,
+        &c->device, &fl, &c->context);
+    if (SUCCEEDED(hr))
+        hr = output->lpVtbl->QueryInterface(output, &IID_IDXGIOutput1, (void**)&c->output);
+
+    DXGI_OUTPUT_DESC desc;
+    output->lpVtbl->GetDesc(output, &desc);
+    c->bounds = desc.DesktopCoordinates;
+    output->lpVtbl->Release(output);
+    adapter->lpVtbl->Release(adapter);
+
+    if (FAILED(hr)) {
+        log_error("D3D11 capture device init failed: 0x%08X", hr);
+        dxgi_destroy(src);
+        return NULL;
+    }
+
+    int out_w, out_h;
+    output_size(c, &out_w, &out_h);
+
+    c->requested = cfg->region;
+    c->region    = cfg->region;
+    if (window) {
+        RECT rc;
+        GetWindowRect(window, &rc);
+        c->region.x      = rc.left - c->bounds.left;
+        c->region.y      = rc.top - c->bounds.top;
+        c->region.width  = rc.right - rc.left;
+        c->region.height = rc.bottom - rc.top;
+    }
+    if (!capture_clip_region(&c->region, out_w, out_h)) {
+        log_error("Capture region is outside output %d (%dx%d)", cfg->output, out_w, out_h);
+        dxgi_destroy(src);
+        return NULL;
+    }
+    src->width  = c->region.width;
+    src->height = c->region.height;
+
+    if (!create_staging(c, src->width, src->height)) {
+        dxgi_destroy(src);
+        return NULL;
+    }
+
+    if (!create_duplication(c)) {
+        dxgi_destroy(src);
+        return NULL;
+    }
+
+    log_info("DXGI output %dx%d, region %dx%d+%d+%d", out_w, out_h,
+             c->region.width, c->region.height, c->region.x, c->region.y);
+    return src;
+}
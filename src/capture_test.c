@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "capture.h"
+#include "test_pattern.h"
+#include "utils.h"
+
+#define TEST_DEFAULT_WIDTH  1280
+#define TEST_DEFAULT_HEIGHT 720
+
+typedef struct {
+    uint32_t  frame_id;
+    long long interval_us;
+    long long next_us;
+    int       pending_w, pending_h; // from test_resize, 0 for none
+} TestCapture;
+
+static int test_grab(CaptureSource* src, unsigned char* out, int stride, int timeout_ms) {
+    TestCapture* c = src->impl;
+    if (!capture_pace(&c->next_us, c->interval_us, timeout_ms)) return 0;
+
+    if (c->pending_w) {
+        src->width   = c->pending_w;
+        src->height  = c->pending_h;
+        c->pending_w = c->pending_h = 0;
+        return CAPTURE_RESIZED;
+    }
+
+    // Stamped as late as possible so the measured latency starts at the
+    // moment the frame exists.
+    test_pattern_draw(out, stride, src->width, src->height, c->frame_id++, time_now_us());
+    return 1;
+}
+
+static int test_resize(CaptureSource* src, int width, int height) {
+    TestCapture* c = src->impl;
+    CaptureRegion region = { 0, 0, width, height };
+    if (!capture_clip_region(&region, width, height)) return 0;
+    c->pending_w = region.width;
+    c->pending_h = region.height;
+    return 1;
+}
+
+static void test_destroy(CaptureSource* src) {
+    free(src->impl);
+    free(src);
+}
+
+CaptureSource* capture_open_test(const CaptureConfig* cfg) {
+    CaptureSource* src = calloc(1, sizeof(CaptureSource));
+    TestCapture*   c   = calloc(1, sizeof(TestCapture));
+    if (!src || !c) {
+        free(src);
+        free(c);
+        return NULL;
+    }
+
+    CaptureRegion region = cfg->region;
+    region.x = region.y = 0;
+    if (region.width <= 0)  region.width  = TEST_DEFAULT_WIDTH;
+    if (region.height <= 0) region.height = TEST_DEFAULT_HEIGHT;
+    capture_clip_region(&region, region.width, region.height);
+
+    src->name    = "test";
+    src->width   = region.width;
+    src->height  = region.height;
+    src->grab    = test_grab;
+    src->resize  = test_resize;
+    src->destroy = test_destroy;
+    src->impl    = c;
+
+    c->interval_us = 1000000 / (cfg->fps > 0 ? cfg->fps : 60);
+    c->next_us     = time_now_us();
+    return src;
+}
@@ -0,0 +1,143 @@
+#include <string.h>
+#include "capture_worker.h"
+#include "logger.h"
+#include "utils.h"
+
+// Set on `middle` while it holds a frame the consumer has not taken. Only
+// the worker sets it and only the consumer clears it.
+#define FRESH 4
+
+int capture_worker_init(CaptureWorker* w, CaptureSource* source, int index) {
+    memset(w, 0, sizeof(*w));
+    w->source = source;
+    w->index  = index;
+    w->cpu    = -1;
+
+    // Allocated and pre-faulted before the thread starts, so running out of
+    // memory is a startup error. A change of capture size reallocates them
+    // later, one at a time, as each comes round to the worker.
+    for (int i = 0; i < 3; i++) {
+        if (!frame_alloc(&w->buffers[i], source->width, source->height)) {
+            log_error("Failed to allocate frame buffers for capture %d", index);
+            for (int j = 0; j < i; j++)
+                frame_free(&w->buffers[j]);
+            return 0;
+        }
+    }
+    w->back   = 0;
+    w->middle = 1;
+    w->front  = 2;
+    w->last_log_us = time_now_us();
+    return 1;
+}
+
+static void worker_func(void* arg) {
+    CaptureWorker* w   = arg;
+    CaptureSource* src = w->source;
+    if (w->cpu >= 0)
+        thread_set_affinity(w->cpu);
+    if (w->priority != THREAD_PRIO_NORMAL)
+        thread_set_priority((ThreadPriority)w->priority);
+
+    while (atomic_load_i32(&w->running)) {
+        long long req = atomic_exchange_i64(&w->resize, 0);
+        if (req) {
+            int width = (int)(req >> 32), height = (int)(req & 0xffffffff);
+            if (!src->resize || !src->resize(src, width, height))
+                log_warn("Capture source %s cannot be resized to %dx%d", src->name, width, height);
+        }
+
+        FrameBuffer* fb = &w->buffers[w->back];
+        if (fb->width != src->width || fb->height != src->height) {
+            frame_free(fb);
+            if (!frame_alloc(fb, src->width, src->height)) {
+                log_error("Capture %d: no memory for %dx%d frames, stopping capture",
+                          w->index, src->width, src->height);
+                return;
+            }
+        }
+
+        int r = src->grab(src, fb->data, fb->stride, 33);
+        if (r < 0) {
+            log_error("Capture %d (%s): source failed, stopping capture", w->index, src->name);
+            return;
+        }
+        if (r == CAPTURE_RESIZED) {
+            log_info("Capture %d resized to %dx%d", w->index, src->width, src->height);
+            continue;
+        }
+        if (r > 0) {
+            w->timestamps[w->back] = time_now_us();
+            w->back = atomic_exchange_i32(&w->middle, w->back | FRESH) & ~FRESH;
+            atomic_add_i64(&w->grabbed, 1);
+        }
+    }
+}
+
+int capture_worker_start(CaptureWorker* w, int cpu, int priority) {
+    w->cpu      = cpu;
+    w->priority = priority;
+    atomic_store_i32(&w->running, 1);
+    w->started = thread_create(&w->thread, worker_func, w);
+    if (!w->started) {
+        log_error("Failed to start capture thread %d", w->index);
+        atomic_store_i32(&w->running, 0);
+    }
+    return w->started;
+}
+
+void capture_worker_stop(CaptureWorker* w) {
+    atomic_store_i32(&w->running, 0);
+}
+
+void capture_worker_destroy(CaptureWorker* w) {
+    if (w->started) {
+        capture_worker_stop(w);
+        thread_join(w->thread);
+        w->started = false;
+    }
+    for (int i = 0; i < 3; i++)
+        frame_free(&w->buffers[i]);
+    capture_close(w->source);
+    w->source = NULL;
+}
+
+void capture_worker_resize(CaptureWorker* w, int width, int height) {
+    atomic_store_i64(&w->resize, ((long long)width << 32) | (unsigned)height);
+}
+
+const FrameBuffer* capture_worker_take(CaptureWorker* w, long long* timestamp_us) {
+    if (!(atomic_load_i32(&w->middle) & FRESH)) return NULL;
+    w->front = atomic_exchange_i32(&w->middle, w->front) & ~FRESH;
+
+    const long long ts = w->timestamps[w->front];
+    w->taken++;
+    w->age_us += time_now_us() - ts;
+    if (timestamp_us) *timestamp_us = ts;
+    return &w->buffers[w->front];
+}
+
+const FrameBuffer* capture_worker_current(const CaptureWorker* w) {
+    return &w->buffers[w->front];
+}
+
+void capture_worker_log_stats(CaptureWorker* w) {
+    const long long now     = time_now_us();
+    const long long grabbed = atomic_load_i64(&w->grabbed);
+    const double    sec     = (now - w->last_log_us) / 1000000.0;
+
+    if (sec > 0) {
+        log_info("Capture %d (%s %dx%d): %.1f fps grabbed, %.1f fps used, %.1f ms old when used",
+                 w->index, w->source->name, w->buffers[w->front].width,
+                 w->buffers[w->front].height, (grabbed - w->last_grabbed) / sec,
+                 (w->taken - w->last_taken) / sec,
+                 w->taken > w->last_taken
+                     ? (w->age_us - w->last_age_us) / 1000.0 / (w->taken - w->last_taken)
+                     : 0.0);
+    }
+
+    w->last_grabbed = grabbed;
+    w->last_taken   = w->taken;
+    w->last_age_us  = w->age_us;
+    w->last_log_us  = now;
+}
@@ -0,0 +1,374 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#ifdef CASTR_HAVE_XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif
+
+#include "capture.h"
+#include "logger.h"
+#include "threading.h"
+#include "utils.h"
+
+typedef struct {
+    Display*        display;
+    Window          root;
+    XImage*         image;  // region-sized, backed by the shm segment
+    XShmSegmentInfo shm;
+    bool            attached;
+    int             output;
+    int             out_x, out_y, out_w, out_h; // output on the root window
+    CaptureRegion   requested; // --region as given, re-clipped on output changes
+    CaptureRegion   region;
+    Window          window;
+    long long       interval_us;
+    long long       next_us;
+#ifdef CASTR_HAVE_XRANDR
+    int             rr_event; // XRandR event base, -1 without the extension
+#endif
+} X11Capture;
+
+static int find_monitor(X11Capture* c, int index) {
+    c->out_x = c->out_y = 0;
+    c->out_w = DisplayWidth(c->display, DefaultScreen(c->display));
+    c->out_h = DisplayHeight(c->display, DefaultScreen(c->display));
+
+#ifdef CASTR_HAVE_XRANDR
+    int count = 0;
+    XRRMonitorInfo* monitors = XRRGetMonitors(c->display, c->root, True, &count);
+    if (monitors && count > 0) {
+        if (index >= count) {
+            log_error("Display output %d not found (%d available)", index, count);
+            XRRFreeMonitors(monitors);
+            return 0;
+        }
+        c->out_x = monitors[index].x;
+        c->out_y = monitors[index].y;
+        c->out_w = monitors[index].width;
+        c->out_h = monitors[index].height;
+    }
+    if (monitors) XRRFreeMonitors(monitors);
+    return 1;
+#else
+    if (index != 0) {
+        log_error("Output selection needs XRandR; only output 0 is available");
+        return 0;
+    }
+    return 1;
+#endif
+}
+
+static Window find_window(Display* display, Window parent, const char* title) {
+    char* name = NULL;
+    if (XFetchName(display, parent, &name) && name) {
+        int match = !strcmp(name, title);
+        XFree(name);
+        if (match) return parent;
+    }
+
+    Window root_ret, parent_ret, *children = NULL;
+    unsigned int count = 0;
+    if (!XQueryTree(display, parent, &root_ret, &parent_ret, &children, &count))
+        return 0;
+
+    Window found = 0;
+    for (unsigned int i = 0; i < count && !found; i++)
+        found = find_window(display, children[i], title);
+    if (children) XFree(children);
+    return found;
+}
+
+// Xlib has a single, process-wide error handler. Every X11 source runs on
+// its own thread, so a trap holds one lock from install to restore, and
+// errors on other connections (GLFW's) go on to the handler it replaced.
+static Mutex         g_trap_lock = PTHREAD_MUTEX_INITIALIZER;
+static Display*      g_trap_display;
+static XErrorHandler g_trap_prev;
+static int           g_trap_error;
+
+static int on_x_error(Display* display, XErrorEvent* event) {
+    if (display != g_trap_display)
+        return g_trap_prev ? g_trap_prev(display, event) : 0;
+    g_trap_error = event->error_code;
+    return 0;
+}
+
+static void trap_errors(Display* display) {
+    mutex_lock(&g_trap_lock);
+    XSync(display, False);
+    g_trap_display = display;
+    g_trap_error   = 0;
+    g_trap_prev    = XSetErrorHandler(on_x_error);
+}
+
+// The last X error code raised since trap_errors, or 0 if none was.
+static int untrap_errors(Display* display) {
+    XSync(display, False);
+    XSetErrorHandler(g_trap_prev);
+    int error = g_trap_error;
+    g_trap_display = NULL;
+    mutex_unlock(&g_trap_lock);
+    return error;
+}
+
+// Window position on the root window and, with attrs, its size. A destroyed
+// window raises BadWindow, which would otherwise terminate the process, so
+// the whole query runs under one trap.
+static int query_window(X11Capture* c, int* x, int* y, XWindowAttributes* attrs) {
+    Window child;
+    trap_errors(c->display);
+    Bool ok = XTranslateCoordinates(c->display, c->window, c->root, 0, 0, x, y, &child);
+    if (ok && attrs) ok = XGetWindowAttributes(c->display, c->window, attrs);
+    return !untrap_errors(c->display) && ok;
+}
+
+// Keeps the crop over a window as it moves. Size changes go through
+// refresh_geometry instead, since every downstream buffer is sized from it.
+static int track_window(X11Capture* c) {
+    int x, y;
+    if (!query_window(c, &x, &y, NULL)) return 0;
+
+    x -= c->out_x;
+    y -= c->out_y;
+    if (x > c->out_w - c->region.width)  x = c->out_w - c->region.width;
+    if (y > c->out_h - c->region.height) y = c->out_h - c->region.height;
+    c->region.x = x < 0 ? 0 : x;
+    c->region.y = y < 0 ? 0 : y;
+    return 1;
+}
+
+static int create_image(X11Capture* c, int width, int height);
+static void destroy_image(X11Capture* c);
+
+// ConfigureNotify on the root window (a mode change) or on the captured
+// window (a resize or move) since the last grab.
+static bool geometry_changed(X11Capture* c) {
+    bool changed = false;
+    while (XPending(c->display)) {
+        XEvent ev;
+        XNextEvent(c->display, &ev);
+        if (ev.type == ConfigureNotify) changed = true;
+#ifdef CASTR_HAVE_XRANDR
+        XRRUpdateConfiguration(&ev);
+        if (c->rr_event >= 0 && ev.type == c->rr_event + RRScreenChangeNotify) changed = true;
+#endif
+    }
+    return changed;
+}
+
+// Re-reads the output and the window. A new capture size replaces the shm
+// image and is reported as CAPTURE_RESIZED; a move just updates the crop.
+static int refresh_geometry(CaptureSource* src) {
+    X11Capture* c = src->impl;
+    if (!find_monitor(c, c->output)) return -1;
+
+    CaptureRegion region = c->requested;
+    if (c->window) {
+        int x, y;
+        XWindowAttributes attrs;
+        if (!query_window(c, &x, &y, &attrs)) {
+            log_error("Captured window was closed");
+            return -1;
+        }
+        // Only the size; track_window keeps the position inside the output.
+        region = (CaptureRegion){ 0, 0, attrs.width, attrs.height };
+    }
+    if (!capture_clip_region(&region, c->out_w, c->out_h)) {
+        log_error("Capture region is outside output %d (%dx%d)", c->output, c->out_w, c->out_h);
+        return -1;
+    }
+
+    const bool resized = region.width != src->width || region.height != src->height;
+    if (resized) {
+        destroy_image(c);
+        if (!create_image(c, region.width, region.height)) {
+            log_error("XShm image setup failed");
+            return -1;
+        }
+        src->width  = region.width;
+        src->height = region.height;
+    }
+    if (c->window) {
+        c->region.width  = region.width;
+        c->region.height = region.height;
+        track_window(c);
+    } else {
+        c->region = region;
+    }
+
+    if (resized)
+        log_info("X11 output %dx%d+%d+%d, capture resized to %dx%d",
+                 c->out_w, c->out_h, c->out_x, c->out_y, src->width, src->height);
+    return resized ? CAPTURE_RESIZED : 0;
+}
+
+// X11 has no cheap "frame presented" signal, so grabs are paced to the
+// configured rate rather than spinning.
+static int x11_grab(CaptureSource* src, unsigned char* out, int stride, int timeout_ms) {
+    X11Capture* c = src->impl;
+
+    if (!capture_pace(&c->next_us, c->interval_us, timeout_ms)) return 0;
+
+    if (geometry_changed(c)) {
+        int r = refresh_geometry(src);
+        if (r != 0) return r;
+    }
+
+    if (c->window && !track_window(c)) {
+        log_error("Captured window was closed");
+        return -1;
+    }
+
+    if (!XShmGetImage(c->display, c->root, c->image,
+                      c->out_x + c->region.x, c->out_y + c->region.y, AllPlanes)) {
+        log_error("XShmGetImage failed");
+        return 0;
+    }
+
+    capture_copy(out, (size_t)stride, (const unsigned char*)c->image->data,
+                 (size_t)c->image->bytes_per_line, (size_t)src->width * 4, src->height);
+    return 1;
+}
+
+static void destroy_image(X11Capture* c) {
+    if (c->attached) XShmDetach(c->display, &c->shm);
+    c->attached = false;
+    if (c->image) {
+        c->image->data = NULL;
+        XDestroyImage(c->image);
+        c->image = NULL;
+    }
+    if (c->shm.shmaddr && c->shm.shmaddr != (char*)-1) shmdt(c->shm.shmaddr);
+    c->shm.shmaddr = NULL;
+}
+
+static void x11_destroy(CaptureSource* src) {
+    X11Capture* c = src->impl;
+    destroy_image(c);
+    if (c->display) XCloseDisplay(c->display);
+    free(c);
+    free(src);
+}
+
+static int create_image(X11Capture* c, int width, int height) {
+    int screen = DefaultScreen(c->display);
+    c->image = XShmCreateImage(c->display, DefaultVisual(c->display, screen),
+                               DefaultDepth(c->display, screen), ZPixmap, NULL,
+                               &c->shm, width, height);
+    if (!c->image) return 0;
+    if (c->image->bits_per_pixel != 32) {
+        log_error("Unsupported X11 pixel format: %d bpp", c->image->bits_per_pixel);
+        return 0;
+    }
+
+    c->shm.shmid = shmget(IPC_PRIVATE, (size_t)c->image->bytes_per_line * height,
+                          IPC_CREAT | 0600);
+    if (c->shm.shmid < 0) return 0;
+    c->shm.shmaddr = c->image->data = shmat(c->shm.shmid, NULL, 0);
+    c->shm.readOnly = False;
+    if (c->shm.shmaddr == (char*)-1) {
+        shmctl(c->shm.shmid, IPC_RMID, NULL);
+        return 0;
+    }
+
+    c->attached = XShmAttach(c->display, &c->shm);
+    XSync(c->display, False);
+    // Marked for removal now; the kernel frees it once both sides detach.
+    shmctl(c->shm.shmid, IPC_RMID, NULL);
+    return c->attached;
+}
+
+CaptureSource* capture_open_x11(const CaptureConfig* cfg) {
+    CaptureSource* src = calloc(1, sizeof(CaptureSource));
+    X11Capture*    c   = calloc(1, sizeof(X11Capture));
+    if (!src || !c) {
+        free(src);
+        free(c);
+        return NULL;
+    }
+    src->name    = "x11-shm";
+    src->grab    = x11_grab;
+    src->destroy = x11_destroy;
+    src->impl    = c;
+
+    // A private connection; only the capture thread uses it after open.
+    c->display = XOpenDisplay(NULL);
+    if (!c->display) {
+        log_error("Cannot open X display");
+        x11_destroy(src);
+        return NULL;
+    }
+    if (!XShmQueryExtension(c->display)) {
+        log_error("X server has no MIT-SHM extension");
+        x11_destroy(src);
+        return NULL;
+    }
+    c->root = DefaultRootWindow(c->display);
+
+    c->output = cfg->output;
+    if (!find_monitor(c, cfg->output)) {
+        x11_destroy(src);
+        return NULL;
+    }
+
+    c->requested = cfg->region;
+    c->region    = cfg->region;
+    if (cfg->window) {
+        // Windows can close while the tree is walked.
+        trap_errors(c->display);
+        c->window = find_window(c->display, c->root, cfg->window);
+        untrap_errors(c->display);
+
+        int x = 0, y = 0;
+        XWindowAttributes attrs;
+        if (!c->window || !query_window(c, &x, &y, &attrs)) {
+            log_error("Window not found: %s", cfg->window);
+            x11_destroy(src);
+            return NULL;
+        }
+        c->region.x      = x - c->out_x;
+        c->region.y      = y - c->out_y;
+        c->region.width  = attrs.width;
+        c->region.height = attrs.height;
+    }
+    if (!capture_clip_region(&c->region, c->out_w, c->out_h)) {
+        log_error("Capture region is outside output %d (%dx%d)",
+                  cfg->output, c->out_w, c->out_h);
+        x11_destroy(src);
+        return NULL;
+    }
+    src->width  = c->region.width;
+    src->height = c->region.height;
+
+    if (!create_image(c, src->width, src->height)) {
+        log_error("XShm image setup failed");
+        x11_destroy(src);
+        return NULL;
+    }
+
+    // Mode changes and resizes of the captured window arrive as
+    // ConfigureNotify and are picked up between grabs.
+    XSelectInput(c->display, c->root, StructureNotifyMask);
+    if (c->window)
+        XSelectInput(c->display, c->window, StructureNotifyMask);
+#ifdef CASTR_HAVE_XRANDR
+    int rr_error;
+    if (XRRQueryExtension(c->display, &c->rr_event, &rr_error))
+        XRRSelectInput(c->display, c->root, RRScreenChangeNotifyMask);
+    else
+        c->rr_event = -1;
+#endif
+
+    c->interval_us = 1000000 / (cfg->fps > 0 ? cfg->fps : 60);
+    c->next_us     = time_now_us();
+
+    log_info("X11 output %dx%d+%d+%d, region %dx%d+%d+%d",
+             c->out_w, c->out_h, c->out_x, c->out_y,
+             c->region.width, c->region.height, c->region.x, c->region.y);
+    return src;
+}
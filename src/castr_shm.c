@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "castr_shm.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+typedef HANDLE MapHandle;
+#else
+typedef int MapHandle; // unused: the mapping outlives its descriptor
+#endif
+
+struct CastrShmReader {
+    const uint8_t*        base;
+    size_t                size;
+    const CastrShmHeader* header;
+    uint64_t              last_sequence;
+    MapHandle             mapping;
+};
+
+// Acquire ordering for the sequence lock; the loads of pixel data must not
+// move across these.
+#if defined(_MSC_VER)
+#include <intrin.h>
+static uint64_t load_acquire(const volatile uint64_t* p) {
+    uint64_t v = *p;
+    _ReadWriteBarrier();
+#if defined(_M_ARM64)
+    __dmb(_ARM64_BARRIER_ISHLD);
+#endif
+    return v;
+}
+
+static void fence_acquire(void) {
+    _ReadWriteBarrier();
+#if defined(_M_ARM64)
+    __dmb(_ARM64_BARRIER_ISHLD);
+#endif
+}
+#else
+static uint64_t load_acquire(const volatile uint64_t* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void fence_acquire(void) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+#endif
+
+static const CastrShmSlot* slot_at(const CastrShmReader* r, uint64_t sequence) {
+    const CastrShmHeader* h = r->header;
+    return (const CastrShmSlot*)(r->base + h->slot_offset +
+                                 (sequence % h->slot_count) * h->slot_size);
+}
+
+static const uint8_t* slot_pixels(const CastrShmSlot* slot) {
+    return (const uint8_t*)slot + CASTR_SHM_ALIGN;
+}
+
+static int layout_ok(const CastrShmHeader* h, size_t size) {
+    if (size < sizeof(*h) || h->magic != CASTR_SHM_MAGIC || h->version != CASTR_SHM_VERSION)
+        return 0;
+    if (!h->slot_count || h->slot_size < CASTR_SHM_ALIGN + h->frame_size)
+        return 0;
+    return (uint64_t)h->slot_offset + (uint64_t)h->slot_count * h->slot_size <= size;
+}
+
+#ifdef _WIN32
+#define SHM_PREFIX "Local\\castr-"
+
+static const uint8_t* map_object(const char* object, size_t* size, MapHandle* mapping) {
+    *mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, object);
+    if (!*mapping) return NULL;
+
+    const uint8_t* base = MapViewOfFile(*mapping, FILE_MAP_READ, 0, 0, 0);
+    MEMORY_BASIC_INFORMATION info;
+    if (!base || !VirtualQuery(base, &info, sizeof(info))) {
+        if (base) UnmapViewOfFile(base);
+        CloseHandle(*mapping);
+        return NULL;
+    }
+    *size = info.RegionSize;
+    return base;
+}
+
+static void unmap_object(const uint8_t* base, size_t size, MapHandle mapping) {
+    (void)size;
+    UnmapViewOfFile(base);
+    CloseHandle(mapping);
+}
+#else
+#define SHM_PREFIX "/castr-"
+
+static const uint8_t* map_object(const char* object, size_t* size, MapHandle* mapping) {
+    *mapping = -1;
+    int fd = shm_open(object, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void* base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+    *size = (size_t)st.st_size;
+    return base;
+}
+
+static void unmap_object(const uint8_t* base, size_t size, MapHandle mapping) {
+    (void)mapping;
+    munmap((void*)base, size);
+}
+#endif
+
+// The directory names the current ring; read it once and let it go.
+static int current_generation(const char* name, uint32_t* generation) {
+    char object[256];
+    snprintf(object, sizeof(object), SHM_PREFIX "%s", name);
+    size_t size;
+    MapHandle mapping;
+    const uint8_t* base = map_object(object, &size, &mapping);
+    if (!base) return 0;
+
+    const CastrShmDirectory* d = (const CastrShmDirectory*)base;
+    int ok = size >= sizeof(*d) && d->magic == CASTR_SHM_DIR_MAGIC &&
+             d->version == CASTR_SHM_VERSION && !d->closed;
+    fence_acquire();
+    *generation = d->generation;
+    unmap_object(base, size, mapping);
+    return ok;
+}
+
+CastrShmReader* castr_shm_open(const char* name) {
+    uint32_t generation;
+    if (!current_generation(name, &generation)) return NULL;
+
+    char object[256];
+    snprintf(object, sizeof(object), SHM_PREFIX "%s.%u", name, generation);
+    size_t size;
+    MapHandle mapping;
+    const uint8_t* base = map_object(object, &size, &mapping);
+    if (!base) return NULL;
+
+    CastrShmReader* r = calloc(1, sizeof(CastrShmReader));
+    if (!r || !layout_ok((const CastrShmHeader*)base, size)) {
+        free(r);
+        unmap_object(base, size, mapping);
+        return NULL;
+    }
+    r->base    = base;
+    r->size    = size;
+    r->header  = (const CastrShmHeader*)base;
+    r->mapping = mapping;
+    return r;
+}
+
+void castr_shm_close(CastrShmReader* r) {
+    if (!r) return;
+    unmap_object(r->base, r->size, r->mapping);
+    free(r);
+}
+
+const CastrShmHeader* castr_shm_header(const CastrShmReader* r) {
+    return r->header;
+}
+
+size_t castr_shm_frame_size(const CastrShmReader* r) {
+    return (size_t)r->header->frame_size;
+}
+
+const uint8_t* castr_shm_peek(CastrShmReader* r, CastrShmFrame* frame) {
+    const CastrShmHeader* h = r->header;
+    for (;;) {
+        uint64_t seq = load_acquire(&h->latest);
+        if (!seq) return NULL;
+
+        const CastrShmSlot* slot = slot_at(r, seq);
+        uint64_t lock = load_acquire(&slot->lock);
+        if (lock != seq * 2) continue; // already being reused, newer frame exists
+
+        frame->sequence     = seq;
+        frame->timestamp_us = slot->timestamp_us;
+        frame->format       = h->format;
+        frame->width        = h->width;
+        frame->height       = h->height;
+        frame->stride       = h->stride;
+        frame->size         = h->frame_size;
+        return slot_pixels(slot);
+    }
+}
+
+int castr_shm_valid(CastrShmReader* r, const CastrShmFrame* frame) {
+    fence_acquire();
+    return load_acquire(&slot_at(r, frame->sequence)->lock) == frame->sequence * 2;
+}
+
+int castr_shm_read(CastrShmReader* r, void* dst, size_t dst_size, CastrShmFrame* frame) {
+    if (dst_size < r->header->frame_size) return -1;
+    for (;;) {
+        if (r->header->closed && load_acquire(&r->header->latest) == r->last_sequence)
+            return -1;
+
+        const uint8_t* pixels = castr_shm_peek(r, frame);
+        if (!pixels || frame->sequence == r->last_sequence) return 0;
+
+        memcpy(dst, pixels, (size_t)frame->size);
+        if (castr_shm_valid(r, frame)) {
+            r->last_sequence = frame->sequence;
+            return 1;
+        }
+    }
+}
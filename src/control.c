@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "control.h"
+#include "logger.h"
+#include "snapshot.h"
+#include "threading.h"
+
+static struct {
+    Mutex          lock;
+    Thread         thread;
+    int            source_w, source_h;
+    int            canvas_w, canvas_h;
+    ControlEncoder encoder;
+    bool           encoder_pending;
+    char           snapshot[224];
+} g_ctl;
+
+static int parse_size(const char* s, int* w, int* h) {
+    return sscanf(s, "%dx%d", w, h) == 2 && *w > 0 && *h > 0 && !(*w & 1) && !(*h & 1);
+}
+
+static int parse_number(const char* s, int min, int max, int* out) {
+    char* end;
+    long v = strtol(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || v < min || v > max) return 0;
+    *out = (int)v;
+    return 1;
+}
+
+static void handle_command(const char* cmd, const char* arg) {
+    int w, h, v;
+    bool ok = true;
+
+    mutex_lock(&g_ctl.lock);
+    if (!strcmp(cmd, "source") && (ok = parse_size(arg, &w, &h))) {
+        g_ctl.source_w = w;
+        g_ctl.source_h = h;
+    } else if (!strcmp(cmd, "canvas") && (ok = parse_size(arg, &w, &h))) {
+        g_ctl.canvas_w = w;
+        g_ctl.canvas_h = h;
+    } else if (!strcmp(cmd, "output-size") && (ok = parse_size(arg, &w, &h))) {
+        g_ctl.encoder.out_w = w;
+        g_ctl.encoder.out_h = h;
+        g_ctl.encoder_pending = true;
+    } else if (!strcmp(cmd, "bitrate") && (ok = parse_number(arg, 1, 1000000, &v))) {
+        g_ctl.encoder.bitrate_kbps = v;
+        g_ctl.encoder_pending = true;
+    } else if (!strcmp(cmd, "crf") && (ok = parse_number(arg, 0, 51, &v))) {
+        g_ctl.encoder.crf = v;
+        g_ctl.encoder_pending = true;
+    } else if (!strcmp(cmd, "snapshot") && (ok = snapshot_path_ok(arg))) {
+        snprintf(g_ctl.snapshot, sizeof(g_ctl.snapshot), "%s", arg);
+    } else if (ok) {
+        ok = false;
+        log_warn("Control: unknown command %s", cmd);
+        mutex_unlock(&g_ctl.lock);
+        return;
+    }
+    mutex_unlock(&g_ctl.lock);
+
+    if (!ok)
+        log_warn("Control: invalid value for %s: %s", cmd, arg);
+    else
+        log_info("Control: %s %s", cmd, arg);
+}
+
+// Not joined: it sits in fgets until stdin closes and goes away with the
+// process.
+static void control_thread_func(void* arg) {
+    (void)arg;
+    char line[256];
+    while (fgets(line, sizeof(line), stdin)) {
+        char cmd[32], value[224];
+        int n = sscanf(line, "%31s %223s", cmd, value);
+        if (n == 2)
+            handle_command(cmd, value);
+        else if (n == 1)
+            log_warn("Control: expected COMMAND VALUE, got %s", cmd);
+    }
+    log_info("Control: end of input");
+}
+
+int control_start(void) {
+    mutex_init(&g_ctl.lock);
+    g_ctl.encoder.crf = -1;
+    if (!thread_create(&g_ctl.thread, control_thread_func, NULL)) {
+        log_error("Failed to start control thread");
+        return 0;
+    }
+    return 1;
+}
+
+bool control_take_source(int* width, int* height) {
+    mutex_lock(&g_ctl.lock);
+    bool pending = g_ctl.source_w > 0;
+    *width  = g_ctl.source_w;
+    *height = g_ctl.source_h;
+    g_ctl.source_w = g_ctl.source_h = 0;
+    mutex_unlock(&g_ctl.lock);
+    return pending;
+}
+
+bool control_take_canvas(int* width, int* height) {
+    mutex_lock(&g_ctl.lock);
+    bool pending = g_ctl.canvas_w > 0;
+    *width  = g_ctl.canvas_w;
+    *height = g_ctl.canvas_h;
+    g_ctl.canvas_w = g_ctl.canvas_h = 0;
+    mutex_unlock(&g_ctl.lock);
+    return pending;
+}
+
+bool control_take_encoder(ControlEncoder* req) {
+    mutex_lock(&g_ctl.lock);
+    bool pending = g_ctl.encoder_pending;
+    *req = g_ctl.encoder;
+    memset(&g_ctl.encoder, 0, sizeof(g_ctl.encoder));
+    g_ctl.encoder.crf = -1;
+    g_ctl.encoder_pending = false;
+    mutex_unlock(&g_ctl.lock);
+    return pending;
+}
+
+bool control_take_snapshot(char* path, size_t size) {
+    mutex_lock(&g_ctl.lock);
+    bool pending = g_ctl.snapshot[0] != '\0';
+    snprintf(path, size, "%s", g_ctl.snapshot);
+    g_ctl.snapshot[0] = '\0';
+    mutex_unlock(&g_ctl.lock);
+    return pending;
+}
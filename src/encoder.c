@@ -1,111 +1,853 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+#include "encoder.h"
+#include "scale.h"
+#include "frame_alloc.h"
+#include "jobs.h"
+#include "roi.h"
 #include "logger.h"
-#include <Windows.h>
+#include "threading.h"
+#include "utils.h"
 
 typedef struct {
+  EncoderConfig cfg;
+  const AVCodec *video_codec;
+  int in_w, in_h;
+  int crf;
+  const char *preset; // current, changed by encoder_reconfigure
+  bool fast_scaler;
+  enum AVPixelFormat pix_fmt;
   AVCodecContext *codec_ctx;
-  AVFormatContext *fmt_ctx;
-  AVStream *video_stream;
+  const AVOutputFormat *oformat;
+  AVFormatContext *fmt_ctx; // current segment, guarded by mux_lock
   AVFrame *frame;
   AVPacket *pkt;
   struct SwsContext *sws_ctx;
+  int sws_src_h;
+  struct SwsContext *band_sws[JOBS_MAX_WORKERS + 1];
+  void *band_scratch[JOBS_MAX_WORKERS + 1]; // scale_bgra_rows line buffers
+  int band_count;
+  int band_h;
+  ScaleMode scale_mode;
+  FrameBuffer scale_buf;
+  RoiTracker roi;
+  bool roi_enabled;
 //   FILE *out_file;
   int64_t frame_count; 
+  int64_t last_pts;
+  int64_t resume_pts;
+  int64_t clock_origin_us;
+  AVCodecContext *audio_ctx;
+  AVFrame *audio_frame;
+  AVPacket *audio_pkt;
+  Mutex mux_lock;
+  EncoderPacketHook packet_hook;
+  int segment_index;
+  int64_t segment_start_us; // pts of the segment's first video packet, -1 before it
+  bool force_key;
 } EncoderState;
 
 EncoderState g_enc = {0};
 
-void init_encoder(const char *filename, int width, int height) {
-    HRESULT hr;
+#define VIDEO_STREAM 0
+#define AUDIO_STREAM 1
 
-    avformat_alloc_output_context2(&g_enc.fmt_ctx, NULL, NULL, filename);
-    if (!g_enc.fmt_ctx) {
-        log_error("Could not allocate output context");
+// Closed segments are finalized (trailer, index, close) off the encoder
+// thread; the next segment is already receiving packets by then.
+#define FINALIZE_QUEUE 8
+
+static struct {
+  Thread thread;
+  Mutex lock;
+  Cond wake;
+  AVFormatContext *queue[FINALIZE_QUEUE];
+  int count;
+  bool stop;
+  bool started;
+} g_finalize;
+
+static void finalize_output(AVFormatContext *ctx) {
+    if (av_write_trailer(ctx) < 0)
+        log_warn("Could not finalize %s", ctx->url);
+    if (!(ctx->oformat->flags & AVFMT_NOFILE))
+        avio_closep(&ctx->pb);
+    log_info("Segment closed: %s", ctx->url);
+    avformat_free_context(ctx);
+}
+
+static void finalize_thread_func(void *arg) {
+    (void)arg;
+    for (;;) {
+        mutex_lock(&g_finalize.lock);
+        while (!g_finalize.count && !g_finalize.stop)
+            cond_wait(&g_finalize.wake, &g_finalize.lock);
+        if (!g_finalize.count) {
+            mutex_unlock(&g_finalize.lock);
+            return;
+        }
+        AVFormatContext *ctx = g_finalize.queue[0];
+        memmove(g_finalize.queue, g_finalize.queue + 1,
+                sizeof(g_finalize.queue[0]) * (size_t)--g_finalize.count);
+        mutex_unlock(&g_finalize.lock);
+
+        finalize_output(ctx);
+    }
+}
+
+static void finalize_later(AVFormatContext *ctx) {
+    mutex_lock(&g_finalize.lock);
+    bool queued = g_finalize.started && g_finalize.count < FINALIZE_QUEUE;
+    if (queued) g_finalize.queue[g_finalize.count++] = ctx;
+    mutex_unlock(&g_finalize.lock);
+
+    if (queued) cond_signal(&g_finalize.wake);
+    else finalize_output(ctx); // the disk can't keep up; pay for it here
+}
+
+static void segment_name(char *out, size_t size, int index) {
+    const char *name = g_enc.cfg.filename;
+    if (g_enc.cfg.rotate_sec <= 0 && g_enc.cfg.rotate_bytes <= 0) {
+        snprintf(out, size, "%s", name);
         return;
     }
+    // NAME.EXT -> NAME.000.EXT
+    const char *dot = strrchr(name, '.');
+    const char *sep = strrchr(name, '/');
+    const char *bsl = strrchr(name, '\\');
+    if (bsl > sep) sep = bsl;
+    if (!dot || (sep && dot < sep)) dot = name + strlen(name);
+    snprintf(out, size, "%.*s.%03d%s", (int)(dot - name), name, index, dot);
+}
 
-    const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_H264);
-    if (!codec) {
-        log_error("Codec H.264 not found");
+// A new output with the current encoders' parameters. Every output is
+// written to survive a crash: fragmented MP4, or Matroska with short
+// clusters, flushed to the OS as packets arrive.
+static AVFormatContext *open_output(const char *filename) {
+    AVFormatContext *ctx = NULL;
+    avformat_alloc_output_context2(&ctx, g_enc.oformat, NULL, filename);
+    if (!ctx) return NULL;
+
+    AVStream *video = avformat_new_stream(ctx, NULL);
+    if (!video) goto fail;
+    avcodec_parameters_from_context(video->codecpar, g_enc.codec_ctx);
+    video->time_base = g_enc.codec_ctx->time_base;
+
+    if (g_enc.audio_ctx) {
+        AVStream *audio = avformat_new_stream(ctx, NULL);
+        if (!audio) goto fail;
+        avcodec_parameters_from_context(audio->codecpar, g_enc.audio_ctx);
+        audio->time_base = g_enc.audio_ctx->time_base;
+    }
+
+    if (!(ctx->oformat->flags & AVFMT_NOFILE) &&
+        avio_open(&ctx->pb, filename, AVIO_FLAG_WRITE) < 0) {
+        log_error("Could not open file: %s", filename);
+        goto fail;
+    }
+
+    AVDictionary *opts = NULL;
+    av_dict_set(&opts, "flush_packets", "1", 0);
+    if (!strcmp(ctx->oformat->name, "mp4") || !strcmp(ctx->oformat->name, "mov"))
+        av_dict_set(&opts, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+    else if (!strcmp(ctx->oformat->name, "matroska"))
+        av_dict_set(&opts, "cluster_time_limit", "1000", 0);
+    int ret = avformat_write_header(ctx, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        log_error("Could not write header: %s", filename);
+        if (!(ctx->oformat->flags & AVFMT_NOFILE)) avio_closep(&ctx->pb);
+        goto fail;
+    }
+    return ctx;
+
+fail:
+    avformat_free_context(ctx);
+    return NULL;
+}
+
+// Moves muxing to the next segment, with streams from the current encoders.
+// Called with mux_lock held, between packets.
+static void next_segment(void) {
+    char name[1024];
+    segment_name(name, sizeof(name), g_enc.segment_index + 1);
+    AVFormatContext *next = open_output(name);
+    if (!next) {
+        log_error("Could not start segment %s, continuing in %s", name, g_enc.fmt_ctx->url);
         return;
     }
+    finalize_later(g_enc.fmt_ctx);
+    g_enc.fmt_ctx = next;
+    g_enc.segment_index++;
+    log_info("Segment opened: %s", name);
+}
+
+// Roll over at a video keyframe once the segment is long or large enough;
+// if the limit is hit mid-GOP the next frame is forced to be a keyframe.
+// Called with mux_lock held, before `pkt` is written.
+static void maybe_rotate(const AVCodecContext *ctx, const AVPacket *pkt) {
+    const EncoderConfig *cfg = &g_enc.cfg;
+    if (cfg->rotate_sec <= 0 && cfg->rotate_bytes <= 0) return;
 
-    g_enc.video_stream = avformat_new_stream(g_enc.fmt_ctx, NULL);
-    if (!g_enc.video_stream) {
-        log_error("Could not create stream");
+    const int64_t t_us = av_rescale_q(pkt->pts, ctx->time_base, AV_TIME_BASE_Q);
+    if (g_enc.segment_start_us < 0) {
+        g_enc.segment_start_us = t_us;
+        return;
+    }
+    const int64_t bytes = g_enc.fmt_ctx->pb ? avio_tell(g_enc.fmt_ctx->pb) : 0;
+    bool due = (cfg->rotate_sec > 0 && t_us - g_enc.segment_start_us >= (int64_t)(cfg->rotate_sec * 1000000.0)) ||
+               (cfg->rotate_bytes > 0 && bytes >= cfg->rotate_bytes);
+    if (!due) return;
+    if (!(pkt->flags & AV_PKT_FLAG_KEY)) {
+        g_enc.force_key = true;
         return;
     }
 
-    g_enc.codec_ctx = avcodec_alloc_context3(codec);
-    g_enc.codec_ctx->width = width;
-    g_enc.codec_ctx->height = height;
-    g_enc.codec_ctx->time_base = (AVRational){1, 60};
-    g_enc.codec_ctx->framerate = (AVRational){60, 1};
-    g_enc.codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
-    g_enc.codec_ctx->gop_size = 12; // Add a GOP size for stability
+    g_enc.segment_start_us = t_us;
+    g_enc.force_key = false;
+    next_segment();
+}
 
-    if (g_enc.fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER)
-        g_enc.codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+static int open_audio(const EncoderConfig *cfg) {
+    const AVCodec *codec = avcodec_find_encoder_by_name(cfg->audio_codec);
+    if (!codec) {
+        log_error("Audio codec %s not found", cfg->audio_codec);
+        return 0;
+    }
 
-    if (avcodec_open2(g_enc.codec_ctx, codec, NULL) < 0) {
-        log_error("Could not open codec");
-        return;
+    if (codec->supported_samplerates) {
+        const int *r = codec->supported_samplerates;
+        while (*r && *r != cfg->audio_sample_rate) r++;
+        if (!*r) {
+            log_error("%s does not support %d Hz", cfg->audio_codec, cfg->audio_sample_rate);
+            return 0;
+        }
     }
 
-    avcodec_parameters_from_context(g_enc.video_stream->codecpar, g_enc.codec_ctx);
-    g_enc.video_stream->time_base = g_enc.codec_ctx->time_base;
+    g_enc.audio_ctx = avcodec_alloc_context3(codec);
+    g_enc.audio_ctx->sample_rate = cfg->audio_sample_rate;
+    g_enc.audio_ctx->time_base = (AVRational){1, cfg->audio_sample_rate};
+    g_enc.audio_ctx->bit_rate = (int64_t)cfg->audio_bitrate_kbps * 1000;
+    g_enc.audio_ctx->sample_fmt = codec->sample_fmts ? codec->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+    av_channel_layout_default(&g_enc.audio_ctx->ch_layout, cfg->audio_channels);
 
-    if (!(g_enc.fmt_ctx->oformat->flags & AVFMT_NOFILE)) {
-        if (avio_open(&g_enc.fmt_ctx->pb, filename, AVIO_FLAG_WRITE) < 0) {
-            log_error("Could not open file: %s", filename);
-            return;
+    if (g_enc.oformat->flags & AVFMT_GLOBALHEADER)
+        g_enc.audio_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    if (avcodec_open2(g_enc.audio_ctx, codec, NULL) < 0) {
+        log_error("Could not open audio codec");
+        return 0;
+    }
+
+    g_enc.audio_frame = av_frame_alloc();
+    g_enc.audio_frame->format = g_enc.audio_ctx->sample_fmt;
+    g_enc.audio_frame->sample_rate = g_enc.audio_ctx->sample_rate;
+    g_enc.audio_frame->nb_samples = encoder_audio_frame_size();
+    av_channel_layout_copy(&g_enc.audio_frame->ch_layout, &g_enc.audio_ctx->ch_layout);
+    av_frame_get_buffer(g_enc.audio_frame, 0);
+    g_enc.audio_pkt = av_packet_alloc();
+
+    log_info("Audio encoder: %s %d Hz, %d channels, %d kbps", cfg->audio_codec,
+             cfg->audio_sample_rate, cfg->audio_channels, cfg->audio_bitrate_kbps);
+    return 1;
+}
+
+// Both the video and audio threads mux into the same context, which video
+// keyframes may swap for the next segment.
+static void write_packets(AVCodecContext *ctx, int stream_index, AVPacket *pkt) {
+    while (avcodec_receive_packet(ctx, pkt) >= 0) {
+        const int64_t pts = pkt->pts;
+
+        mutex_lock(&g_enc.mux_lock);
+        if (stream_index == VIDEO_STREAM)
+            maybe_rotate(ctx, pkt);
+        av_packet_rescale_ts(pkt, ctx->time_base,
+                             g_enc.fmt_ctx->streams[stream_index]->time_base);
+        pkt->stream_index = stream_index;
+        av_interleaved_write_frame(g_enc.fmt_ctx, pkt);
+        mutex_unlock(&g_enc.mux_lock);
+        av_packet_unref(pkt);
+
+        if (g_enc.packet_hook && stream_index == VIDEO_STREAM)
+            g_enc.packet_hook(pts, time_now_us());
+    }
+}
+
+// Same-size conversion is split into row bands, one swscale context each,
+// and run on the job system together with the fast downscale of the band.
+static int init_band_converters(int width, int height) {
+    int bands = jobs_worker_count() + 1;
+    g_enc.band_h = (((height + bands - 1) / bands) + 1) & ~1;
+    g_enc.band_count = (height + g_enc.band_h - 1) / g_enc.band_h;
+
+    for (int i = 0; i < g_enc.band_count; i++) {
+        int h = FFMIN(g_enc.band_h, height - i * g_enc.band_h);
+        g_enc.band_sws[i] = sws_getContext(width, h, AV_PIX_FMT_BGRA,
+                                           width, h, g_enc.pix_fmt,
+                                           g_enc.fast_scaler ? SWS_BILINEAR : SWS_BICUBIC,
+                                           NULL, NULL, NULL);
+        if (!g_enc.band_sws[i]) return 0;
+    }
+    const size_t scratch = scale_scratch_size(g_enc.scale_mode, width);
+    for (int i = 0; i < g_enc.band_count && scratch; i++) {
+        g_enc.band_scratch[i] = mem_aligned_alloc(scratch, FRAME_ALIGN);
+        if (!g_enc.band_scratch[i]) return 0;
+    }
+    return 1;
+}
+
+typedef struct {
+    const uint8_t *src;
+    int stride;
+} ConvertJob;
+
+static void convert_band(void *ctx, int index) {
+    const ConvertJob *job = ctx;
+    AVFrame *f = g_enc.frame;
+    const int y0 = index * g_enc.band_h;
+    const int h = FFMIN(g_enc.band_h, f->height - y0);
+
+    const uint8_t *src = job->src;
+    int src_stride = job->stride;
+    if (g_enc.scale_buf.data) {
+        scale_bgra_rows(g_enc.scale_mode, job->src, job->stride,
+                        g_enc.scale_buf.data, g_enc.scale_buf.stride, f->width, y0, y0 + h,
+                        g_enc.band_scratch[index]);
+        src = g_enc.scale_buf.data;
+        src_stride = g_enc.scale_buf.stride;
+    }
+
+    const uint8_t *src_data[1] = { src + (ptrdiff_t)y0 * src_stride };
+    int src_linesize[1] = { src_stride };
+    uint8_t *dst[4] = {0};
+    for (int p = 0; p < 4 && f->data[p]; p++)
+        dst[p] = f->data[p] + (ptrdiff_t)(p ? y0 / 2 : y0) * f->linesize[p];
+    sws_scale(g_enc.band_sws[index], src_data, src_linesize, 0, h, dst, f->linesize);
+}
+
+// Changed tiles get -roi_qp and everything else +roi_qp, so x264 skips
+// the static parts cheaply and spends the bits where the screen moved.
+// Where regions overlap the earlier one wins: runs of changed tiles come
+// first and a single frame-sized static region last. A frame that changed
+// everywhere has nothing to prioritise and is left at the plain CRF.
+static void attach_roi(const uint8_t *bgra, int stride) {
+    RoiTracker *roi = &g_enc.roi;
+    AVFrame *f = g_enc.frame;
+    av_frame_remove_side_data(f, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+
+    const int changed = roi_update(roi, bgra, stride);
+    const int total = roi->cols * roi->rows;
+    const bool uniform = changed == 0 || changed == total;
+
+    int count = 1;
+    if (!uniform) {
+        for (int row = 0; row < roi->rows; row++)
+            for (int col = 0; col < roi->cols; col++)
+                if (roi_dirty(roi, col, row) && (col == 0 || !roi_dirty(roi, col - 1, row)))
+                    count++;
+    }
+
+    AVFrameSideData *sd = av_frame_new_side_data(f, AV_FRAME_DATA_REGIONS_OF_INTEREST,
+                                                 sizeof(AVRegionOfInterest) * count);
+    if (!sd) return;
+    AVRegionOfInterest *r = (AVRegionOfInterest *)sd->data;
+
+    // Offsets are a fraction of the 8-bit QP range.
+    const int qp = g_enc.cfg.roi_qp;
+    for (int row = 0; !uniform && row < roi->rows; row++) {
+        for (int col = 0; col < roi->cols; col++) {
+            if (!roi_dirty(roi, col, row) || (col > 0 && roi_dirty(roi, col - 1, row)))
+                continue;
+            int end = col;
+            while (end < roi->cols && roi_dirty(roi, end, row)) end++;
+
+            // Tiles are in canvas pixels; the frame may be scaled.
+            r->self_size = sizeof(*r);
+            r->left   = (int)((int64_t)col * ROI_TILE * f->width / roi->width);
+            r->right  = (int)((int64_t)FFMIN(end * ROI_TILE, roi->width) * f->width / roi->width);
+            r->top    = (int)((int64_t)row * ROI_TILE * f->height / roi->height);
+            r->bottom = (int)((int64_t)FFMIN((row + 1) * ROI_TILE, roi->height) * f->height / roi->height);
+            r->qoffset = (AVRational){ -qp, 51 };
+            r++;
         }
     }
+    r->self_size = sizeof(*r);
+    r->left = r->top = 0;
+    r->right = f->width;
+    r->bottom = f->height;
+    r->qoffset = (AVRational){ changed == total ? 0 : qp, 51 };
+}
 
-    if (avformat_write_header(g_enc.fmt_ctx, NULL) < 0) {
-        log_error("Error occurred when opening output file");
-        return;
+static AVCodecContext *open_video(int width, int height, const char *preset, int crf) {
+    const EncoderConfig *cfg = &g_enc.cfg;
+    AVCodecContext *ctx = avcodec_alloc_context3(g_enc.video_codec);
+    if (!ctx) return NULL;
+
+    ctx->width = width;
+    ctx->height = height;
+    ctx->time_base = (AVRational){1, cfg->fps};
+    ctx->framerate = (AVRational){cfg->fps, 1};
+    ctx->pix_fmt = g_enc.pix_fmt;
+    ctx->gop_size = cfg->gop;
+
+    if (g_enc.oformat->flags & AVFMT_GLOBALHEADER)
+        ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    AVDictionary *opts = NULL;
+    if (cfg->intermediate) {
+        // rawvideo takes no options. Lossless is the cheapest x264 that is
+        // still lossless, with a keyframe every second as split points for
+        // the transcoder.
+        if (strcmp(cfg->intermediate, "raw") != 0) {
+            av_dict_set(&opts, "preset", "ultrafast", 0);
+            av_dict_set_int(&opts, "qp", 0, 0);
+            ctx->gop_size = cfg->fps;
+        }
+    } else {
+        if (preset)
+            av_dict_set(&opts, "preset", preset, 0);
+        if (cfg->bitrate_kbps > 0) {
+            ctx->bit_rate = (int64_t)cfg->bitrate_kbps * 1000;
+            ctx->rc_max_rate = ctx->bit_rate;
+            ctx->rc_buffer_size = (int)(ctx->bit_rate * 2);
+        } else {
+            av_dict_set_int(&opts, "crf", crf, 0);
+        }
     }
+    // Segments must start on an IDR frame to play on their own.
+    if ((cfg->rotate_sec > 0 || cfg->rotate_bytes > 0) &&
+        av_opt_find(ctx->priv_data, "forced-idr", NULL, 0, 0))
+        av_dict_set(&opts, "forced-idr", "1", 0);
+    // The container header only has the first encoder's parameter sets, so
+    // a reopened encoder must repeat its own in front of every keyframe.
+    if ((cfg->adaptive || cfg->reconfigurable) &&
+        av_opt_find(ctx->priv_data, "x264-params", NULL, 0, 0))
+        av_dict_set(&opts, "x264-params", "repeat-headers=1", 0);
+
+    int ret = avcodec_open2(ctx, g_enc.video_codec, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        avcodec_free_context(&ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+static void free_conversion(void) {
+    av_frame_free(&g_enc.frame);
+    frame_free(&g_enc.scale_buf);
+    sws_freeContext(g_enc.sws_ctx);
+    g_enc.sws_ctx = NULL;
+    for (int i = 0; i < g_enc.band_count; i++) {
+        sws_freeContext(g_enc.band_sws[i]);
+        mem_aligned_free(g_enc.band_scratch[i]);
+        g_enc.band_scratch[i] = NULL;
+    }
+    g_enc.band_count = 0;
+}
+
+static int init_conversion(int width, int height) {
+    const int in_w = g_enc.in_w, in_h = g_enc.in_h;
 
     g_enc.frame = av_frame_alloc();
-    g_enc.frame->format = g_enc.codec_ctx->pix_fmt;
+    if (!g_enc.frame) return 0;
+    g_enc.frame->format = g_enc.pix_fmt;
     g_enc.frame->width = width;
     g_enc.frame->height = height;
-    av_frame_get_buffer(g_enc.frame, 0);
+    if (av_frame_get_buffer(g_enc.frame, 0) < 0) return 0;
+
+    // 1:2 and 2:3 downscales run through our own box/area filters and leave
+    // swscale a same-size colour conversion; other ratios go to swscale.
+    g_enc.scale_mode = scale_pick_mode(in_w, in_h, width, height);
+    if (g_enc.fast_scaler &&
+        (g_enc.scale_mode == SCALE_HALF || g_enc.scale_mode == SCALE_TWO_THIRDS)) {
+        if (!frame_alloc(&g_enc.scale_buf, width, height)) {
+            log_error("Could not allocate scale buffer");
+            return 0;
+        }
+    } else if (g_enc.scale_mode != SCALE_NONE) {
+        g_enc.scale_mode = SCALE_GENERIC;
+    }
+
+    if (g_enc.scale_mode == SCALE_GENERIC) {
+        int flags = g_enc.fast_scaler ? SWS_FAST_BILINEAR : SWS_BICUBIC;
+        g_enc.sws_src_h = in_h;
+        g_enc.sws_ctx = sws_getContext(in_w, in_h, AV_PIX_FMT_BGRA,
+                                       width, height, g_enc.pix_fmt,
+                                       flags, NULL, NULL, NULL);
+        if (!g_enc.sws_ctx) {
+            log_error("Could not create colour converter");
+            return 0;
+        }
+    } else if (!init_band_converters(width, height)) {
+        log_error("Could not create colour converter");
+        return 0;
+    }
+    return 1;
+}
+
+int init_encoder(const EncoderConfig *cfg) {
+    const char *filename = cfg->filename;
+    const int in_w = cfg->width, in_h = cfg->height;
+    const int width = cfg->out_width > 0 ? cfg->out_width : in_w;
+    const int height = cfg->out_height > 0 ? cfg->out_height : in_h;
+
+    g_enc.cfg = *cfg;
+    g_enc.in_w = in_w;
+    g_enc.in_h = in_h;
+    g_enc.crf = cfg->crf;
+    g_enc.preset = cfg->preset;
+    g_enc.fast_scaler = !cfg->scaler || strcmp(cfg->scaler, "bicubic") != 0;
+
+    g_enc.oformat = av_guess_format(NULL, filename, NULL);
+    if (!g_enc.oformat) {
+        log_error("Could not find a container for %s", filename);
+        return 0;
+    }
+
+    const char *codec_name = cfg->codec;
+    g_enc.pix_fmt = AV_PIX_FMT_YUV420P;
+    if (cfg->intermediate) {
+        bool raw = !strcmp(cfg->intermediate, "raw");
+        codec_name = raw ? "rawvideo" : "libx264";
+        if (raw) g_enc.pix_fmt = AV_PIX_FMT_NV12;
+    }
+
+    g_enc.video_codec = avcodec_find_encoder_by_name(codec_name);
+    if (!g_enc.video_codec) {
+        log_error("Codec %s not found", codec_name);
+        return 0;
+    }
+
+    g_enc.codec_ctx = open_video(width, height, cfg->preset, cfg->crf);
+    if (!g_enc.codec_ctx) {
+        log_error("Could not open codec");
+        return 0;
+    }
+
+    if (cfg->audio_codec && !open_audio(cfg))
+        return 0;
+
+    char first[1024];
+    g_enc.segment_index = 0;
+    g_enc.segment_start_us = -1;
+    segment_name(first, sizeof(first), 0);
+    g_enc.fmt_ctx = open_output(first);
+    if (!g_enc.fmt_ctx) {
+        log_error("Error occurred when opening output file");
+        return 0;
+    }
+
+    if (cfg->rotate_sec > 0 || cfg->rotate_bytes > 0) {
+        mutex_init(&g_finalize.lock);
+        cond_init(&g_finalize.wake);
+        g_finalize.started = thread_create(&g_finalize.thread, finalize_thread_func, NULL);
+        if (!g_finalize.started)
+            log_warn("No finalizer thread, segments will be closed inline");
+    }
 
     g_enc.pkt = av_packet_alloc();
-    g_enc.sws_ctx = sws_getContext(width, height, AV_PIX_FMT_BGRA,
-                                   width, height, AV_PIX_FMT_YUV420P,
-                                   SWS_BICUBIC, NULL, NULL, NULL);
+
+    if (!init_conversion(width, height))
+        return 0;
+
+    g_enc.roi_enabled = cfg->roi_qp > 0 && !cfg->intermediate;
+    if (g_enc.roi_enabled && !roi_init(&g_enc.roi, in_w, in_h))
+        return 0;
+
     g_enc.frame_count = 0;
+    g_enc.last_pts = -1;
+    g_enc.resume_pts = 0;
+    mutex_init(&g_enc.mux_lock);
+    g_enc.clock_origin_us = time_now_us();
     
-    log_info("Muxer and Encoder initialized: %s", filename);
+    log_info("Muxer and Encoder initialized: %s (%s %dx%d@%d, canvas %dx%d, scaler %s)",
+             first, codec_name, width, height, cfg->fps, in_w, in_h,
+             scale_mode_name(g_enc.scale_mode));
+    return 1;
+}
+
+void encoder_set_packet_hook(EncoderPacketHook hook) {
+    g_enc.packet_hook = hook;
 }
 
-void encode_frame(unsigned char *bgra_data) {
-    const uint8_t *src_data[1] = { bgra_data };
-    int src_linesize[1] = { 4 * g_enc.codec_ctx->width };
-    sws_scale(g_enc.sws_ctx, src_data, src_linesize, 0, g_enc.codec_ctx->height,
-              g_enc.frame->data, g_enc.frame->linesize);
-    g_enc.frame->pts = g_enc.frame_count++;
+int encoder_has_option(const char *name) {
+    return g_enc.codec_ctx &&
+           av_opt_find(g_enc.codec_ctx->priv_data, name, NULL, 0, 0) != NULL;
+}
+
+int encoder_set_crf(int crf) {
+    if (!g_enc.codec_ctx ||
+        av_opt_set_double(g_enc.codec_ctx->priv_data, "crf", crf, 0) < 0)
+        return 0;
+    g_enc.crf = crf;
+    return 1;
+}
+
+int encoder_set_bitrate(int kbps) {
+    AVCodecContext *ctx = g_enc.codec_ctx;
+    if (!ctx || g_enc.cfg.bitrate_kbps <= 0) return 0;
+    ctx->bit_rate = (int64_t)kbps * 1000;
+    ctx->rc_max_rate = ctx->bit_rate;
+    ctx->rc_buffer_size = (int)(ctx->bit_rate * 2);
+    g_enc.cfg.bitrate_kbps = kbps;
+    return 1;
+}
+
+// The conversion fields of g_enc, set aside while a replacement is built.
+typedef struct {
+  AVFrame *frame;
+  struct SwsContext *sws_ctx;
+  int sws_src_h;
+  struct SwsContext *band_sws[JOBS_MAX_WORKERS + 1];
+  void *band_scratch[JOBS_MAX_WORKERS + 1];
+  int band_count;
+  int band_h;
+  ScaleMode scale_mode;
+  FrameBuffer scale_buf;
+} Conversion;
+
+// Moves the conversion out of g_enc, leaving it empty.
+static void save_conversion(Conversion *c) {
+    c->frame = g_enc.frame;
+    c->sws_ctx = g_enc.sws_ctx;
+    c->sws_src_h = g_enc.sws_src_h;
+    memcpy(c->band_sws, g_enc.band_sws, sizeof(c->band_sws));
+    memcpy(c->band_scratch, g_enc.band_scratch, sizeof(c->band_scratch));
+    c->band_count = g_enc.band_count;
+    c->band_h = g_enc.band_h;
+    c->scale_mode = g_enc.scale_mode;
+    c->scale_buf = g_enc.scale_buf;
+
+    g_enc.frame = NULL;
+    g_enc.sws_ctx = NULL;
+    memset(g_enc.band_sws, 0, sizeof(g_enc.band_sws));
+    memset(g_enc.band_scratch, 0, sizeof(g_enc.band_scratch));
+    g_enc.band_count = 0;
+    memset(&g_enc.scale_buf, 0, sizeof(g_enc.scale_buf));
+}
+
+// Puts a saved conversion back; g_enc's own must be empty or freed.
+static void restore_conversion(const Conversion *c) {
+    g_enc.frame = c->frame;
+    g_enc.sws_ctx = c->sws_ctx;
+    g_enc.sws_src_h = c->sws_src_h;
+    memcpy(g_enc.band_sws, c->band_sws, sizeof(g_enc.band_sws));
+    memcpy(g_enc.band_scratch, c->band_scratch, sizeof(g_enc.band_scratch));
+    g_enc.band_count = c->band_count;
+    g_enc.band_h = c->band_h;
+    g_enc.scale_mode = c->scale_mode;
+    g_enc.scale_buf = c->scale_buf;
+}
+
+int encoder_can_resize(void) {
+    return g_enc.cfg.rotate_sec > 0 || g_enc.cfg.rotate_bytes > 0;
+}
+
+int encoder_reconfigure(const char *preset, int width, int height) {
+    if (!g_enc.cfg.adaptive && !g_enc.cfg.reconfigurable) return 0;
+
+    // The stream's codec parameters are written once per file, so a new
+    // size needs a new segment to describe it.
+    const bool resize = !g_enc.frame || g_enc.frame->width != width ||
+                        g_enc.frame->height != height;
+    if (resize && !encoder_can_resize()) {
+        log_error("Output size changes need --rotate-time or --rotate-size");
+        return 0;
+    }
+
+    // Open the replacement and its conversion first so a failure leaves the
+    // old ones running.
+    AVCodecContext *ctx = open_video(width, height, preset, g_enc.crf);
+    if (!ctx) {
+        log_error("Could not reopen %s at %dx%d (%s)", g_enc.cfg.codec, width, height,
+                  preset ? preset : "default");
+        return 0;
+    }
+    Conversion old = {0};
+    if (resize) {
+        save_conversion(&old);
+        if (!init_conversion(width, height)) {
+            free_conversion();
+            restore_conversion(&old);
+            avcodec_free_context(&ctx);
+            log_error("Could not build conversion for %dx%d", width, height);
+            return 0;
+        }
+    }
+
+    avcodec_send_frame(g_enc.codec_ctx, NULL);
+    write_packets(g_enc.codec_ctx, VIDEO_STREAM, g_enc.pkt);
+    avcodec_free_context(&g_enc.codec_ctx);
+    g_enc.codec_ctx = ctx;
+    g_enc.preset = preset;
+
+    // With rotation each segment keeps one set of parameters; the new
+    // encoder's first frame is an IDR to start the next one on.
+    if (g_enc.cfg.rotate_sec > 0 || g_enc.cfg.rotate_bytes > 0) {
+        mutex_lock(&g_enc.mux_lock);
+        next_segment();
+        g_enc.segment_start_us = -1;
+        mutex_unlock(&g_enc.mux_lock);
+    }
+
+    // The new encoder's first dts sits up to its reorder delay before its
+    // first pts; skip that many ticks so dts stays monotonic in the stream
+    // without pushing later frames off the shared clock.
+    g_enc.resume_pts = g_enc.last_pts + 1 + ctx->has_b_frames;
+
+    if (resize) {
+        Conversion cur;
+        save_conversion(&cur);
+        restore_conversion(&old);
+        free_conversion();
+        restore_conversion(&cur);
+    }
+    return 1;
+}
+
+int encoder_set_output_size(int width, int height) {
+    return encoder_reconfigure(g_enc.preset, width, height);
+}
+
+int encoder_set_input_size(int width, int height) {
+    if (!g_enc.frame) return 0;
+    if (width == g_enc.in_w && height == g_enc.in_h) return 1;
+
+    const int out_w = g_enc.frame->width, out_h = g_enc.frame->height;
+    g_enc.in_w = width;
+    g_enc.in_h = height;
+    free_conversion();
+    if (!init_conversion(out_w, out_h)) {
+        free_conversion();
+        log_error("Could not rebuild conversion for a %dx%d canvas", width, height);
+        return 0;
+    }
+    if (g_enc.roi_enabled) {
+        roi_free(&g_enc.roi);
+        g_enc.roi_enabled = roi_init(&g_enc.roi, width, height);
+    }
+    log_info("Encoder input %dx%d, scaled to %dx%d (%s)", width, height, out_w, out_h,
+             scale_mode_name(g_enc.scale_mode));
+    return 1;
+}
+
+long long encoder_clock_origin(void) {
+    return g_enc.clock_origin_us;
+}
+
+int encoder_audio_frame_size(void) {
+    if (!g_enc.audio_ctx) return 0;
+    if (g_enc.audio_ctx->frame_size > 0) return g_enc.audio_ctx->frame_size;
+    return g_enc.audio_ctx->sample_rate / 50;
+}
+
+void encode_frame(const unsigned char *bgra_data, int stride, long long timestamp_us) {
+    if (!g_enc.frame) return;
+
+    // pts follows the shared monotonic clock so audio and video line up; two
+    // frames landing in the same tick are pushed apart to stay monotonic.
+    int64_t pts = av_rescale_q(timestamp_us - g_enc.clock_origin_us,
+                               (AVRational){1, 1000000}, g_enc.codec_ctx->time_base);
+    if (pts < g_enc.resume_pts) return;
+    if (pts <= g_enc.last_pts) pts = g_enc.last_pts + 1;
+
+    if (g_enc.sws_ctx) {
+        const uint8_t *src_data[1] = { bgra_data };
+        int src_linesize[1] = { stride };
+        sws_scale(g_enc.sws_ctx, src_data, src_linesize, 0, g_enc.sws_src_h,
+                  g_enc.frame->data, g_enc.frame->linesize);
+    } else {
+        ConvertJob job = { bgra_data, stride };
+        jobs_parallel_for(g_enc.band_count, convert_band, &job);
+    }
+
+    if (g_enc.roi_enabled)
+        attach_roi(bgra_data, stride);
+
+    g_enc.last_pts = pts;
+    g_enc.frame->pts = pts;
+    g_enc.frame->pict_type = g_enc.force_key ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+    g_enc.force_key = false;
+    g_enc.frame_count++;
     
-     if (avcodec_send_frame(g_enc.codec_ctx, g_enc.frame) >= 0) {
-        while (avcodec_receive_packet(g_enc.codec_ctx, g_enc.pkt) >= 0) {
-            av_packet_rescale_ts(g_enc.pkt, g_enc.codec_ctx->time_base, g_enc.video_stream->time_base);
-            g_enc.pkt->stream_index = g_enc.video_stream->index;
+     if (avcodec_send_frame(g_enc.codec_ctx, g_enc.frame) >= 0)
+        write_packets(g_enc.codec_ctx, VIDEO_STREAM, g_enc.pkt);
+}
+
+void encode_audio(const float *samples, int frames, long long pts) {
+    AVFrame *f = g_enc.audio_frame;
+    const int channels = g_enc.audio_ctx->ch_layout.nb_channels;
 
-            av_interleaved_write_frame(g_enc.fmt_ctx, g_enc.pkt);
-            av_packet_unref(g_enc.pkt);
+    if (av_frame_make_writable(f) < 0) return;
+    f->nb_samples = frames;
+    f->pts = pts;
+
+    switch (f->format) {
+    case AV_SAMPLE_FMT_FLT:
+        memcpy(f->data[0], samples, sizeof(float) * (size_t)frames * channels);
+        break;
+    case AV_SAMPLE_FMT_FLTP:
+        for (int c = 0; c < channels; c++) {
+            float *dst = (float *)f->extended_data[c];
+            for (int i = 0; i < frames; i++)
+                dst[i] = samples[i * channels + c];
+        }
+        break;
+    case AV_SAMPLE_FMT_S16: {
+        int16_t *dst = (int16_t *)f->data[0];
+        for (int i = 0; i < frames * channels; i++) {
+            float v = samples[i] * 32767.0f;
+            dst[i] = (int16_t)(v > 32767.0f ? 32767 : v < -32768.0f ? -32768 : v);
         }
+        break;
     }
+    default:
+        log_error("Unsupported audio sample format %d", f->format);
+        return;
+    }
+
+    if (avcodec_send_frame(g_enc.audio_ctx, f) >= 0)
+        write_packets(g_enc.audio_ctx, AUDIO_STREAM, g_enc.audio_pkt);
 }
 
+// Drains both encoders into the current segment, then waits for every
+// segment to be finalized.
 void cleanup_encoder() {
     avcodec_send_frame(g_enc.codec_ctx, NULL);
-    av_write_trailer(g_enc.fmt_ctx);
-    avio_closep(&g_enc.fmt_ctx->pb);
-    avformat_free_context(g_enc.fmt_ctx);
+    write_packets(g_enc.codec_ctx, VIDEO_STREAM, g_enc.pkt);
+    if (g_enc.audio_ctx) {
+        avcodec_send_frame(g_enc.audio_ctx, NULL);
+        write_packets(g_enc.audio_ctx, AUDIO_STREAM, g_enc.audio_pkt);
+    }
+    finalize_output(g_enc.fmt_ctx);
+    g_enc.fmt_ctx = NULL;
+
+    if (g_finalize.started) {
+        mutex_lock(&g_finalize.lock);
+        g_finalize.stop = true;
+        mutex_unlock(&g_finalize.lock);
+        cond_broadcast(&g_finalize.wake);
+        thread_join(g_finalize.thread);
+        g_finalize.started = false;
+    }
+    if (g_enc.cfg.rotate_sec > 0 || g_enc.cfg.rotate_bytes > 0) {
+        cond_destroy(&g_finalize.wake);
+        mutex_destroy(&g_finalize.lock);
+    }
+
+    avcodec_free_context(&g_enc.codec_ctx);
+    avcodec_free_context(&g_enc.audio_ctx);
+    av_frame_free(&g_enc.audio_frame);
+    av_packet_free(&g_enc.audio_pkt);
+    av_packet_free(&g_enc.pkt);
+    free_conversion();
+    if (g_enc.roi_enabled)
+        roi_free(&g_enc.roi);
+    mutex_destroy(&g_enc.mux_lock);
 }
\ No newline at end of file
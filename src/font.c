@@ -5,11 +5,121 @@
 #include "logger.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 
-static stbtt_bakedchar cdata[96];
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define make_dir(path) _mkdir(path)
+#define process_id()   _getpid()
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define make_dir(path) mkdir(path, 0755)
+#define process_id()   getpid()
+#endif
+
+#define FONT_FIRST_CHAR 32
+#define FONT_CHAR_COUNT 96
+#define FONT_CACHE_MAGIC   0x544E4643u // "CFNT"
+#define FONT_CACHE_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t font_hash;
+    float    size;
+    uint32_t atlas_size;
+} FontCacheHeader;
+
+static const size_t CHARDATA_BYTES = sizeof(stbtt_bakedchar) * FONT_CHAR_COUNT;
+static const size_t BITMAP_BYTES   = (size_t)FONT_ATLAS_SIZE * FONT_ATLAS_SIZE;
+
+// FNV-1a; only has to tell font files apart, not resist anyone.
+static uint64_t hash_bytes(const unsigned char* data, size_t size) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// $XDG_CACHE_HOME/castr, ~/.cache/castr or %LOCALAPPDATA%\castr, created
+// on demand.
+static int cache_path(char* out, size_t cap, uint64_t font_hash, float size) {
+    char dir[512];
+#ifdef _WIN32
+    const char* base = getenv("LOCALAPPDATA");
+    if (!base || !*base) return 0;
+    snprintf(dir, sizeof(dir), "%s\\castr", base);
+#else
+    const char* xdg  = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (xdg && *xdg) {
+        snprintf(dir, sizeof(dir), "%s/castr", xdg);
+    } else if (home && *home) {
+        snprintf(dir, sizeof(dir), "%s/.cache", home);
+        make_dir(dir);
+        snprintf(dir, sizeof(dir), "%s/.cache/castr", home);
+    } else {
+        return 0;
+    }
+#endif
+    make_dir(dir);
+    int n = snprintf(out, cap, "%s/font-%016llx-%d.atlas", dir,
+                     (unsigned long long)font_hash, (int)(size * 100.0f + 0.5f));
+    return n > 0 && (size_t)n < cap;
+}
+
+static int cache_load(FontAtlas* atlas, const char* path, uint64_t font_hash) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return 0;
+
+    FontCacheHeader h;
+    int ok = fread(&h, sizeof(h), 1, f) == 1 &&
+             h.magic == FONT_CACHE_MAGIC && h.version == FONT_CACHE_VERSION &&
+             h.font_hash == font_hash && h.size == atlas->size &&
+             h.atlas_size == FONT_ATLAS_SIZE &&
+             fread(atlas->chardata, CHARDATA_BYTES, 1, f) == 1 &&
+             fread(atlas->bitmap, BITMAP_BYTES, 1, f) == 1 &&
+             fgetc(f) == EOF;
+    fclose(f);
+    return ok;
+}
+
+// Written under a temporary name and renamed, so a concurrent start never
+// reads half a file.
+static void cache_store(const FontAtlas* atlas, const char* path, uint64_t font_hash) {
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)process_id());
+    FILE* f = fopen(tmp, "wb");
+    if (!f) {
+        log_warn("Cannot write font cache %s", tmp);
+        return;
+    }
+
+    FontCacheHeader h = {
+        .magic      = FONT_CACHE_MAGIC,
+        .version    = FONT_CACHE_VERSION,
+        .font_hash  = font_hash,
+        .size       = atlas->size,
+        .atlas_size = FONT_ATLAS_SIZE,
+    };
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+             fwrite(atlas->chardata, CHARDATA_BYTES, 1, f) == 1 &&
+             fwrite(atlas->bitmap, BITMAP_BYTES, 1, f) == 1;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp, path) != 0) {
+        if (!ok) log_warn("Failed to write font cache %s", tmp);
+        remove(tmp);
+    }
+}
+
+int font_bake(FontAtlas* atlas, const char* path, float size) {
+    memset(atlas, 0, sizeof(*atlas));
 
-int font_init(Font* font, const char* path, float size) {
     // Get actual file size
     FILE* f = fopen(path, "rb");
     if (!f) {
@@ -20,30 +130,66 @@ int font_init(Font* font, const char* path, float size) {
     long file_size = ftell(f);
     rewind(f);
 
-    unsigned char* ttf_buffer = malloc(file_size);
+    unsigned char* ttf_buffer = file_size > 0 ? malloc(file_size) : NULL;
     if (!ttf_buffer) {
         log_error("Failed to allocate font buffer");
         fclose(f);
         return 0;
     }
-    fread(ttf_buffer, 1, file_size, f);
+    size_t got = fread(ttf_buffer, 1, file_size, f);
     fclose(f);
+    if (got != (size_t)file_size) {
+        log_error("Failed to read font file: %s", path);
+        free(ttf_buffer);
+        return 0;
+    }
 
-    unsigned char* temp_bitmap = malloc(512 * 512);
-    if (!temp_bitmap) {
+    atlas->size     = size;
+    atlas->bitmap   = malloc(BITMAP_BYTES);
+    atlas->chardata = malloc(CHARDATA_BYTES);
+    if (!atlas->bitmap || !atlas->chardata) {
         log_error("Failed to allocate bitmap buffer");
         free(ttf_buffer);
+        font_atlas_free(atlas);
         return 0;
     }
 
-    stbtt_BakeFontBitmap(ttf_buffer, 0, size, temp_bitmap, 512, 512, 32, 96, cdata);
+    const uint64_t font_hash = hash_bytes(ttf_buffer, (size_t)file_size);
+    char cache[600];
+    const int cacheable = cache_path(cache, sizeof(cache), font_hash, size);
+    if (cacheable && cache_load(atlas, cache, font_hash)) {
+        free(ttf_buffer);
+        log_info("Font atlas loaded from cache: %s", cache);
+        return 1;
+    }
+
+    int rows = stbtt_BakeFontBitmap(ttf_buffer, 0, size, atlas->bitmap,
+                                    FONT_ATLAS_SIZE, FONT_ATLAS_SIZE, FONT_FIRST_CHAR,
+                                    FONT_CHAR_COUNT, (stbtt_bakedchar*)atlas->chardata);
     free(ttf_buffer);
+    if (rows == 0) {
+        log_error("Failed to bake font: %s", path);
+        font_atlas_free(atlas);
+        return 0;
+    }
+    if (cacheable)
+        cache_store(atlas, cache, font_hash);
+    return 1;
+}
+
+void font_atlas_free(FontAtlas* atlas) {
+    free(atlas->bitmap);
+    free(atlas->chardata);
+    memset(atlas, 0, sizeof(*atlas));
+}
 
+int font_upload(Font* font, FontAtlas* atlas) {
     glGenTextures(1, &font->texture);
     glBindTexture(GL_TEXTURE_2D, font->texture);
 
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, 512, 512, 0, GL_RED, GL_UNSIGNED_BYTE, temp_bitmap);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, FONT_ATLAS_SIZE, FONT_ATLAS_SIZE, 0,
+                 GL_RED, GL_UNSIGNED_BYTE, atlas->bitmap);
 
     const GLint swizzleMask[] = {GL_RED, GL_RED, GL_RED, GL_RED};
     glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzleMask);
@@ -51,16 +197,19 @@ int font_init(Font* font, const char* path, float size) {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    free(temp_bitmap);
+    free(atlas->bitmap);
+    atlas->bitmap = NULL;
 
-    font->size = size;
-    font->chardata = malloc(sizeof(cdata));
-    if (!font->chardata) {
-        log_error("Failed to allocate chardata");
-        glDeleteTextures(1, &font->texture);
-        return 0;
-    }
-    memcpy(font->chardata, cdata, sizeof(cdata));
+    font->size = atlas->size;
+    font->chardata = atlas->chardata;
+    atlas->chardata = NULL;
+    return 1;
+}
+
+int font_init(Font* font, const char* path, float size) {
+    FontAtlas atlas;
+    if (!font_bake(&atlas, path, size)) return 0;
+    font_upload(font, &atlas);
 
     log_info("Font initialized successfully: %s", path);
     return 1;
@@ -83,7 +232,7 @@ void font_draw(Font* font, const char* text, float x, float y) {
             stbtt_aligned_quad q;
             stbtt_GetBakedQuad(
                 (stbtt_bakedchar*)font->chardata,
-                512, 512, *p - 32, &x, &y, &q, 0
+                FONT_ATLAS_SIZE, FONT_ATLAS_SIZE, *p - 32, &x, &y, &q, 0
             );
             glTexCoord2f(q.s0, q.t0); glVertex2f(q.x0, q.y0);
             glTexCoord2f(q.s1, q.t0); glVertex2f(q.x1, q.y0);
@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <string.h>
+#include "frame_alloc.h"
+#include "logger.h"
+#include "threading.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define HUGE_PAGE_SIZE (2u * 1024 * 1024)
+#define SMALL_PAGE     4096u
+
+// FrameAllocStats, updated from any thread that allocates.
+static struct {
+    atomic_i64 buffers;
+    atomic_i64 bytes;
+    atomic_i64 huge_bytes;
+    atomic_i64 peak_bytes;
+} g_stats;
+
+static size_t round_up(size_t v, size_t to) {
+    return (v + to - 1) / to * to;
+}
+
+static void account(const FrameBuffer* fb, int sign) {
+    long long bytes = sign * (long long)fb->mapped;
+    atomic_add_i64(&g_stats.buffers, sign);
+    long long now = atomic_add_i64(&g_stats.bytes, bytes);
+    if (fb->pages == FRAME_PAGES_HUGE)
+        atomic_add_i64(&g_stats.huge_bytes, bytes);
+    long long peak = atomic_load_i64(&g_stats.peak_bytes);
+    while (now > peak) {
+        long long prev = atomic_cas_i64(&g_stats.peak_bytes, peak, now);
+        if (prev == peak) break;
+        peak = prev;
+    }
+}
+
+#ifdef _WIN32
+static bool enable_lock_memory_privilege(void) {
+    static int state = 0; // 0 untried, 1 enabled, -1 unavailable
+    if (state) return state > 0;
+
+    HANDLE token;
+    state = -1;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+        return false;
+
+    TOKEN_PRIVILEGES tp = {0};
+    tp.PrivilegeCount = 1;
+    tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    if (LookupPrivilegeValueA(NULL, "SeLockMemoryPrivilege", &tp.Privileges[0].Luid) &&
+        AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL) &&
+        GetLastError() == ERROR_SUCCESS)
+        state = 1;
+    CloseHandle(token);
+    return state > 0;
+}
+
+static int map_pages(FrameBuffer* fb) {
+    SIZE_T large = GetLargePageMinimum();
+    if (large && enable_lock_memory_privilege()) {
+        fb->mapped = round_up(fb->size, large);
+        fb->data = VirtualAlloc(NULL, fb->mapped,
+                                MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (fb->data) {
+            fb->pages = FRAME_PAGES_HUGE;
+            return 1;
+        }
+    }
+
+    fb->mapped = round_up(fb->size, SMALL_PAGE);
+    fb->data = VirtualAlloc(NULL, fb->mapped, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    fb->pages = FRAME_PAGES_NORMAL;
+    return fb->data != NULL;
+}
+
+static void unmap_pages(FrameBuffer* fb) {
+    VirtualFree(fb->data, 0, MEM_RELEASE);
+}
+#else
+static int map_pages(FrameBuffer* fb) {
+#ifdef MAP_HUGETLB
+    fb->mapped = round_up(fb->size, HUGE_PAGE_SIZE);
+    void* p = mmap(NULL, fb->mapped, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        fb->data  = p;
+        fb->pages = FRAME_PAGES_HUGE;
+        return 1;
+    }
+#endif
+
+    // Over-reserve so the buffer can start on a 2 MB boundary, which THP
+    // needs to back it with huge pages, then trim the slack.
+    size_t size  = round_up(fb->size, SMALL_PAGE);
+    size_t total = size + HUGE_PAGE_SIZE;
+    unsigned char* base = mmap(NULL, total, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return 0;
+
+    unsigned char* aligned = (unsigned char*)round_up((size_t)base, HUGE_PAGE_SIZE);
+    if (aligned > base) munmap(base, (size_t)(aligned - base));
+    size_t tail = (size_t)(base + total - (aligned + size));
+    if (tail) munmap(aligned + size, tail);
+
+    fb->data   = aligned;
+    fb->mapped = size;
+    fb->pages  = FRAME_PAGES_NORMAL;
+#ifdef MADV_HUGEPAGE
+    if (size >= HUGE_PAGE_SIZE && madvise(aligned, size, MADV_HUGEPAGE) == 0)
+        fb->pages = FRAME_PAGES_TRANSPARENT;
+#endif
+    return 1;
+}
+
+static void unmap_pages(FrameBuffer* fb) {
+    munmap(fb->data, fb->mapped);
+}
+#endif
+
+int frame_alloc_bytes(FrameBuffer* fb, size_t size) {
+    memset(fb, 0, sizeof(*fb));
+    fb->size = size;
+    if (!size || !map_pages(fb)) {
+        log_error("Failed to allocate %zu byte frame buffer", size);
+        memset(fb, 0, sizeof(*fb));
+        return 0;
+    }
+
+    // Touch every page now so faults (and any commit failure) happen at
+    // startup rather than on the first captured frame.
+    for (size_t off = 0; off < fb->mapped; off += SMALL_PAGE)
+        fb->data[off] = 0;
+
+    account(fb, 1);
+    return 1;
+}
+
+int frame_alloc(FrameBuffer* fb, int width, int height) {
+    int stride = (int)round_up((size_t)width * 4, FRAME_ALIGN);
+    if (!frame_alloc_bytes(fb, (size_t)stride * height))
+        return 0;
+    fb->width  = width;
+    fb->height = height;
+    fb->stride = stride;
+    return 1;
+}
+
+void frame_free(FrameBuffer* fb) {
+    if (!fb->data) return;
+    account(fb, -1);
+    unmap_pages(fb);
+    memset(fb, 0, sizeof(*fb));
+}
+
+void* mem_aligned_alloc(size_t size, size_t align) {
+#ifdef _WIN32
+    return _aligned_malloc(size, align);
+#else
+    void* p;
+    if (align < sizeof(void*)) align = sizeof(void*);
+    return posix_memalign(&p, align, size) == 0 ? p : NULL;
+#endif
+}
+
+void mem_aligned_free(void* p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+void frame_alloc_get_stats(FrameAllocStats* stats) {
+    stats->buffers    = atomic_load_i64(&g_stats.buffers);
+    stats->bytes      = atomic_load_i64(&g_stats.bytes);
+    stats->huge_bytes = atomic_load_i64(&g_stats.huge_bytes);
+    stats->peak_bytes = atomic_load_i64(&g_stats.peak_bytes);
+}
+
+void frame_alloc_log_stats(void) {
+    FrameAllocStats s;
+    frame_alloc_get_stats(&s);
+    log_info("Frame memory: %lld buffers, %.1f MB in use (%.1f MB huge pages), peak %.1f MB",
+             s.buffers, s.bytes / 1048576.0, s.huge_bytes / 1048576.0,
+             s.peak_bytes / 1048576.0);
+}
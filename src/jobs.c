@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include <string.h>
+#include "jobs.h"
+#include "logger.h"
+#include "threading.h"
+#include "utils.h"
+
+#define DEQUE_SIZE 256
+
+typedef struct {
+    JobFunc       fn;
+    void*         ctx;
+    atomic_i32    remaining;
+} JobBatch;
+
+typedef struct {
+    JobBatch* batch;
+    int       index;
+} Job;
+
+// Owner pushes and pops at the bottom, thieves take from the top.
+typedef struct {
+    Mutex              lock;
+    Job                jobs[DEQUE_SIZE];
+    int                top, bottom;
+    Thread             thread;
+    atomic_i64         busy_us;  // written by the owner, read by jobs_get_stats
+    atomic_i64         executed;
+    atomic_i64         steals;
+} Worker;
+
+typedef struct {
+    Worker             workers[JOBS_MAX_WORKERS];
+    int                count;
+    atomic_i32         running;
+    atomic_i32         queued;
+    atomic_i32         next_push;
+    long long          start_us;
+    Mutex              sleep_lock;
+    Cond               wake;
+} JobSystem;
+
+static JobSystem g_jobs = {0};
+
+static bool deque_push(Worker* w, Job job) {
+    bool ok = false;
+    mutex_lock(&w->lock);
+    if (w->bottom - w->top < DEQUE_SIZE) {
+        w->jobs[w->bottom % DEQUE_SIZE] = job;
+        w->bottom++;
+        ok = true;
+    }
+    mutex_unlock(&w->lock);
+    return ok;
+}
+
+static bool deque_pop(Worker* w, Job* job) {
+    bool ok = false;
+    mutex_lock(&w->lock);
+    if (w->bottom > w->top) {
+        w->bottom--;
+        *job = w->jobs[w->bottom % DEQUE_SIZE];
+        ok = true;
+    }
+    mutex_unlock(&w->lock);
+    return ok;
+}
+
+static bool deque_steal(Worker* w, Job* job) {
+    bool ok = false;
+    mutex_lock(&w->lock);
+    if (w->bottom > w->top) {
+        *job = w->jobs[w->top % DEQUE_SIZE];
+        w->top++;
+        ok = true;
+    }
+    mutex_unlock(&w->lock);
+    return ok;
+}
+
+// `self` is -1 for threads outside the pool.
+static bool find_job(int self, Job* job, bool* stolen) {
+    if (self >= 0 && deque_pop(&g_jobs.workers[self], job)) {
+        *stolen = false;
+        return true;
+    }
+    int start = self >= 0 ? self + 1 : 0;
+    for (int n = 0; n < g_jobs.count; n++) {
+        int victim = (start + n) % g_jobs.count;
+        if (victim == self) continue;
+        if (deque_steal(&g_jobs.workers[victim], job)) {
+            *stolen = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void run_job(Job* job) {
+    atomic_add_i32(&g_jobs.queued, -1);
+    job->batch->fn(job->batch->ctx, job->index);
+    atomic_add_i32(&job->batch->remaining, -1);
+}
+
+static void worker_func(void* arg) {
+    int     self = (int)(size_t)arg;
+    Worker* w    = &g_jobs.workers[self];
+
+    while (atomic_load_i32(&g_jobs.running)) {
+        Job  job;
+        bool stolen;
+        if (find_job(self, &job, &stolen)) {
+            long long t0 = time_now_us();
+            run_job(&job);
+            atomic_add_i64(&w->busy_us, time_now_us() - t0);
+            atomic_add_i64(&w->executed, 1);
+            if (stolen) atomic_add_i64(&w->steals, 1);
+            continue;
+        }
+
+        mutex_lock(&g_jobs.sleep_lock);
+        while (atomic_load_i32(&g_jobs.running) && atomic_load_i32(&g_jobs.queued) <= 0)
+            cond_wait(&g_jobs.wake, &g_jobs.sleep_lock);
+        mutex_unlock(&g_jobs.sleep_lock);
+    }
+}
+
+int jobs_init(int workers) {
+    if (workers <= 0)
+        workers = cpu_count() - 1;
+    if (workers > JOBS_MAX_WORKERS) workers = JOBS_MAX_WORKERS;
+    if (workers <= 0) return 1;
+
+    memset(&g_jobs, 0, sizeof(g_jobs));
+    g_jobs.running  = 1;
+    g_jobs.start_us = time_now_us();
+    mutex_init(&g_jobs.sleep_lock);
+    cond_init(&g_jobs.wake);
+
+    for (int i = 0; i < workers; i++) {
+        Worker* w = &g_jobs.workers[i];
+        mutex_init(&w->lock);
+        if (!thread_create(&w->thread, worker_func, (void*)(size_t)i)) {
+            log_error("Failed to start job worker %d", i);
+            mutex_destroy(&w->lock);
+            break;
+        }
+        g_jobs.count++;
+    }
+
+    log_info("Job system: %d workers", g_jobs.count);
+    return g_jobs.count > 0;
+}
+
+void jobs_shutdown(void) {
+    if (!g_jobs.count) return;
+
+    mutex_lock(&g_jobs.sleep_lock);
+    atomic_store_i32(&g_jobs.running, 0);
+    mutex_unlock(&g_jobs.sleep_lock);
+    cond_broadcast(&g_jobs.wake);
+
+    for (int i = 0; i < g_jobs.count; i++) {
+        thread_join(g_jobs.workers[i].thread);
+        mutex_destroy(&g_jobs.workers[i].lock);
+    }
+    cond_destroy(&g_jobs.wake);
+    mutex_destroy(&g_jobs.sleep_lock);
+    g_jobs.count = 0;
+}
+
+int jobs_worker_count(void) {
+    return g_jobs.count;
+}
+
+void jobs_parallel_for(int count, JobFunc fn, void* ctx) {
+    if (count <= 0) return;
+    if (!g_jobs.count || count == 1) {
+        for (int i = 0; i < count; i++) fn(ctx, i);
+        return;
+    }
+
+    JobBatch batch = { fn, ctx, count };
+
+    // Keep the first item for ourselves and spread the rest.
+    for (int i = 1; i < count; i++) {
+        Job     job = { &batch, i };
+        int     n   = atomic_add_i32(&g_jobs.next_push, 1);
+        Worker* w   = &g_jobs.workers[(unsigned)n % (unsigned)g_jobs.count];
+        atomic_add_i32(&g_jobs.queued, 1);
+        if (!deque_push(w, job)) {
+            atomic_add_i32(&g_jobs.queued, -1);
+            fn(ctx, i);
+            atomic_add_i32(&batch.remaining, -1);
+        }
+    }
+
+    // A worker that saw queued == 0 holds sleep_lock until it is parked, so
+    // taking the lock once orders our wake after its wait.
+    mutex_lock(&g_jobs.sleep_lock);
+    mutex_unlock(&g_jobs.sleep_lock);
+    cond_broadcast(&g_jobs.wake);
+
+    fn(ctx, 0);
+    atomic_add_i32(&batch.remaining, -1);
+
+    // Help with whatever is queued (ours or anyone's) until our batch is done.
+    while (atomic_load_i32(&batch.remaining) > 0) {
+        Job  job;
+        bool stolen;
+        if (find_job(-1, &job, &stolen))
+            run_job(&job);
+        else
+            thread_yield();
+    }
+}
+
+typedef struct {
+    JobRowsFunc fn;
+    void*       ctx;
+    int         rows;
+    int         band;
+} RowsBatch;
+
+static void rows_job(void* ctx, int index) {
+    RowsBatch* b  = ctx;
+    int        y0 = index * b->band;
+    int        y1 = y0 + b->band < b->rows ? y0 + b->band : b->rows;
+    b->fn(b->ctx, y0, y1);
+}
+
+void jobs_parallel_rows(int rows, int align, JobRowsFunc fn, void* ctx) {
+    if (align < 1) align = 1;
+    int bands = (g_jobs.count + 1) * 2;
+    int band  = (rows + bands - 1) / bands;
+    band = (band + align - 1) / align * align;
+    if (band < align) band = align;
+
+    RowsBatch b = { fn, ctx, rows, band };
+    jobs_parallel_for((rows + band - 1) / band, rows_job, &b);
+}
+
+int jobs_get_stats(JobWorkerStats* stats, int max) {
+    long long elapsed = time_now_us() - g_jobs.start_us;
+    int n = g_jobs.count < max ? g_jobs.count : max;
+    for (int i = 0; i < n; i++) {
+        Worker* w = &g_jobs.workers[i];
+        long long busy_us = atomic_load_i64(&w->busy_us);
+        stats[i].busy_pct = elapsed > 0 ? 100.0 * (double)busy_us / (double)elapsed : 0.0;
+        stats[i].jobs     = (unsigned long long)atomic_load_i64(&w->executed);
+        stats[i].steals   = (unsigned long long)atomic_load_i64(&w->steals);
+    }
+    return n;
+}
+
+void jobs_log_stats(void) {
+    JobWorkerStats stats[JOBS_MAX_WORKERS];
+    int n = jobs_get_stats(stats, JOBS_MAX_WORKERS);
+    for (int i = 0; i < n; i++)
+        log_info("Job worker %d: %.1f%% busy, %llu jobs, %llu stolen",
+                 i, stats[i].busy_pct, stats[i].jobs, stats[i].steals);
+}
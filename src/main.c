@@ -2,19 +2,30 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
-#include <process.h>
-#include <windows.h>
+#include <signal.h>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
-#include <d3d11.h>
-#include <dxgi1_2.h>
 
 #include "logger.h"
 #include "font.h"
 #include "encoder.h"
 #include "ui.h"
 #include "threading.h"
+#include "readback.h"
+#include "capture.h"
+#include "capture_worker.h"
+#include "options.h"
+#include "audio.h"
+#include "frame_alloc.h"
+#include "jobs.h"
+#include "quality.h"
+#include "transcode.h"
+#include "probe.h"
+#include "shm_export.h"
+#include "snapshot.h"
+#include "control.h"
+#include "utils.h"
 
 #ifndef GL_BGRA
 #define GL_BGRA 0x80E1
@@ -28,15 +39,12 @@
 #ifndef GL_FRAMEBUFFER_COMPLETE
 #define GL_FRAMEBUFFER_COMPLETE 0x8CD5
 #endif
-
-typedef struct {
-    ID3D11Device*           device;
-    ID3D11DeviceContext*    context;
-    IDXGIOutputDuplication* duplication;
-    ID3D11Texture2D*        staging_tex;
-    UINT                    tex_width;
-    UINT                    tex_height;
-} CaptureState;
+#ifndef GL_READ_FRAMEBUFFER
+#define GL_READ_FRAMEBUFFER 0x8CA8
+#endif
+#ifndef GL_DRAW_FRAMEBUFFER
+#define GL_DRAW_FRAMEBUFFER 0x8CA9
+#endif
 
 typedef struct {
     float x, y;
@@ -45,246 +53,97 @@ typedef struct {
     float opacity;
 } RenderSource;
 
-static RenderSource desktop_source = {
-    .x      = 0,
-    .y      = 0,
-    .width  = 1920.0f,
-    .height = 1080.0f,
-    .scale  = 0.5f,
-    .opacity = 1.0f
-};
-
-static CaptureState g_cap   = {0};
-static SharedState  g_state = {0};
-static GLuint       g_fbo, g_canvas_tex;
-
-static HANDLE g_capture_thread = NULL;
-static HANDLE g_encoder_thread = NULL;
+// One per capture source, in compositing order; [0] is --source, the rest
+// come from --add-source.
+static CaptureWorker g_workers[CASTR_MAX_SOURCES];
+static RenderSource  g_layout[CASTR_MAX_SOURCES];
+static int           g_source_count;
+static int           g_selected; // source the panel's slider and reset act on
 
-static int create_duplication(void) {
-    if (g_cap.duplication) {
-        g_cap.duplication->lpVtbl->Release(g_cap.duplication);
-        g_cap.duplication = NULL;
-    }
-
-    IDXGIDevice*  dxgi_device = NULL;
-    IDXGIAdapter* adapter     = NULL;
-    IDXGIOutput*  output      = NULL;
-    IDXGIOutput1* output1     = NULL;
-
-    g_cap.device->lpVtbl->QueryInterface(
-        g_cap.device, &IID_IDXGIDevice, (void**)&dxgi_device);
-    dxgi_device->lpVtbl->GetParent(
-        dxgi_device, &IID_IDXGIAdapter, (void**)&adapter);
-    adapter->lpVtbl->EnumOutputs(adapter, 0, &output);
-    output->lpVtbl->QueryInterface(
-        output, &IID_IDXGIOutput1, (void**)&output1);
+static ReadbackRing g_readback = {0};
+static GLuint       g_fbo, g_canvas_tex;
 
-    HRESULT hr = output1->lpVtbl->DuplicateOutput(
-        output1, (IUnknown*)g_cap.device, &g_cap.duplication);
+static void tune_thread(const CastrOptions* opts, CastrThread thread) {
+    if (opts->thread_cpu[thread] >= 0)
+        thread_set_affinity(opts->thread_cpu[thread]);
+    if (opts->thread_priority[thread] != THREAD_PRIO_NORMAL)
+        thread_set_priority((ThreadPriority)opts->thread_priority[thread]);
+}
 
-    output1->lpVtbl->Release(output1);
-    output->lpVtbl->Release(output);
-    adapter->lpVtbl->Release(adapter);
-    dxgi_device->lpVtbl->Release(dxgi_device);
+// Launch time; startup phases and the first encoded frame are logged
+// relative to it.
+static long long g_startup_us;
 
-    if (FAILED(hr)) {
-        log_error("DuplicateOutput failed: 0x%08X", hr);
-        return 0;
-    }
-    return 1;
+static void note_first_frame(void) {
+    static bool seen;
+    if (seen) return;
+    seen = true;
+    log_info("Startup: first frame encoded %.1f ms after launch",
+             (time_now_us() - g_startup_us) / 1000.0);
 }
 
-static int init_capture(void) {
-    D3D_FEATURE_LEVEL fl;
-    HRESULT hr = D3D11CreateDevice(
-        NULL, D3D_DRIVER_TYPE_HARDWARE, NULL, 0,
-        NULL, 0, D3D11_SDK_VERSION,
-        &g_cap.device, &fl, &g_cap.context);
-    if (FAILED(hr)) {
-        log_error("D3D11CreateDevice failed: 0x%08X", hr);
-        return 0;
-    }
-    return 1;
+// Compositor or direct encoder. The capture size follows `source WxH` on
+// the first source's worker thread.
+static void apply_source_control(const CastrOptions* opts) {
+    int w, h;
+    if (opts->control && control_take_source(&w, &h))
+        capture_worker_resize(&g_workers[0], w, h);
 }
 
-static int capture_frame(unsigned char* out_data, int width, int height) {
-    if (!g_cap.duplication) return 0;
-
-    IDXGIResource*          res  = NULL;
-    DXGI_OUTDUPL_FRAME_INFO info = {0};
-
-    HRESULT hr = g_cap.duplication->lpVtbl->AcquireNextFrame(
-        g_cap.duplication, 33, &info, &res);
-
-    if (hr == DXGI_ERROR_WAIT_TIMEOUT) return 0;
-
-    if (hr == DXGI_ERROR_ACCESS_LOST) {
-        log_error("Desktop duplication access lost, recreating...");
-        create_duplication();
-        return 0;
-    }
-
-    if (FAILED(hr)) {
-        log_error("AcquireNextFrame failed: 0x%08X", hr);
-        return 0;
-    }
-
-    if (info.LastPresentTime.QuadPart == 0) {
-        res->lpVtbl->Release(res);
-        g_cap.duplication->lpVtbl->ReleaseFrame(g_cap.duplication);
-        return 0;
-    }
-
-    ID3D11Texture2D* tex = NULL;
-    hr = res->lpVtbl->QueryInterface(res, &IID_ID3D11Texture2D, (void**)&tex);
-    if (FAILED(hr) || !tex) {
-        res->lpVtbl->Release(res);
-        g_cap.duplication->lpVtbl->ReleaseFrame(g_cap.duplication);
-        return 0;
+// Encoder thread. --adaptive owns these settings when it is on.
+static void apply_encoder_control(const CastrOptions* opts) {
+    ControlEncoder req;
+    if (!opts->control || !control_take_encoder(&req)) return;
+    if (opts->adaptive) {
+        log_warn("Control: encoder settings are managed by --adaptive, ignored");
+        return;
     }
-
-    D3D11_TEXTURE2D_DESC acquired_desc;
-    tex->lpVtbl->GetDesc(tex, &acquired_desc);
-
-    if (!g_cap.staging_tex ||
-        g_cap.tex_width  != acquired_desc.Width ||
-        g_cap.tex_height != acquired_desc.Height)
-    {
-        if (g_cap.staging_tex) {
-            g_cap.staging_tex->lpVtbl->Release(g_cap.staging_tex);
-            g_cap.staging_tex = NULL;
-        }
-        D3D11_TEXTURE2D_DESC desc  = {0};
-        desc.Width                 = acquired_desc.Width;
-        desc.Height                = acquired_desc.Height;
-        desc.MipLevels             = 1;
-        desc.ArraySize             = 1;
-        desc.Format                = acquired_desc.Format;
-        desc.SampleDesc.Count      = 1;
-        desc.Usage                 = D3D11_USAGE_STAGING;
-        desc.BindFlags             = 0;
-        desc.CPUAccessFlags        = D3D11_CPU_ACCESS_READ;
-        desc.MiscFlags             = 0;
-        hr = g_cap.device->lpVtbl->CreateTexture2D(
-            g_cap.device, &desc, NULL, &g_cap.staging_tex);
-        if (FAILED(hr)) {
-            log_error("CreateTexture2D (staging) failed: 0x%08X", hr);
-            tex->lpVtbl->Release(tex);
-            res->lpVtbl->Release(res);
-            g_cap.duplication->lpVtbl->ReleaseFrame(g_cap.duplication);
-            return 0;
-        }
-        g_cap.tex_width  = acquired_desc.Width;
-        g_cap.tex_height = acquired_desc.Height;
-    }
-
-    g_cap.context->lpVtbl->CopyResource(
-        g_cap.context,
-        (ID3D11Resource*)g_cap.staging_tex,
-        (ID3D11Resource*)tex);
-
-    tex->lpVtbl->Release(tex);
-    res->lpVtbl->Release(res);
-    g_cap.duplication->lpVtbl->ReleaseFrame(g_cap.duplication);
-
-    D3D11_MAPPED_SUBRESOURCE mapped = {0};
-    hr = g_cap.context->lpVtbl->Map(
-        g_cap.context, (ID3D11Resource*)g_cap.staging_tex,
-        0, D3D11_MAP_READ, 0, &mapped);
-    if (FAILED(hr)) {
-        log_error("Map failed: 0x%08X", hr);
-        return 0;
-    }
-
-    const unsigned char* src   = (const unsigned char*)mapped.pData;
-    unsigned char*       dst   = out_data;
-    int copy_h = (int)g_cap.tex_height < height ? (int)g_cap.tex_height : height;
-    int copy_w = (int)g_cap.tex_width  < width  ? (int)g_cap.tex_width  : width;
-
-    for (int row = 0; row < copy_h; row++) {
-        memcpy(dst, src, (size_t)copy_w * 4);
-        src += mapped.RowPitch;
-        dst += (size_t)width * 4;
-    }
-
-    g_cap.context->lpVtbl->Unmap(
-        g_cap.context, (ID3D11Resource*)g_cap.staging_tex, 0);
-
-    return 1;
+    if (req.out_w && !encoder_set_output_size(req.out_w, req.out_h))
+        log_warn("Control: could not change the output size to %dx%d", req.out_w, req.out_h);
+    if (req.bitrate_kbps && !encoder_set_bitrate(req.bitrate_kbps))
+        log_warn("Control: bitrate changes need --bitrate");
+    if (req.crf >= 0 && (opts->bitrate_kbps > 0 || !encoder_set_crf(req.crf)))
+        log_warn("Control: CRF changes need CRF mode");
 }
 
-static void init_shared_state(int w, int h) {
-    g_state.width         = w;
-    g_state.height        = h;
-    g_state.running       = true;
-
-    g_state.frame_buffer  = malloc((size_t)w * h * 4);
-    // g_state.encode_buffer = malloc((size_t)w * h * 4);
-
-    // if (!g_state.frame_buffer || !g_state.encode_buffer) {
-    //     log_error("Failed to allocate shared buffers");
-    //     exit(1);
-    // }
-
-    memset(g_state.frame_buffer,  0, (size_t)w * h * 4);
-    // memset(g_state.encode_buffer, 0, (size_t)w * h * 4);
-
-    InitializeCriticalSection(&g_state.lock);
-    InitializeConditionVariable(&g_state.data_ready);
+// Encoder thread. `snapshot PATH` takes the next frame, between intervals.
+static void apply_snapshot_control(const CastrOptions* opts) {
+    char path[224];
+    if (opts->control && control_take_snapshot(path, sizeof(path)))
+        snapshot_request(path);
 }
 
-static unsigned __stdcall capture_thread_func(void* arg) {
-    (void)arg;
-
-    if (!create_duplication()) {
-        log_error("capture_thread: failed to create duplication");
-        return 1;
-    }
-
-    unsigned char* temp_buf =
-        malloc((size_t)g_state.width * g_state.height * 4);
-    if (!temp_buf) return 1;
-
-    while (g_state.running) {
-        if (capture_frame(temp_buf, g_state.width, g_state.height)) {
-            EnterCriticalSection(&g_state.lock);
-            memcpy(g_state.frame_buffer, temp_buf,
-                   (size_t)g_state.width * g_state.height * 4);
-            g_state.has_new_frame = true;
-            LeaveCriticalSection(&g_state.lock);
-            WakeAllConditionVariable(&g_state.data_ready);
-        }
-    }
-
-    free(temp_buf);
-    return 0;
+// Encoder thread. The canvas or capture changed size; the encoder scales
+// the new size to its output and the shared-memory ring is recreated.
+static void follow_input_size(int w, int h) {
+    if (!encoder_set_input_size(w, h))
+        log_error("Encoder cannot take %dx%d frames", w, h);
+    shm_export_resize(w, h);
 }
 
-static unsigned __stdcall encoder_thread_func(void* arg) {
-    (void)arg;
-    unsigned char* local_buf =
-        malloc((size_t)g_state.width * g_state.height * 4);
-    if (!local_buf) return 1;
-
-    while (1) {
-        EnterCriticalSection(&g_state.lock);
-        while (g_state.running && !g_state.encoder_has_work)
-            SleepConditionVariableCS(
-                &g_state.data_ready, &g_state.lock, INFINITE);
-        if (!g_state.running) {
-            LeaveCriticalSection(&g_state.lock);
-            break;
+static void encoder_thread_func(void* arg) {
+    const CastrOptions* opts = arg;
+    tune_thread(opts, CASTR_THREAD_ENCODER);
+    const unsigned char* data;
+    int slot, stride, w, h;
+    long long timestamp;
+
+    while ((data = readback_wait(&g_readback, &slot, &stride, &timestamp)) != NULL) {
+        readback_frame_size(&g_readback, slot, &w, &h);
+        follow_input_size(w, h);
+        apply_encoder_control(opts);
+        apply_snapshot_control(opts);
+
+        shm_export_publish(data, stride, timestamp);
+        snapshot_offer(data, stride, w, h, timestamp);
+        if (quality_keep_frame()) {
+            long long start = time_now_us();
+            encode_frame(data, stride, timestamp);
+            note_first_frame();
+            quality_frame_encoded(time_now_us() - start, readback_queued(&g_readback));
         }
-        // memcpy(local_buf, g_state.encode_buffer,
-               // (size_t)g_state.width * g_state.height * 4);
-        g_state.encoder_has_work = false;
-        LeaveCriticalSection(&g_state.lock);
-        encode_frame(local_buf);
+        readback_release(&g_readback, slot);
     }
-
-    free(local_buf);
-    return 0;
 }
 
 static void init_compositor(int w, int h) {
@@ -307,125 +166,314 @@ static void init_compositor(int w, int h) {
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-GLuint pbos[2];
-int pbo_index = 0;
+static volatile sig_atomic_t g_quit = 0;
 
-void init_pbos(int w, int h) {
-    int data_size = w * h * 4;
-    glGenBuffers(2, pbos);
+static void on_signal(int sig) {
+    (void)sig;
+    g_quit = 1;
+}
 
-    for (size_t i = 0; i < 2; ++i)
-    {
-        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
-        glBufferData(GL_PIXEL_PACK_BUFFER, data_size, NULL, GL_STREAM_READ);
+static bool should_stop(const CastrOptions* opts, long long start_us) {
+    if (g_quit) return true;
+    return opts->duration > 0 &&
+           time_now_us() - start_us >= (long long)(opts->duration * 1000000.0);
+}
+
+// Fixed cadence for compositing/encoding; skips ticks instead of bursting
+// when the loop falls behind.
+static bool frame_due(long long* next_us, long long interval_us) {
+    long long now = time_now_us();
+    if (now < *next_us) return false;
+    *next_us += interval_us;
+    if (*next_us <= now) {
+        quality_note_drops((now - *next_us) / interval_us + 1);
+        *next_us = now + interval_us;
     }
-    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return true;
 }
 
-static void flip_bgra_vertical(unsigned char* buf, int width, int height) {
-    size_t         row_bytes = (size_t)width * 4;
-    unsigned char* tmp       = malloc(row_bytes);
-    if (!tmp) return;
-    for (int top = 0, bot = height - 1; top < bot; top++, bot--) {
-        memcpy(tmp,                   buf + top * row_bytes, row_bytes);
-        memcpy(buf + top * row_bytes, buf + bot * row_bytes, row_bytes);
-        memcpy(buf + bot * row_bytes, tmp,                   row_bytes);
+#define STATS_INTERVAL_US 10000000LL
+
+static void log_pipeline_stats(long long* next_us) {
+    long long now = time_now_us();
+    if (now < *next_us) return;
+    *next_us = now + STATS_INTERVAL_US;
+    jobs_log_stats();
+    for (int i = 0; i < g_source_count; i++)
+        capture_worker_log_stats(&g_workers[i]);
+    snapshot_log_stats();
+}
+
+// The worker's front buffer is encoded in place; without a new capture the
+// previous frame is repeated.
+static void run_direct(const CastrOptions* opts) {
+    const long long interval = 1000000 / opts->fps;
+    long long start = time_now_us(), next = start;
+    long long next_stats = start + STATS_INTERVAL_US;
+    const FrameBuffer* frame = capture_worker_current(&g_workers[0]);
+    int encoded_w = frame->width, encoded_h = frame->height;
+
+    while (!should_stop(opts, start)) {
+        log_pipeline_stats(&next_stats);
+        if (!frame_due(&next, interval)) {
+            time_sleep_ms(1);
+            continue;
+        }
+
+        int w, h;
+        if (opts->control && control_take_canvas(&w, &h))
+            log_warn("Control: without the compositor the canvas is the capture; use source");
+        apply_source_control(opts);
+
+        const FrameBuffer* fresh = capture_worker_take(&g_workers[0], NULL);
+        if (fresh) frame = fresh;
+        if (frame->width != encoded_w || frame->height != encoded_h) {
+            encoded_w = frame->width;
+            encoded_h = frame->height;
+            follow_input_size(encoded_w, encoded_h);
+        }
+        apply_encoder_control(opts);
+        apply_snapshot_control(opts);
+
+        long long now = time_now_us();
+        shm_export_publish(frame->data, frame->stride, now);
+        snapshot_offer(frame->data, frame->stride, frame->width, frame->height, now);
+        if (quality_keep_frame()) {
+            long long start = time_now_us();
+            encode_frame(frame->data, frame->stride, now);
+            note_first_frame();
+            quality_frame_encoded(time_now_us() - start, 0);
+        }
     }
-    free(tmp);
 }
 
-int main(void) {
-    if (!glfwInit()) return -1;
+// Downscaled copy of the canvas that the preview samples, no larger than
+// the window. Reallocated when the window size changes.
+static GLuint g_preview_fbo, g_preview_tex;
+static int    g_preview_w, g_preview_h;
 
-    const int screen_w = 1920, screen_h = 1080;
-    const int window_w = 1280, window_h = 720;
+// Set by the GLFW callbacks during glfwPollEvents. Button changes skip the
+// preview rate cap so that a short click still reaches the UI.
+static bool g_preview_stale = true, g_preview_urgent;
 
-    GLFWwindow* window = glfwCreateWindow(
-        window_w, window_h, "Castr Engine", NULL, NULL);
-    if (!window) { glfwTerminate(); return -1; }
+static void on_cursor_pos(GLFWwindow* window, double x, double y) {
+    (void)window; (void)x; (void)y;
+    g_preview_stale = true;
+}
 
-    glfwMakeContextCurrent(window);
-    glfwSwapInterval(0);
-    gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+static void on_mouse_button(GLFWwindow* window, int button, int action, int mods) {
+    (void)window; (void)button; (void)action; (void)mods;
+    g_preview_urgent = true;
+}
 
-    log_info("GL version: %s", glGetString(GL_VERSION));
+static void on_window_refresh(GLFWwindow* window) {
+    (void)window;
+    g_preview_stale = true;
+}
 
-    Font main_font;
-    font_init(&main_font, "C:/Windows/Fonts/Arial.ttf", 32.0f);
+static bool preview_resize(int window_w, int window_h, int canvas_w, int canvas_h) {
+    const int w = window_w < canvas_w ? window_w : canvas_w;
+    const int h = window_h < canvas_h ? window_h : canvas_h;
+    if (w == g_preview_w && h == g_preview_h) return false;
+
+    if (!g_preview_fbo) {
+        glGenFramebuffers(1, &g_preview_fbo);
+        glGenTextures(1, &g_preview_tex);
+        glBindTexture(GL_TEXTURE_2D, g_preview_tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    glBindTexture(GL_TEXTURE_2D, g_preview_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
 
-    if (!init_capture()) {
-        log_error("Capture init failed");
-        glfwTerminate();
-        return -1;
+    glBindFramebuffer(GL_FRAMEBUFFER, g_preview_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, g_preview_tex, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        log_error("Preview framebuffer incomplete");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    g_preview_w = w;
+    g_preview_h = h;
+    return true;
+}
+
+// The preview and everything interactive. Nothing drawn here reaches g_fbo,
+// so the control panel and the hover outline stay out of the recording.
+static void draw_preview(GLFWwindow* window, Font* font, int canvas_w, int canvas_h,
+                         bool canvas_changed) {
+    int fb_w, fb_h, win_w, win_h;
+    glfwGetFramebufferSize(window, &fb_w, &fb_h);
+    glfwGetWindowSize(window, &win_w, &win_h);
+    if (fb_w <= 0 || fb_h <= 0 || win_w <= 0 || win_h <= 0) return; // minimised
+
+    if (preview_resize(fb_w, fb_h, canvas_w, canvas_h) || canvas_changed) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, g_fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, g_preview_fbo);
+        glBlitFramebuffer(0, 0, canvas_w, canvas_h, 0, 0, g_preview_w, g_preview_h,
+                          GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
-    init_encoder("recording.mkv", screen_w, screen_h);
-    init_shared_state(screen_w, screen_h);
-    init_compositor(screen_w, screen_h);
-    init_pbos(screen_w, screen_h);
+    // The canvas is stretched over the window; the cursor is in window
+    // coordinates, sources are placed in canvas coordinates.
+    ui_begin_frame(window);
+    const float to_canvas_x = (float)canvas_w / win_w;
+    const float to_canvas_y = (float)canvas_h / win_h;
+    const float mouse_x  = (float)ui.mouse_x * to_canvas_x;
+    const float mouse_y  = (float)ui.mouse_y * to_canvas_y;
+
+    // The topmost (last drawn) source under the cursor.
+    int hovered = -1;
+    for (int i = g_source_count - 1; i >= 0 && hovered < 0; i--) {
+        const RenderSource* src = &g_layout[i];
+        if (mouse_x >= src->x && mouse_x <= src->x + src->width * src->scale &&
+            mouse_y >= src->y && mouse_y <= src->y + src->height * src->scale)
+            hovered = i;
+    }
 
-    unsigned cap_tid, enc_tid;
-    g_capture_thread = (HANDLE)_beginthreadex(
-        NULL, 0, capture_thread_func, NULL, 0, &cap_tid);
-    g_encoder_thread = (HANDLE)_beginthreadex(
-        NULL, 0, encoder_thread_func, NULL, 0, &enc_tid);
+    if (ui.mouse_down) {
+        if (ui.dragging_item == 0 && ui.mouse_clicked) {
+            if (hovered >= 0) {
+                ui.dragging_item = hovered + 1;
+                g_selected = hovered;
+            }
+        }
+        if (ui.dragging_item > 0) {
+            RenderSource* src = &g_layout[ui.dragging_item - 1];
+            src->x += (float)(ui.mouse_x - ui.last_mouse_x) * to_canvas_x;
+            src->y += (float)(ui.mouse_y - ui.last_mouse_y) * to_canvas_y;
+        }
+    } else {
+        ui.dragging_item = 0;
+    }
 
-    GLuint desktop_tex;
-    glGenTextures(1, &desktop_tex);
-    glBindTexture(GL_TEXTURE_2D, desktop_tex);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, screen_w, screen_h,
-                 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+    glViewport(0, 0, fb_w, fb_h);
+    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(0, canvas_w, canvas_h, 0, -1, 1);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, g_preview_tex);
+    glColor3f(1.0f, 1.0f, 1.0f);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0, 1); glVertex2f(0, 0);
+    glTexCoord2f(1, 1); glVertex2f((float)canvas_w, 0);
+    glTexCoord2f(1, 0); glVertex2f((float)canvas_w, (float)canvas_h);
+    glTexCoord2f(0, 0); glVertex2f(0, (float)canvas_h);
+    glEnd();
+
+    const int outlined = ui.dragging_item > 0 ? ui.dragging_item - 1 : hovered;
+    if (outlined >= 0) {
+        const RenderSource* src = &g_layout[outlined];
+        const float render_w = src->width * src->scale;
+        const float render_h = src->height * src->scale;
+        glDisable(GL_TEXTURE_2D);
+        glColor3f(0.0f, 1.0f, 0.0f);
+        glLineWidth(2.0f);
+        glBegin(GL_LINE_LOOP);
+        glVertex2f(src->x, src->y);
+        glVertex2f(src->x + render_w, src->y);
+        glVertex2f(src->x + render_w, src->y + render_h);
+        glVertex2f(src->x, src->y + render_h);
+        glEnd();
+        glLineWidth(1.0f);
+        glEnable(GL_TEXTURE_2D);
+    }
+
+    // Control panel, in window coordinates like the cursor.
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(0, win_w, win_h, 0, -1, 1);
+    glMatrixMode(GL_MODELVIEW);
+
+    ui_draw_rect(10, 10, 240, 150, (UIColor) { 0.0f, 0.0f, 0.0f });
+    ui_slider(10, &g_layout[g_selected].scale, 0.1f, 1.0f, 20, 40, 200);
+    if (ui_button(1, font, "Reset Pos", 20, 80, 200, 40)) {
+        g_layout[g_selected].x = 0;
+        g_layout[g_selected].y = 0;
+    }
+
+    glfwSwapBuffers(window);
+    ui_end_frame();
+}
+
+// Compositor thread. Frames already submitted keep their size and drain
+// as usual; the encoder rescales the new size to its output.
+static void resize_canvas(int w, int h) {
+    glBindTexture(GL_TEXTURE_2D, g_canvas_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
     glBindTexture(GL_TEXTURE_2D, 0);
+    readback_resize(&g_readback, w, h);
+    g_preview_stale = true;
+    log_info("Canvas resized to %dx%d", w, h);
+}
 
-    const size_t   frame_bytes = (size_t)screen_w * screen_h * 4;
-    unsigned char* upload_buf  = malloc(frame_bytes);
-    unsigned char* encoder_buf = malloc(frame_bytes);
-    if (!upload_buf || !encoder_buf) {
-        log_error("Failed to allocate upload/encoder buffers");
-        return -1;
+static void run_compositor(GLFWwindow* window, const CastrOptions* opts, Font* font,
+                           int screen_w, int screen_h) {
+    GLuint source_tex[CASTR_MAX_SOURCES];
+    glGenTextures(g_source_count, source_tex);
+    for (int i = 0; i < g_source_count; i++) {
+        glBindTexture(GL_TEXTURE_2D, source_tex[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, (int)g_layout[i].width, (int)g_layout[i].height,
+                     0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
     }
+    glBindTexture(GL_TEXTURE_2D, 0);
 
+    const long long interval = 1000000 / opts->fps;
+    long long start = time_now_us(), next = start;
+    long long next_stats = start + STATS_INTERVAL_US;
 
-    float render_w = desktop_source.width - desktop_source.scale;
-    float render_h = desktop_source.height - desktop_source.scale;
-    while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
-        ui_begin_frame(window);
+    // The preview follows new canvas frames and input, no faster than
+    // --preview-fps; an idle window costs nothing.
+    const long long preview_interval = 1000000 / opts->preview_fps;
+    long long next_preview = start;
+    bool canvas_changed = false;
 
-        float render_w = desktop_source.width * desktop_source.scale;
-        float render_h = desktop_source.height * desktop_source.scale;
+    while (!glfwWindowShouldClose(window) && !should_stop(opts, start)) {
+        glfwPollEvents();
+        log_pipeline_stats(&next_stats);
 
-        bool is_hovering_desktop = (ui.mouse_x >= desktop_source.x &&
-            ui.mouse_x <= desktop_source.x + render_w &&
-            ui.mouse_y >= desktop_source.y &&
-            ui.mouse_y <= desktop_source.y + render_h);
+        readback_poll(&g_readback);
 
-        if (ui.mouse_down) {
-            if (ui.dragging_item == 0 && ui.mouse_clicked) {
-                if (is_hovering_desktop) {
-                    ui.dragging_item = 1;
+        int w, h;
+        if (opts->control && control_take_canvas(&w, &h)) {
+            screen_w = w;
+            screen_h = h;
+            resize_canvas(w, h);
+        }
+        apply_source_control(opts);
+
+        bool composite = frame_due(&next, interval);
+        if (composite) {
+            // Whatever each worker has ready; a source without a new frame
+            // keeps its last one on the canvas.
+            for (int i = 0; i < g_source_count; i++) {
+                const FrameBuffer* frame = capture_worker_take(&g_workers[i], NULL);
+                if (!frame) continue;
+
+                RenderSource* src = &g_layout[i];
+                glBindTexture(GL_TEXTURE_2D, source_tex[i]);
+                if (frame->width != (int)src->width || frame->height != (int)src->height) {
+                    // The source keeps its place and scale on the canvas.
+                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, frame->width, frame->height,
+                                 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+                    src->width  = (float)frame->width;
+                    src->height = (float)frame->height;
                 }
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, frame->stride / 4);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, frame->width, frame->height,
+                                GL_BGRA, GL_UNSIGNED_BYTE, frame->data);
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
             }
-            if (ui.dragging_item == 1) {
-                desktop_source.x += (float)(ui.mouse_x - ui.last_mouse_x);
-                desktop_source.y += (float)(ui.mouse_y - ui.last_mouse_y);
-            }
-        }
-
-        bool has_frame = false;
-        EnterCriticalSection(&g_state.lock);
-        if (g_state.has_new_frame) {
-            memcpy(upload_buf, g_state.frame_buffer, frame_bytes);
-            g_state.has_new_frame = false;
-            has_frame = true;
-        }
-        LeaveCriticalSection(&g_state.lock);
-
-        if (has_frame) {
-            glBindTexture(GL_TEXTURE_2D, desktop_tex);
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, screen_w, screen_h, GL_BGRA, GL_UNSIGNED_BYTE, upload_buf);
 
             glBindFramebuffer(GL_FRAMEBUFFER, g_fbo);
             glViewport(0, 0, screen_w, screen_h);
@@ -439,112 +487,449 @@ int main(void) {
             glLoadIdentity();
 
             glEnable(GL_TEXTURE_2D);
-            glBindTexture(GL_TEXTURE_2D, desktop_tex);
-            glPushMatrix();
-            glTranslatef(desktop_source.x, desktop_source.y, 0);
-            glScalef(desktop_source.scale, desktop_source.scale, 1.0f);
-            glBegin(GL_QUADS);
-            glTexCoord2f(0, 0); glVertex2f(0, 0);
-            glTexCoord2f(1, 0); glVertex2f(desktop_source.width, 0);
-            glTexCoord2f(1, 1); glVertex2f(desktop_source.width, desktop_source.height);
-            glTexCoord2f(0, 1); glVertex2f(0, desktop_source.height);
-            glEnd();
-            glPopMatrix();
-
-            if (ui.dragging_item == 1 || is_hovering_desktop) {
-                glDisable(GL_TEXTURE_2D);
-                glColor3f(0.0f, 1.0f, 0.0f);
-                glLineWidth(2.0f);
-                glBegin(GL_LINE_LOOP);
-                glVertex2f(desktop_source.x, desktop_source.y);
-                glVertex2f(desktop_source.x + render_w, desktop_source.y);
-                glVertex2f(desktop_source.x + render_w, desktop_source.y + render_h);
-                glVertex2f(desktop_source.x, desktop_source.y + render_h);
+            glColor3f(1.0f, 1.0f, 1.0f);
+            for (int i = 0; i < g_source_count; i++) {
+                const RenderSource* src = &g_layout[i];
+                glBindTexture(GL_TEXTURE_2D, source_tex[i]);
+                glPushMatrix();
+                glTranslatef(src->x, src->y, 0);
+                glScalef(src->scale, src->scale, 1.0f);
+                glBegin(GL_QUADS);
+                glTexCoord2f(0, 0); glVertex2f(0, 0);
+                glTexCoord2f(1, 0); glVertex2f(src->width, 0);
+                glTexCoord2f(1, 1); glVertex2f(src->width, src->height);
+                glTexCoord2f(0, 1); glVertex2f(0, src->height);
                 glEnd();
-                glLineWidth(1.0f);
-                glEnable(GL_TEXTURE_2D);
+                glPopMatrix();
             }
 
-            ui_draw_rect(10, 10, 240, 150, (UIColor) { 0.0f, 0.0f, 0.0f });
-            ui_slider(10, &desktop_source.scale, 0.1f, 1.0f, 20, 40, 200);
-            if (ui_button(1, &main_font, "Reset Pos", 20, 80, 200, 40)) {
-                desktop_source.x = 0;
-                desktop_source.y = 0;
+            if (!readback_submit(&g_readback))
+                quality_note_drops(1);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            canvas_changed = true;
+        }
+
+        if (!opts->headless && (canvas_changed || g_preview_stale || g_preview_urgent)) {
+            long long now = time_now_us();
+            if (g_preview_urgent || now >= next_preview) {
+                draw_preview(window, font, screen_w, screen_h, canvas_changed);
+                canvas_changed   = false;
+                g_preview_stale  = false;
+                g_preview_urgent = false;
+                next_preview     = now + preview_interval;
             }
+        }
 
-            pbo_index = (pbo_index + 1) % 2;
-            int next_index = (pbo_index + 1) % 2;
+        if (!composite) time_sleep_ms(1);
+    }
 
-            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[pbo_index]);
-            glReadPixels(0, 0, screen_w, screen_h, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+    glDeleteTextures(g_source_count, source_tex);
+}
 
-            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[next_index]);
-            void* ptr = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
-            if (ptr) {
-                memcpy(encoder_buf, ptr, frame_bytes);
-                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
-            }
-            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+// Startup work that does not touch the GL context runs on its own thread
+// while the window and context are created; each task logs its duration.
+typedef struct {
+    const char* name;
+    int       (*fn)(void* arg);
+    void*       arg;
+    Thread      thread;
+    bool        started, threaded;
+    int         ok;
+    long long   elapsed_us;
+} StartupTask;
+
+static void startup_task_func(void* arg) {
+    StartupTask* task = arg;
+    long long start = time_now_us();
+    task->ok = task->fn(task->arg);
+    task->elapsed_us = time_now_us() - start;
+}
+
+static void startup_begin(StartupTask* task, const char* name, int (*fn)(void*), void* arg) {
+    task->name    = name;
+    task->fn      = fn;
+    task->arg     = arg;
+    task->started = true;
+    task->threaded = thread_create(&task->thread, startup_task_func, task);
+    if (!task->threaded)
+        startup_task_func(task);
+}
+
+static int startup_wait(StartupTask* task) {
+    if (task->threaded) {
+        thread_join(task->thread);
+        task->threaded = false;
+    }
+    log_info("Startup: %s %.1f ms", task->name, task->elapsed_us / 1000.0);
+    return task->ok;
+}
+
+typedef struct {
+    const char*   names[CASTR_MAX_SOURCES];
+    CaptureConfig configs[CASTR_MAX_SOURCES];
+    atomic_i32    failed;
+} SourceOpen;
+
+static void open_source(void* ctx, int index) {
+    SourceOpen* open = ctx;
+    CaptureSource* src = capture_open(open->names[index], &open->configs[index]);
+    if (!src) {
+        log_error("Capture init failed for source %d", index);
+        atomic_store_i32(&open->failed, 1);
+        return;
+    }
+    if (!capture_worker_init(&g_workers[index], src, index)) {
+        capture_close(src);
+        g_workers[index].source = NULL;
+        atomic_store_i32(&open->failed, 1);
+    }
+}
+
+// Opens every capture source, side by side on the job pool, and pre-faults
+// each worker's frame buffers.
+static int open_capture(void* arg) {
+    const CastrOptions* opts = arg;
+    SourceOpen open = {0};
+    open.names[0]   = opts->source;
+    open.configs[0] = (CaptureConfig){
+        .output = opts->monitor,
+        .region = { opts->region_x, opts->region_y, opts->region_w, opts->region_h },
+        .window = opts->window,
+        .fps    = opts->fps,
+    };
+    // The synthetic source has no output to clip to; --size is its size.
+    if (!strcmp(opts->source, "test") && !opts->region_w) {
+        open.configs[0].region.width  = opts->width;
+        open.configs[0].region.height = opts->height;
+    }
+    for (int i = 0; i < opts->extra_source_count; i++) {
+        const CastrSourceSpec* spec = &opts->extra_sources[i];
+        open.names[i + 1]   = spec->name;
+        open.configs[i + 1] = (CaptureConfig){
+            .output = spec->monitor,
+            .region = { 0, 0, spec->width, spec->height },
+            .window = spec->window[0] ? spec->window : NULL,
+            .fps    = spec->fps > 0 ? spec->fps : opts->fps,
+        };
+    }
+
+    const int count = 1 + opts->extra_source_count;
+    jobs_parallel_for(count, open_source, &open);
+    if (atomic_load_i32(&open.failed)) {
+        for (int i = 0; i < count; i++)
+            if (g_workers[i].source) capture_worker_destroy(&g_workers[i]);
+        return 0;
+    }
+    g_source_count = count;
+    return 1;
+}
+
+static FontAtlas g_font_atlas;
 
-            flip_bgra_vertical(encoder_buf, screen_w, screen_h);
+static int bake_font(void* arg) {
+    const CastrOptions* opts = arg;
+    return font_bake(&g_font_atlas, opts->font_path, 32.0f);
+}
 
-            EnterCriticalSection(&g_state.lock);
-            g_state.encoder_has_work = true;
-            WakeAllConditionVariable(&g_state.data_ready);
-            LeaveCriticalSection(&g_state.lock);
+typedef struct {
+    const CastrOptions* opts;
+    int                 width, height; // canvas
+    AudioSource*        audio;         // opened here, started once the encoder is up
+} EncoderStartup;
+
+// Opens the audio source, whose format the encoder needs, then the encoder
+// and its output file.
+static int open_encoder(void* arg) {
+    EncoderStartup* start = arg;
+    const CastrOptions* opts = start->opts;
+
+    if (opts->audio) {
+        start->audio = audio_source_open(opts->audio);
+        if (!start->audio) {
+            log_error("Audio source init failed");
+            return 0;
         }
+    }
 
-        glViewport(0, 0, window_w, window_h);
-        glClear(GL_COLOR_BUFFER_BIT);
+    EncoderConfig enc_cfg = {
+        .filename     = opts->output,
+        .width        = start->width,
+        .height       = start->height,
+        .out_width    = opts->out_width,
+        .out_height   = opts->out_height,
+        .scaler       = opts->scaler,
+        .fps          = opts->fps,
+        .codec        = opts->codec,
+        .preset       = opts->preset,
+        .crf          = opts->crf,
+        .bitrate_kbps = opts->bitrate_kbps,
+        .gop          = opts->gop,
+        .adaptive     = opts->adaptive,
+        .reconfigurable = opts->control,
+        .roi_qp       = opts->roi_qp,
+        .intermediate = opts->intermediate,
+        .rotate_sec   = opts->rotate_sec,
+        .rotate_bytes = (long long)opts->rotate_mb * 1024 * 1024,
+    };
+    if (start->audio) {
+        // PCM keeps the intermediate cheap; transcode encodes it properly.
+        enc_cfg.audio_codec        = opts->intermediate ? "pcm_s16le" : opts->audio_codec;
+        enc_cfg.audio_sample_rate  = start->audio->sample_rate;
+        enc_cfg.audio_channels     = start->audio->channels;
+        enc_cfg.audio_bitrate_kbps = opts->audio_bitrate_kbps;
+    }
+    if (!init_encoder(&enc_cfg)) {
+        log_error("Encoder init failed");
+        audio_source_close(start->audio);
+        start->audio = NULL;
+        return 0;
+    }
+    return 1;
+}
 
-        glMatrixMode(GL_PROJECTION);
-        glLoadIdentity();
-        glOrtho(-1, 1, -1, 1, -1, 1);
-        glMatrixMode(GL_MODELVIEW);
-        glLoadIdentity();
+int main(int argc, char** argv) {
+    CastrOptions opts;
+    options_defaults(&opts);
+    int parsed = options_parse(&opts, argc, argv);
+    if (parsed <= 0) return parsed < 0 ? 1 : 0;
+
+    signal(SIGINT,  on_signal);
+    signal(SIGTERM, on_signal);
+
+    if (opts.transcode) {
+        jobs_init(opts.jobs);
+        TranscodeConfig t_cfg = {
+            .input              = opts.transcode,
+            .output             = opts.output,
+            .codec              = opts.codec,
+            .preset             = opts.preset,
+            .crf                = opts.crf,
+            .bitrate_kbps       = opts.bitrate_kbps,
+            .gop                = opts.gop,
+            .audio_codec        = opts.audio_codec,
+            .audio_bitrate_kbps = opts.audio_bitrate_kbps,
+            .segment_sec        = opts.segment_sec,
+        };
+        int ok = transcode_run(&t_cfg);
+        jobs_log_stats();
+        jobs_shutdown();
+        return ok ? 0 : 1;
+    }
 
-        glEnable(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, g_canvas_tex);
-        glBegin(GL_QUADS);
-        glTexCoord2f(0, 0); glVertex2f(-1, -1);
-        glTexCoord2f(1, 0); glVertex2f(1, -1);
-        glTexCoord2f(1, 1); glVertex2f(1, 1);
-        glTexCoord2f(0, 1); glVertex2f(-1, 1);
-        glEnd();
+    int screen_w = opts.width, screen_h = opts.height;
+    const int window_w = 1280, window_h = 720;
+    const bool ui = !opts.no_gl && !opts.headless;
+    // Without a compositor the captured frame is the encoded frame. The
+    // probe wants the same through the compositor: source 1:1 at the origin.
+    // Either way the encoder has to wait for the capture size.
+    const bool encoder_follows_capture = opts.no_gl || opts.probe;
+
+    GLFWwindow* window = NULL;
+    Font main_font = {0};
+
+    g_startup_us = time_now_us();
+    jobs_init(opts.jobs);
+
+    // GLFW calls XInitThreads, which has to come before the capture thread
+    // opens its own display connection.
+    if (!opts.no_gl && !glfwInit()) return -1;
+
+    StartupTask capture_task = {0}, font_task = {0}, encoder_task = {0};
+    EncoderStartup enc_start = { .opts = &opts, .width = screen_w, .height = screen_h };
+    startup_begin(&capture_task, "capture", open_capture, &opts);
+    if (ui)
+        startup_begin(&font_task, "font", bake_font, &opts);
+    if (!encoder_follows_capture)
+        startup_begin(&encoder_task, "encoder", open_encoder, &enc_start);
+
+    if (!opts.no_gl) {
+        long long phase = time_now_us();
+        if (opts.headless)
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        window = glfwCreateWindow(
+            window_w, window_h, "Castr Engine", NULL, NULL);
+
+        if (window) {
+            glfwMakeContextCurrent(window);
+            glfwSwapInterval(0);
+            gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+
+            log_info("GL version: %s", glGetString(GL_VERSION));
+            log_info("Startup: window %.1f ms", (time_now_us() - phase) / 1000.0);
+        } else {
+            log_error("Failed to create window");
+        }
+    }
+
+    if (ui && startup_wait(&font_task) && window) {
+        font_upload(&main_font, &g_font_atlas);
+        glfwSetCursorPosCallback(window, on_cursor_pos);
+        glfwSetMouseButtonCallback(window, on_mouse_button);
+        glfwSetWindowRefreshCallback(window, on_window_refresh);
+    }
+    font_atlas_free(&g_font_atlas);
+
+    bool ok = startup_wait(&capture_task) && (window || opts.no_gl);
+    if (ok) {
+        const CaptureSource* first = g_workers[0].source;
+        if (encoder_follows_capture) {
+            screen_w = enc_start.width  = first->width;
+            screen_h = enc_start.height = first->height;
+        }
+        // Added sources start to the right of the previous one.
+        float x = 0;
+        for (int i = 0; i < g_source_count; i++) {
+            g_layout[i] = (RenderSource){
+                .x       = x,
+                .width   = (float)g_workers[i].source->width,
+                .height  = (float)g_workers[i].source->height,
+                .scale   = opts.probe ? 1.0f : 0.5f,
+                .opacity = 1.0f,
+            };
+            x += g_layout[i].width * g_layout[i].scale;
+        }
 
-        glfwSwapBuffers(window);
-        ui_end_frame();
+        if (opts.probe && !probe_begin(first->width, first->height, opts.fps, opts.duration)) {
+            log_error("Probe init failed");
+            ok = false;
+        } else if (encoder_follows_capture) {
+            startup_begin(&encoder_task, "encoder", open_encoder, &enc_start);
+        }
+    }
 
-        if (!has_frame) Sleep(1);
+    // The GL side of the pipeline goes up while the encoder opens.
+    if (ok && window) {
+        long long phase = time_now_us();
+        init_compositor(screen_w, screen_h);
+        if (!readback_init(&g_readback, screen_w, screen_h, opts.readback_depth)) {
+            log_error("Readback init failed");
+            ok = false;
+        }
+        log_info("Startup: compositor %.1f ms", (time_now_us() - phase) / 1000.0);
     }
 
-    EnterCriticalSection(&g_state.lock);
-    g_state.running = false;
-    WakeAllConditionVariable(&g_state.data_ready);
-    LeaveCriticalSection(&g_state.lock);
+    const bool encoder_ok = encoder_task.started && startup_wait(&encoder_task);
+
+    // --affinity capture=N pins the first source; each added one takes the
+    // next CPU. A source without its thread would record a blank frame for
+    // the whole session, so that is a startup error too.
+    const int capture_cpu = opts.thread_cpu[CASTR_THREAD_CAPTURE];
+    for (int i = 0; ok && encoder_ok && i < g_source_count; i++)
+        ok = capture_worker_start(&g_workers[i],
+                                  capture_cpu >= 0 ? (capture_cpu + i) % cpu_count() : -1,
+                                  opts.thread_priority[CASTR_THREAD_CAPTURE]);
+
+    if (!ok || !encoder_ok) {
+        if (encoder_ok) {
+            cleanup_encoder();
+            audio_source_close(enc_start.audio);
+        }
+        for (int i = 0; i < g_source_count; i++)
+            capture_worker_destroy(&g_workers[i]);
+        if (!opts.no_gl) glfwTerminate();
+        return -1;
+    }
+    AudioSource* audio_src = enc_start.audio;
+    if (audio_src)
+        audio_start(audio_src, encoder_clock_origin());
+
+    if (opts.control)
+        control_start();
+
+    if (opts.shm && !shm_export_open(opts.shm, opts.shm_format, screen_w, screen_h))
+        log_warn("Continuing without shared memory export");
+
+    // The copies are sized for the frames snapshot_offer will see: the
+    // canvas, or without a compositor the first capture itself. With only
+    // --control they are allocated on the first request.
+    if (opts.snapshot || opts.control) {
+        SnapshotConfig snap_cfg = {
+            .path         = opts.snapshot,
+            .interval_sec = opts.snapshot_sec,
+            .width        = opts.snapshot_w,
+            .height       = opts.snapshot_h,
+            .jpeg_quality = opts.snapshot_quality,
+        };
+        const FrameBuffer* first = capture_worker_current(&g_workers[0]);
+        const int snap_w = window ? screen_w : first->width;
+        const int snap_h = window ? screen_h : first->height;
+        if (!snapshot_start(&snap_cfg, opts.snapshot ? snap_w : 0, snap_h))
+            log_warn("Continuing without snapshots");
+    }
 
-    HANDLE threads[2] = { g_capture_thread, g_encoder_thread };
-    WaitForMultipleObjects(2, threads, TRUE, 3000);
-    CloseHandle(g_capture_thread);
-    CloseHandle(g_encoder_thread);
+    if (opts.adaptive) {
+        QualityConfig q_cfg = {
+            .preset       = opts.preset,
+            .crf          = opts.crf,
+            .bitrate_kbps = opts.bitrate_kbps,
+            .width        = opts.out_width > 0 ? opts.out_width : screen_w,
+            .height       = opts.out_height > 0 ? opts.out_height : screen_h,
+            .fps          = opts.fps,
+            .queue_limit  = opts.readback_depth / 2,
+        };
+        quality_init(&q_cfg);
+    }
 
-    free(upload_buf);
-    free(encoder_buf);
-    cleanup_encoder();
-    free(g_state.frame_buffer);
-    // free(g_state.encode_buffer);
-    DeleteCriticalSection(&g_state.lock);
-    ui_end_frame();
+    log_info("Startup: ready after %.1f ms", (time_now_us() - g_startup_us) / 1000.0);
+    frame_alloc_log_stats();
+
+    // Without the encoder thread nothing would be recorded, so that is a
+    // startup failure: the session is torn down below without running.
+    Thread encoder_thread;
+    bool   encoder_started = false;
+    int    status          = 0;
+    if (window) {
+        encoder_started = thread_create(&encoder_thread, encoder_thread_func, &opts);
+        if (!encoder_started) {
+            log_error("Failed to start encoder thread");
+            status = -1;
+        }
+    }
+
+    // Without a compositor the main thread is the encoder.
+    if (status == 0) {
+        tune_thread(&opts, window ? CASTR_THREAD_COMPOSITOR : CASTR_THREAD_ENCODER);
+        if (window)
+            run_compositor(window, &opts, &main_font, screen_w, screen_h);
+        else
+            run_direct(&opts);
+    }
 
-    if (g_cap.staging_tex) g_cap.staging_tex->lpVtbl->Release(g_cap.staging_tex);
-    if (g_cap.duplication) g_cap.duplication->lpVtbl->Release(g_cap.duplication);
-    if (g_cap.context)     g_cap.context->lpVtbl->Release(g_cap.context);
-    if (g_cap.device)      g_cap.device->lpVtbl->Release(g_cap.device);
+    if (window) readback_close(&g_readback);
+
+    for (int i = 0; i < g_source_count; i++)
+        capture_worker_stop(&g_workers[i]);
+    if (encoder_started)
+        thread_join(encoder_thread);
+    for (int i = 0; i < g_source_count; i++)
+        capture_worker_destroy(&g_workers[i]);
+
+    if (window) {
+        if (g_readback.dropped)
+            log_warn("Readback dropped %llu frames (encoder behind)", g_readback.dropped);
+        readback_destroy(&g_readback);
+    }
+
+    shm_export_close();
+    snapshot_stop();
+    audio_stop();
+    cleanup_encoder();
+    jobs_log_stats();
+    jobs_shutdown();
+
+    if (window) {
+        glDeleteTextures(1, &g_canvas_tex);
+        glDeleteFramebuffers(1, &g_fbo);
+        if (g_preview_fbo) {
+            glDeleteTextures(1, &g_preview_tex);
+            glDeleteFramebuffers(1, &g_preview_fbo);
+        }
+        glfwTerminate();
+    }
 
-    glDeleteTextures(1, &desktop_tex);
-    glDeleteTextures(1, &g_canvas_tex);
-    glDeleteFramebuffers(1, &g_fbo);
-    glfwTerminate();
+    if (status != 0)
+        return status;
+    if (opts.probe)
+        return probe_analyze(opts.output) ? 0 : 1;
     return 0;
 }
@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "options.h"
+#include "logger.h"
+#include "snapshot.h"
+#include "threading.h"
+
+#ifdef _WIN32
+#define CASTR_DEFAULT_FONT "C:/Windows/Fonts/Arial.ttf"
+#else
+#define CASTR_DEFAULT_FONT "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf"
+#endif
+
+void options_defaults(CastrOptions* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->source         = "desktop";
+    opts->output         = "recording.mkv";
+    opts->font_path      = CASTR_DEFAULT_FONT;
+    opts->width          = 1920;
+    opts->height         = 1080;
+    opts->scaler         = "fast";
+    opts->fps            = 60;
+    opts->preview_fps    = 30;
+    opts->codec          = "libx264";
+    opts->preset         = "veryfast";
+    opts->crf            = 23;
+    opts->gop            = 120;
+    opts->readback_depth = 3;
+    opts->shm_format     = "bgra";
+    opts->snapshot_sec   = 5.0;
+    opts->snapshot_quality = 90;
+    opts->audio_codec    = "aac";
+    opts->audio_bitrate_kbps = 128;
+    for (int i = 0; i < CASTR_THREAD_COUNT; i++) {
+        opts->thread_cpu[i]      = -1;
+        opts->thread_priority[i] = THREAD_PRIO_NORMAL;
+    }
+}
+
+void options_usage(const char* argv0) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "       %s transcode INPUT [-o OUTPUT] [encoder options] [--segment SEC]\n"
+        "  --source NAME         capture source: desktop or test (desktop)\n"
+        "  --monitor N           display output to capture (0)\n"
+        "  --region X,Y,WxH      capture only this part of the output\n"
+        "  --window TITLE        capture the window with this title\n"
+        "  --add-source SPEC     capture another source on its own thread and\n"
+        "                        composite it beside the first: desktop[:N],\n"
+        "                        window:TITLE or test[:WxH], optionally @FPS\n"
+        "                        (repeatable, up to 7)\n"
+        "  --size WxH            canvas and encode size (1920x1080); with\n"
+        "                        --no-gl the capture size is encoded\n"
+        "  --output-size WxH     encoded size if different from the canvas\n"
+        "  --scaler NAME         fast (box/area filters for 1:2 and 2:3) or bicubic\n"
+        "  --fps N               composite and encode rate (60)\n"
+        "  --preview-fps N       most preview redraws per second; the preview only\n"
+        "                        redraws for new frames and input (30)\n"
+        "  --codec NAME          libavcodec encoder (libx264)\n"
+        "  --preset NAME         encoder preset (veryfast)\n"
+        "  --crf N               constant rate factor, ignored with --bitrate (23)\n"
+        "  --bitrate KBPS        target bitrate instead of CRF\n"
+        "  --gop N               keyframe interval in frames (120)\n"
+        "  --readback-depth N    PBOs in the readback ring (3)\n"
+        "  --jobs N              worker threads for per-pixel work (cores - 1)\n"
+        "  --affinity LIST       pin threads to CPUs, e.g. capture=2,encoder=3\n"
+        "                        (threads: capture, compositor, encoder); each\n"
+        "                        added source's capture thread takes the next CPU\n"
+        "  --priority LIST       thread priorities: normal, high or realtime,\n"
+        "                        e.g. capture=realtime,encoder=high\n"
+        "  --adaptive            lower preset, CRF, size or frame rate under load\n"
+        "                        and restore them when it passes\n"
+        "  --roi QP              region-of-interest encoding: lower the quantizer by\n"
+        "                        QP where the canvas changed, raise it elsewhere\n"
+        "                        (0, off; libx264/libx265)\n"
+        "  --intermediate KIND   record raw NV12 or lossless x264 to transcode\n"
+        "                        later: raw or lossless (use a .nut output)\n"
+        "  --segment SEC         transcode segment length (automatic)\n"
+        "  --rotate-time SEC     start a new output file every SEC seconds, at a\n"
+        "                        keyframe: OUTPUT.000.mkv, OUTPUT.001.mkv, ...\n"
+        "  --rotate-size MB      ...or once the current file reaches MB\n"
+        "  --shm NAME            publish composited frames to shared memory for\n"
+        "                        local readers (see castr_shm.h)\n"
+        "  --shm-format FMT      bgra or nv12 (bgra)\n"
+        "  --audio SPEC          audio source: sine[:HZ], wav:PATH, pulse[:DEVICE]\n"
+        "  --audio-codec NAME    audio encoder, e.g. aac or libopus (aac)\n"
+        "  --audio-bitrate KBPS  audio bitrate (128)\n"
+        "  --duration SEC        stop after SEC seconds\n"
+        "  --font PATH           UI font\n"
+        "  -o, --output PATH     output file (recording.mkv)\n"
+        "  --headless            hidden GL context, no preview or UI\n"
+        "  --no-gl               headless without a GL context, encode the\n"
+        "                        captured frame directly\n"
+        "  --snapshot PATH       write a still of the canvas every interval;\n"
+        "                        .qoi, .png or .jpg, a %%d numbers the files\n"
+        "  --snapshot-interval SEC\n"
+        "                        seconds between snapshots (5)\n"
+        "  --snapshot-size WxH   snapshot size (canvas size)\n"
+        "  --snapshot-quality N  JPEG snapshot quality, 1-100 (90)\n"
+        "  --control             read commands from stdin to reconfigure while\n"
+        "                        recording: source WxH, canvas WxH,\n"
+        "                        output-size WxH, bitrate KBPS, crf N,\n"
+        "                        snapshot PATH\n"
+        "  --probe               record the test source and check the output for\n"
+        "                        latency, drops and PSNR; exit status is the result\n"
+        "  -h, --help            show this help\n",
+        argv0, argv0);
+}
+
+static int parse_int(const char* name, const char* s, int min, int* out) {
+    char* end;
+    long v = strtol(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || v < min) {
+        log_error("Invalid value for %s: %s", name, s);
+        return 0;
+    }
+    *out = (int)v;
+    return 1;
+}
+
+// A positive number of seconds, fractions allowed.
+static int parse_seconds(const char* name, const char* s, double* out) {
+    char* end;
+    double v = strtod(s, &end);
+    if (*s == '\0' || *end != '\0' || !(v > 0)) {
+        log_error("Invalid value for %s (expected seconds > 0): %s", name, s);
+        return 0;
+    }
+    *out = v;
+    return 1;
+}
+
+static int parse_size(const char* s, int* w, int* h) {
+    if (sscanf(s, "%dx%d", w, h) != 2 || *w <= 0 || *h <= 0 || (*w & 1) || (*h & 1)) {
+        log_error("Invalid size (expected even WxH): %s", s);
+        return 0;
+    }
+    return 1;
+}
+
+static int parse_region(const char* s, CastrOptions* opts) {
+    if (sscanf(s, "%d,%d,%dx%d", &opts->region_x, &opts->region_y,
+               &opts->region_w, &opts->region_h) != 4 ||
+        opts->region_x < 0 || opts->region_y < 0 ||
+        opts->region_w <= 0 || opts->region_h <= 0) {
+        log_error("Invalid region (expected X,Y,WxH): %s", s);
+        return 0;
+    }
+    return 1;
+}
+
+static int bad_source(const char* s) {
+    log_error("Invalid source (expected desktop[:N], window:TITLE or test[:WxH], "
+              "optionally followed by @FPS): %s", s);
+    return 0;
+}
+
+static int parse_source_spec(const char* s, CastrSourceSpec* spec) {
+    char buf[160];
+    if (strlen(s) >= sizeof(buf)) return bad_source(s);
+    snprintf(buf, sizeof(buf), "%s", s);
+    memset(spec, 0, sizeof(*spec));
+
+    // Window titles may contain '@' themselves; only a trailing number counts.
+    char* at = strrchr(buf, '@');
+    if (at && at[1] && strspn(at + 1, "0123456789") == strlen(at + 1)) {
+        spec->fps = atoi(at + 1);
+        if (spec->fps <= 0) return bad_source(s);
+        *at = '\0';
+    }
+
+    char* arg = strchr(buf, ':');
+    if (arg) *arg++ = '\0';
+    if (!strcmp(buf, "desktop")) {
+        spec->name = "desktop";
+        if (arg && !parse_int("--add-source", arg, 0, &spec->monitor)) return 0;
+    } else if (!strcmp(buf, "window") && arg && *arg) {
+        spec->name = "desktop";
+        snprintf(spec->window, sizeof(spec->window), "%s", arg);
+    } else if (!strcmp(buf, "test")) {
+        spec->name = "test";
+        if (arg && !parse_size(arg, &spec->width, &spec->height)) return 0;
+    } else {
+        return bad_source(s);
+    }
+    return 1;
+}
+
+static const char* const thread_names[CASTR_THREAD_COUNT] = {
+    "capture", "compositor", "encoder",
+};
+
+static const char* const priority_names[] = { "normal", "high", "realtime" };
+
+static int lookup(const char* s, size_t len, const char* const* names, int count) {
+    for (int i = 0; i < count; i++)
+        if (strlen(names[i]) == len && !strncmp(s, names[i], len)) return i;
+    return -1;
+}
+
+// "THREAD=VALUE[,THREAD=VALUE...]", VALUE a CPU index or a priority name.
+static int parse_thread_list(const char* name, const char* s, int* values, bool priority) {
+    while (*s) {
+        const char* eq  = strchr(s, '=');
+        const char* end = strchr(s, ',');
+        if (!end) end = s + strlen(s);
+        int thread = eq && eq < end ? lookup(s, (size_t)(eq - s), thread_names, CASTR_THREAD_COUNT) : -1;
+        if (thread < 0) {
+            log_error("Invalid value for %s: %s", name, s);
+            return 0;
+        }
+
+        const char* val = eq + 1;
+        int v;
+        if (priority) {
+            v = lookup(val, (size_t)(end - val), priority_names, 3);
+        } else {
+            char* num_end;
+            v = (int)strtol(val, &num_end, 10);
+            if (num_end != end || val == end) v = -1;
+        }
+        if (v < 0) {
+            log_error("Invalid value for %s: %.*s", name, (int)(end - s), s);
+            return 0;
+        }
+        values[thread] = v;
+        s = *end ? end + 1 : end;
+    }
+    return 1;
+}
+
+int options_parse(CastrOptions* opts, int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* val = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (i == 1 && !strcmp(arg, "transcode")) {
+            if (!val) {
+                log_error("transcode needs an input file");
+                return -1;
+            }
+            opts->transcode = val;
+            i++;
+            continue;
+        }
+
+        if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+            options_usage(argv[0]);
+            return 0;
+        }
+        if (!strcmp(arg, "--headless")) { opts->headless = true; continue; }
+        if (!strcmp(arg, "--adaptive")) { opts->adaptive = true; continue; }
+        if (!strcmp(arg, "--no-gl"))    { opts->headless = true; opts->no_gl = true; continue; }
+        if (!strcmp(arg, "--probe"))    { opts->probe = true; continue; }
+        if (!strcmp(arg, "--control"))  { opts->control = true; continue; }
+
+        if (!val) {
+            log_error("Missing value for %s", arg);
+            return -1;
+        }
+        i++;
+
+        int ok = 1;
+        if      (!strcmp(arg, "--source"))         opts->source = val;
+        else if (!strcmp(arg, "--monitor"))        ok = parse_int(arg, val, 0, &opts->monitor);
+        else if (!strcmp(arg, "--region"))         ok = parse_region(val, opts);
+        else if (!strcmp(arg, "--window"))         opts->window = val;
+        else if (!strcmp(arg, "--add-source")) {
+            if (opts->extra_source_count == CASTR_MAX_SOURCES - 1) {
+                log_error("At most %d sources", CASTR_MAX_SOURCES);
+                return -1;
+            }
+            ok = parse_source_spec(val, &opts->extra_sources[opts->extra_source_count++]);
+        }
+        else if (!strcmp(arg, "-o") ||
+                 !strcmp(arg, "--output"))         opts->output = val;
+        else if (!strcmp(arg, "--font"))           opts->font_path = val;
+        else if (!strcmp(arg, "--codec"))          opts->codec = val;
+        else if (!strcmp(arg, "--preset"))         opts->preset = val;
+        else if (!strcmp(arg, "--audio"))          opts->audio = val;
+        else if (!strcmp(arg, "--shm"))            opts->shm = val;
+        else if (!strcmp(arg, "--snapshot"))       opts->snapshot = val;
+        else if (!strcmp(arg, "--snapshot-interval")) ok = parse_seconds(arg, val, &opts->snapshot_sec);
+        else if (!strcmp(arg, "--snapshot-size"))  ok = parse_size(val, &opts->snapshot_w, &opts->snapshot_h);
+        else if (!strcmp(arg, "--snapshot-quality")) ok = parse_int(arg, val, 1, &opts->snapshot_quality);
+        else if (!strcmp(arg, "--shm-format"))     opts->shm_format = val;
+        else if (!strcmp(arg, "--audio-codec"))    opts->audio_codec = val;
+        else if (!strcmp(arg, "--audio-bitrate"))  ok = parse_int(arg, val, 1, &opts->audio_bitrate_kbps);
+        else if (!strcmp(arg, "--size"))           ok = parse_size(val, &opts->width, &opts->height);
+        else if (!strcmp(arg, "--output-size"))    ok = parse_size(val, &opts->out_width, &opts->out_height);
+        else if (!strcmp(arg, "--scaler"))         opts->scaler = val;
+        else if (!strcmp(arg, "--fps"))            ok = parse_int(arg, val, 1, &opts->fps);
+        else if (!strcmp(arg, "--preview-fps"))    ok = parse_int(arg, val, 1, &opts->preview_fps);
+        else if (!strcmp(arg, "--crf"))            ok = parse_int(arg, val, 0, &opts->crf);
+        else if (!strcmp(arg, "--bitrate"))        ok = parse_int(arg, val, 1, &opts->bitrate_kbps);
+        else if (!strcmp(arg, "--gop"))            ok = parse_int(arg, val, 1, &opts->gop);
+        else if (!strcmp(arg, "--readback-depth")) ok = parse_int(arg, val, 2, &opts->readback_depth);
+        else if (!strcmp(arg, "--jobs"))           ok = parse_int(arg, val, 0, &opts->jobs);
+        else if (!strcmp(arg, "--affinity"))       ok = parse_thread_list(arg, val, opts->thread_cpu, false);
+        else if (!strcmp(arg, "--priority"))       ok = parse_thread_list(arg, val, opts->thread_priority, true);
+        else if (!strcmp(arg, "--duration"))       ok = parse_seconds(arg, val, &opts->duration);
+        else if (!strcmp(arg, "--roi"))            ok = parse_int(arg, val, 0, &opts->roi_qp);
+        else if (!strcmp(arg, "--intermediate"))   opts->intermediate = val;
+        else if (!strcmp(arg, "--segment"))        ok = parse_seconds(arg, val, &opts->segment_sec);
+        else if (!strcmp(arg, "--rotate-time"))    ok = parse_seconds(arg, val, &opts->rotate_sec);
+        else if (!strcmp(arg, "--rotate-size"))    ok = parse_int(arg, val, 1, &opts->rotate_mb);
+        else {
+            log_error("Unknown option: %s", arg);
+            options_usage(argv[0]);
+            return -1;
+        }
+        if (!ok) return -1;
+    }
+
+    if (strcmp(opts->scaler, "fast") != 0 && strcmp(opts->scaler, "bicubic") != 0) {
+        log_error("Unknown scaler: %s", opts->scaler);
+        return -1;
+    }
+    if (opts->probe) {
+        // The stamp has to reach the encoder untouched: no window, no
+        // desktop, a fixed length.
+        opts->source   = "test";
+        opts->headless = true;
+        if (opts->duration <= 0) opts->duration = 3.0;
+    }
+    if (strcmp(opts->source, "desktop") != 0 && strcmp(opts->source, "test") != 0) {
+        log_error("Unknown source: %s", opts->source);
+        return -1;
+    }
+    if (opts->intermediate && strcmp(opts->intermediate, "raw") != 0 &&
+        strcmp(opts->intermediate, "lossless") != 0) {
+        log_error("Unknown intermediate: %s", opts->intermediate);
+        return -1;
+    }
+    if (strcmp(opts->shm_format, "bgra") != 0 && strcmp(opts->shm_format, "nv12") != 0) {
+        log_error("Unknown shared memory format: %s", opts->shm_format);
+        return -1;
+    }
+    if (opts->roi_qp > 51) {
+        log_error("--roi must be between 0 and 51");
+        return -1;
+    }
+    if (opts->intermediate && opts->roi_qp) {
+        log_error("--roi does not apply to --intermediate recordings");
+        return -1;
+    }
+    if (opts->intermediate && opts->adaptive) {
+        log_error("--adaptive does not apply to --intermediate recordings");
+        return -1;
+    }
+    if (opts->probe && (opts->rotate_sec > 0 || opts->rotate_mb > 0)) {
+        log_error("--probe checks a single output file, drop --rotate-time/--rotate-size");
+        return -1;
+    }
+    if (opts->extra_source_count && (opts->no_gl || opts->probe)) {
+        log_error("--add-source needs the compositor, drop --no-gl/--probe");
+        return -1;
+    }
+    if (opts->snapshot && !snapshot_path_ok(opts->snapshot))
+        return -1;
+    if (opts->snapshot_quality > 100) {
+        log_error("--snapshot-quality must be between 1 and 100");
+        return -1;
+    }
+    if (opts->window && opts->region_w) {
+        log_error("--window and --region are mutually exclusive");
+        return -1;
+    }
+    return 1;
+}
@@ -0,0 +1,266 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+#include "probe.h"
+#include "encoder.h"
+#include "frame_alloc.h"
+#include "test_pattern.h"
+#include "logger.h"
+#include "utils.h"
+
+#define PROBE_MIN_PSNR      30.0 // mean over all frames, in dB
+#define PROBE_MAX_DROP_RATE 0.10
+#define PROBE_TS_MASK       ((1LL << TEST_STAMP_TS_BITS) - 1)
+
+static struct {
+    int        width, height, fps;
+    long long* muxed_us; // indexed by pts tick, 0 if never muxed
+    long long  capacity;
+} g_probe;
+
+static void on_packet(long long pts, long long muxed_us) {
+    if (pts >= 0 && pts < g_probe.capacity)
+        g_probe.muxed_us[pts] = muxed_us;
+}
+
+int probe_begin(int width, int height, int fps, double duration) {
+    g_probe.width    = width;
+    g_probe.height   = height;
+    g_probe.fps      = fps;
+    g_probe.capacity = (long long)((duration > 0 ? duration : 60.0) + 5.0) * fps;
+    g_probe.muxed_us = calloc((size_t)g_probe.capacity, sizeof(long long));
+    if (!g_probe.muxed_us) return 0;
+    encoder_set_packet_hook(on_packet);
+    return 1;
+}
+
+typedef struct {
+    AVFormatContext*   in;
+    AVCodecContext*    dec;
+    int                stream;
+    FrameBuffer        ref_bgra;  // regenerated source frame
+    AVFrame*           ref;       // reference in the decoded size, YUV420P
+    AVFrame*           yuv;       // decoded frame as YUV420P if it isn't already
+    struct SwsContext* ref_sws;
+    struct SwsContext* dec_sws;
+    FILE*              csv;
+
+    long long          frames, unreadable, duplicated, dropped, out_of_order;
+    long long          first_id, last_id;
+    long long*         latency_us;
+    long long          latency_count;
+    double             psnr_sum, psnr_min;
+} Probe;
+
+static double plane_sse(const uint8_t* a, int la, const uint8_t* b, int lb, int w, int h) {
+    double sse = 0.0;
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++) {
+            int d = a[(long long)y * la + x] - b[(long long)y * lb + x];
+            sse += d * d;
+        }
+    return sse;
+}
+
+static double frame_psnr(const AVFrame* a, const AVFrame* b) {
+    const int w = a->width, h = a->height;
+    const int cw = (w + 1) / 2, ch = (h + 1) / 2;
+    double sse = plane_sse(a->data[0], a->linesize[0], b->data[0], b->linesize[0], w, h) +
+                 plane_sse(a->data[1], a->linesize[1], b->data[1], b->linesize[1], cw, ch) +
+                 plane_sse(a->data[2], a->linesize[2], b->data[2], b->linesize[2], cw, ch);
+    double mse = sse / ((double)w * h + 2.0 * cw * ch);
+    return mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+static AVFrame* alloc_yuv(int width, int height) {
+    AVFrame* f = av_frame_alloc();
+    if (!f) return NULL;
+    f->format = AV_PIX_FMT_YUV420P;
+    f->width  = width;
+    f->height = height;
+    if (av_frame_get_buffer(f, 0) < 0) av_frame_free(&f);
+    return f;
+}
+
+static int setup_conversion(Probe* p, const AVFrame* frame) {
+    p->ref = alloc_yuv(frame->width, frame->height);
+    p->ref_sws = sws_getContext(g_probe.width, g_probe.height, AV_PIX_FMT_BGRA,
+                                frame->width, frame->height, AV_PIX_FMT_YUV420P,
+                                SWS_BICUBIC, NULL, NULL, NULL);
+    if (!p->ref || !p->ref_sws) return 0;
+
+    if (frame->format != AV_PIX_FMT_YUV420P) {
+        p->yuv = alloc_yuv(frame->width, frame->height);
+        p->dec_sws = sws_getContext(frame->width, frame->height, frame->format,
+                                    frame->width, frame->height, AV_PIX_FMT_YUV420P,
+                                    SWS_POINT, NULL, NULL, NULL);
+        if (!p->yuv || !p->dec_sws) return 0;
+    }
+    return 1;
+}
+
+static int analyze_frame(Probe* p, AVFrame* frame) {
+    if (!p->ref && !setup_conversion(p, frame)) return 0;
+
+    const AVFrame* img = frame;
+    if (p->dec_sws) {
+        sws_scale(p->dec_sws, (const uint8_t* const*)frame->data, frame->linesize,
+                  0, frame->height, p->yuv->data, p->yuv->linesize);
+        img = p->yuv;
+    }
+
+    p->frames++;
+    uint32_t id;
+    long long ts48;
+    if (!test_pattern_read(img->data[0], img->linesize[0], img->width, img->height, &id, &ts48)) {
+        p->unreadable++;
+        return 1;
+    }
+
+    if (p->frames - p->unreadable == 1) {
+        p->first_id = p->last_id = id;
+    } else if ((long long)id == p->last_id) {
+        p->duplicated++;
+    } else if ((long long)id < p->last_id) {
+        p->out_of_order++;
+    } else {
+        p->dropped += id - p->last_id - 1;
+        p->last_id  = id;
+    }
+
+    // Mux time by pts tick; the capture time's high bits come from it.
+    const AVStream* st = p->in->streams[p->stream];
+    long long tick  = av_rescale_q(frame->best_effort_timestamp, st->time_base,
+                                   (AVRational){1, g_probe.fps});
+    long long muxed = tick >= 0 && tick < g_probe.capacity ? g_probe.muxed_us[tick] : 0;
+    long long capture = 0, latency = -1;
+    if (muxed && p->latency_count < g_probe.capacity) {
+        capture = (muxed & ~PROBE_TS_MASK) | ts48;
+        if (capture > muxed) capture -= PROBE_TS_MASK + 1;
+        latency = muxed - capture;
+        p->latency_us[p->latency_count++] = latency;
+    }
+
+    test_pattern_draw(p->ref_bgra.data, p->ref_bgra.stride, g_probe.width, g_probe.height,
+                      id, ts48);
+    const uint8_t* src[1] = { p->ref_bgra.data };
+    int src_stride[1] = { p->ref_bgra.stride };
+    sws_scale(p->ref_sws, src, src_stride, 0, g_probe.height, p->ref->data, p->ref->linesize);
+    double psnr = frame_psnr(img, p->ref);
+    p->psnr_sum += psnr;
+    if (psnr < p->psnr_min) p->psnr_min = psnr;
+
+    if (p->csv)
+        fprintf(p->csv, "%u,%lld,%lld,%lld,%.3f,%.2f\n", id, tick, capture, muxed,
+                latency >= 0 ? latency / 1000.0 : -1.0, psnr);
+    return 1;
+}
+
+static int compare_ll(const void* a, const void* b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(const long long* sorted, long long n, double q) {
+    if (n == 0) return 0.0;
+    long long i = (long long)(q * (n - 1) + 0.5);
+    return sorted[i] / 1000.0;
+}
+
+static bool report(Probe* p) {
+    const long long stamped = p->frames - p->unreadable;
+    const long long span    = stamped ? p->last_id - p->first_id + 1 : 0;
+    const double    mean    = stamped ? p->psnr_sum / stamped : 0.0;
+
+    qsort(p->latency_us, (size_t)p->latency_count, sizeof(long long), compare_ll);
+    printf("probe: frames %lld, ids %lld..%lld, dropped %lld, duplicated %lld, "
+           "out of order %lld, unreadable %lld\n",
+           p->frames, p->first_id, p->last_id, p->dropped, p->duplicated,
+           p->out_of_order, p->unreadable);
+    printf("probe: capture to mux latency ms: min %.1f, p50 %.1f, p95 %.1f, max %.1f (%lld frames)\n",
+           percentile_ms(p->latency_us, p->latency_count, 0.0),
+           percentile_ms(p->latency_us, p->latency_count, 0.5),
+           percentile_ms(p->latency_us, p->latency_count, 0.95),
+           percentile_ms(p->latency_us, p->latency_count, 1.0), p->latency_count);
+    printf("probe: psnr dB: mean %.2f, min %.2f\n", mean, stamped ? p->psnr_min : 0.0);
+
+    bool pass = stamped > 0 && p->unreadable == 0 && p->out_of_order == 0 &&
+                mean >= PROBE_MIN_PSNR && p->dropped <= span * PROBE_MAX_DROP_RATE;
+    printf("probe: %s\n", pass ? "PASS" : "FAIL");
+    return pass;
+}
+
+int probe_analyze(const char* path) {
+    Probe p = { .psnr_min = 99.0 };
+    AVFrame*  frame = av_frame_alloc();
+    AVPacket* pkt   = av_packet_alloc();
+    bool reading = true, pass = false;
+
+    if (!frame || !pkt || avformat_open_input(&p.in, path, NULL, NULL) < 0 ||
+        avformat_find_stream_info(p.in, NULL) < 0) {
+        log_error("Probe: could not open %s", path);
+        goto done;
+    }
+    p.stream = av_find_best_stream(p.in, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (p.stream < 0) goto done;
+
+    const AVStream* st  = p.in->streams[p.stream];
+    const AVCodec*  dec = avcodec_find_decoder(st->codecpar->codec_id);
+    p.dec = dec ? avcodec_alloc_context3(dec) : NULL;
+    if (!p.dec || avcodec_parameters_to_context(p.dec, st->codecpar) < 0 ||
+        avcodec_open2(p.dec, dec, NULL) < 0) {
+        log_error("Probe: no decoder for %s", path);
+        goto done;
+    }
+
+    p.latency_us = calloc((size_t)g_probe.capacity, sizeof(long long));
+    if (!p.latency_us || !frame_alloc(&p.ref_bgra, g_probe.width, g_probe.height))
+        goto done;
+
+    char csv_path[1024];
+    snprintf(csv_path, sizeof(csv_path), "%s.probe.csv", path);
+    p.csv = fopen(csv_path, "w");
+    if (p.csv) fprintf(p.csv, "frame_id,pts,capture_us,muxed_us,latency_ms,psnr_db\n");
+
+    while (reading) {
+        if (av_read_frame(p.in, pkt) < 0) {
+            avcodec_send_packet(p.dec, NULL);
+            reading = false;
+        } else if (pkt->stream_index != p.stream) {
+            av_packet_unref(pkt);
+            continue;
+        } else {
+            avcodec_send_packet(p.dec, pkt);
+            av_packet_unref(pkt);
+        }
+
+        while (avcodec_receive_frame(p.dec, frame) >= 0) {
+            bool ok = analyze_frame(&p, frame);
+            av_frame_unref(frame);
+            if (!ok) goto done;
+        }
+    }
+    pass = report(&p);
+
+done:
+    if (p.csv) fclose(p.csv);
+    frame_free(&p.ref_bgra);
+    av_frame_free(&p.ref);
+    av_frame_free(&p.yuv);
+    sws_freeContext(p.ref_sws);
+    sws_freeContext(p.dec_sws);
+    free(p.latency_us);
+    avcodec_free_context(&p.dec);
+    avformat_close_input(&p.in);
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    free(g_probe.muxed_us);
+    g_probe.muxed_us = NULL;
+    encoder_set_packet_hook(NULL);
+    return pass;
+}
@@ -0,0 +1,236 @@
+#include <string.h>
+#include "quality.h"
+#include "encoder.h"
+#include "logger.h"
+#include "threading.h"
+#include "utils.h"
+
+#define QUALITY_MAX_LEVELS    16
+#define QUALITY_WINDOW_US     1000000LL
+#define QUALITY_LOAD_HIGH     0.90 // encode time / frame budget that counts as overload
+#define QUALITY_LOAD_LOW      0.60 // below this a window counts as calm
+#define QUALITY_DROP_HIGH     0.02
+#define QUALITY_DROP_PANIC    0.10 // step down without waiting for a second window
+#define QUALITY_DOWN_WINDOWS  2
+#define QUALITY_UP_WINDOWS    5
+#define QUALITY_UP_MAX        60
+#define QUALITY_COOLDOWN      2    // windows ignored after a change while it settles
+#define QUALITY_RELAPSE_US    10000000LL
+#define QUALITY_MIN_FPS       10
+
+static const char* const x264_presets[] = {
+    "ultrafast", "superfast", "veryfast", "faster", "fast",
+    "medium", "slow", "slower", "veryslow", "placebo",
+};
+#define PRESET_COUNT ((int)(sizeof(x264_presets) / sizeof(x264_presets[0])))
+
+typedef enum { STEP_PRESET, STEP_CRF, STEP_SCALE, STEP_FPS } QualityStep;
+
+// Cheapest quality loss first: presets and CRF cost little visually, a
+// smaller frame costs more, a lower frame rate is the last resort.
+static const QualityStep ladder[] = {
+    STEP_PRESET, STEP_CRF, STEP_PRESET, STEP_SCALE, STEP_CRF,
+    STEP_PRESET, STEP_SCALE, STEP_FPS, STEP_FPS,
+};
+
+// Output size per scale step. Without --output-size the output is the
+// canvas, and 2:3 and 1:2 of it hit the fast scalers.
+static const int scale_num[] = { 1, 2, 1 };
+static const int scale_den[] = { 1, 3, 2 };
+
+static struct {
+    bool          enabled;
+    QualityConfig cfg;
+    QualityLevel  levels[QUALITY_MAX_LEVELS];
+    int           level_count;
+    int           level;
+
+    long long     window_start_us;
+    long long     encode_us;
+    long long     queue_sum;
+    int           frames;
+    atomic_i64    drops;
+    long long     frame_index;
+
+    int           over_windows;
+    int           calm_windows;
+    int           calm_needed;
+    int           cooldown;
+    long long     last_up_us;
+} g_q;
+
+static int find_preset(const char* name) {
+    for (int i = 0; name && i < PRESET_COUNT; i++)
+        if (!strcmp(name, x264_presets[i])) return i;
+    return -1;
+}
+
+static void build_ladder(void) {
+    const bool can_preset = encoder_has_option("preset") && find_preset(g_q.cfg.preset) >= 0;
+    const bool can_crf    = g_q.cfg.bitrate_kbps <= 0 && encoder_has_option("crf");
+    const bool can_scale  = encoder_can_resize();
+
+    QualityLevel cur = {
+        .preset      = can_preset ? find_preset(g_q.cfg.preset) : -1,
+        .crf         = g_q.cfg.crf,
+        .width       = g_q.cfg.width,
+        .height      = g_q.cfg.height,
+        .fps_divisor = 1,
+    };
+    int scale = 0;
+    g_q.levels[0] = cur;
+    g_q.level_count = 1;
+
+    for (size_t i = 0; i < sizeof(ladder) / sizeof(ladder[0]); i++) {
+        QualityLevel next = cur;
+        switch (ladder[i]) {
+        case STEP_PRESET:
+            if (cur.preset <= 0) continue;
+            next.preset = cur.preset - 1;
+            break;
+        case STEP_CRF:
+            if (!can_crf || cur.crf >= 51) continue;
+            next.crf = cur.crf + 3 > 51 ? 51 : cur.crf + 3;
+            break;
+        case STEP_SCALE:
+            if (!can_scale || scale + 1 >= (int)(sizeof(scale_num) / sizeof(scale_num[0])))
+                continue;
+            scale++;
+            next.width  = (g_q.cfg.width * scale_num[scale] / scale_den[scale]) & ~1;
+            next.height = (g_q.cfg.height * scale_num[scale] / scale_den[scale]) & ~1;
+            break;
+        case STEP_FPS:
+            if (g_q.cfg.fps / (cur.fps_divisor + 1) < QUALITY_MIN_FPS) continue;
+            next.fps_divisor = cur.fps_divisor + 1;
+            break;
+        }
+        g_q.levels[g_q.level_count++] = next;
+        cur = next;
+    }
+}
+
+static const char* preset_name(const QualityLevel* l) {
+    return l->preset >= 0 ? x264_presets[l->preset] : g_q.cfg.preset;
+}
+
+static bool apply_level(int to) {
+    const QualityLevel* a = &g_q.levels[g_q.level];
+    const QualityLevel* b = &g_q.levels[to];
+
+    if (a->preset != b->preset || a->width != b->width || a->height != b->height) {
+        if (!encoder_reconfigure(preset_name(b), b->width, b->height))
+            return false;
+    }
+    if (a->crf != b->crf && !encoder_set_crf(b->crf))
+        return false;
+    g_q.level = to;
+    return true;
+}
+
+static void change_level(int to, double load, double queue, double drop_rate) {
+    const int from = g_q.level;
+    if (!apply_level(to)) {
+        // Don't keep retrying a step the encoder refuses.
+        log_warn("Quality level %d -> %d failed, holding at %d", from, to, from);
+        if (to > from) g_q.level_count = from + 1;
+        return;
+    }
+
+    // A warning, so that Release builds record every change too.
+    const QualityLevel* l = &g_q.levels[to];
+    log_warn("Quality level %d -> %d: preset %s, crf %d, %dx%d, %d fps "
+             "(load %.0f%%, queue %.1f, drops %.1f%%)",
+             from, to, preset_name(l) ? preset_name(l) : "default", l->crf,
+             l->width, l->height, g_q.cfg.fps / l->fps_divisor,
+             load * 100.0, queue, drop_rate * 100.0);
+}
+
+void quality_init(const QualityConfig* cfg) {
+    memset(&g_q, 0, sizeof(g_q));
+    g_q.cfg = *cfg;
+    if (g_q.cfg.queue_limit < 1) g_q.cfg.queue_limit = 1;
+    build_ladder();
+
+    g_q.calm_needed     = QUALITY_UP_WINDOWS;
+    g_q.window_start_us = time_now_us();
+    g_q.enabled         = true;
+    log_info("Adaptive quality: %d levels", g_q.level_count);
+}
+
+bool quality_keep_frame(void) {
+    if (!g_q.enabled) return true;
+    return g_q.frame_index++ % g_q.levels[g_q.level].fps_divisor == 0;
+}
+
+void quality_note_drops(long long frames) {
+    if (g_q.enabled && frames > 0)
+        atomic_add_i64(&g_q.drops, frames);
+}
+
+static void evaluate(long long now) {
+    const QualityLevel* l = &g_q.levels[g_q.level];
+    const double budget_us = 1000000.0 * l->fps_divisor / g_q.cfg.fps;
+
+    long long drops = atomic_load_i64(&g_q.drops);
+    atomic_add_i64(&g_q.drops, -drops);
+
+    const double load      = (double)g_q.encode_us / g_q.frames / budget_us;
+    const double queue     = (double)g_q.queue_sum / g_q.frames;
+    const double drop_rate = (double)drops / (g_q.frames + drops);
+
+    if (g_q.cooldown > 0) {
+        g_q.cooldown--;
+        return;
+    }
+
+    const bool over = load > QUALITY_LOAD_HIGH || queue > g_q.cfg.queue_limit ||
+                      drop_rate > QUALITY_DROP_HIGH;
+    const bool calm = load < QUALITY_LOAD_LOW && queue <= 0.5 && drops == 0;
+
+    if (over) {
+        g_q.calm_windows = 0;
+        g_q.over_windows++;
+        bool panic = drop_rate > QUALITY_DROP_PANIC;
+        if ((panic || g_q.over_windows >= QUALITY_DOWN_WINDOWS) &&
+            g_q.level + 1 < g_q.level_count) {
+            // Falling straight back after stepping up means that level
+            // doesn't fit; wait longer before trying it again.
+            if (g_q.last_up_us && now - g_q.last_up_us < QUALITY_RELAPSE_US) {
+                g_q.calm_needed *= 2;
+                if (g_q.calm_needed > QUALITY_UP_MAX) g_q.calm_needed = QUALITY_UP_MAX;
+            }
+            change_level(g_q.level + 1, load, queue, drop_rate);
+            g_q.over_windows = 0;
+            g_q.cooldown     = QUALITY_COOLDOWN;
+        }
+    } else if (calm) {
+        g_q.over_windows = 0;
+        g_q.calm_windows++;
+        if (g_q.calm_windows >= g_q.calm_needed && g_q.level > 0) {
+            change_level(g_q.level - 1, load, queue, drop_rate);
+            g_q.last_up_us   = now;
+            g_q.calm_windows = 0;
+            g_q.cooldown     = QUALITY_COOLDOWN;
+        }
+    } else {
+        g_q.over_windows = 0;
+        g_q.calm_windows = 0;
+    }
+}
+
+void quality_frame_encoded(long long encode_us, int queue_depth) {
+    if (!g_q.enabled) return;
+
+    g_q.encode_us += encode_us;
+    g_q.queue_sum += queue_depth;
+    g_q.frames++;
+
+    long long now = time_now_us();
+    if (now - g_q.window_start_us < QUALITY_WINDOW_US) return;
+
+    evaluate(now);
+    g_q.window_start_us = now;
+    g_q.encode_us       = 0;
+    g_q.queue_sum       = 0;
+    g_q.frames          = 0;
+}
@@ -0,0 +1,233 @@
+#include <string.h>
+#include "readback.h"
+#include "logger.h"
+#include "utils.h"
+
+#ifndef GL_BGRA
+#define GL_BGRA 0x80E1
+#endif
+
+static int map_slot(ReadbackSlot* s, GLbitfield extra) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s->buffer);
+    s->mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)s->capacity,
+                                 GL_MAP_READ_BIT | extra);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return s->mapped != NULL;
+}
+
+static void unmap_slot(ReadbackSlot* s) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s->buffer);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    s->mapped = NULL;
+}
+
+static void set_state(ReadbackRing* ring, ReadbackSlot* s, ReadbackSlotState state) {
+    mutex_lock(&ring->lock);
+    s->state = state;
+    mutex_unlock(&ring->lock);
+    if (state == READBACK_READY)
+        cond_broadcast(&ring->ready);
+}
+
+static ReadbackSlotState get_state(ReadbackRing* ring, ReadbackSlot* s) {
+    mutex_lock(&ring->lock);
+    ReadbackSlotState state = s->state;
+    mutex_unlock(&ring->lock);
+    return state;
+}
+
+// (Re)creates the slot's PBO with room for `size` bytes. Buffer storage is
+// immutable, so a persistent buffer is replaced rather than resized.
+static int alloc_slot(ReadbackRing* ring, ReadbackSlot* s, size_t size) {
+    if (s->mapped) unmap_slot(s);
+    if (s->buffer) glDeleteBuffers(1, &s->buffer);
+    s->buffer   = 0;
+    s->capacity = size;
+
+    glGenBuffers(1, &s->buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s->buffer);
+#ifdef GL_VERSION_4_4
+    if (ring->persistent) {
+        const GLbitfield flags =
+            GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)size, NULL, flags);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (!map_slot(s, GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT)) {
+            log_error("Persistent PBO map failed");
+            return 0;
+        }
+        return 1;
+    }
+#endif
+    glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)size, NULL, GL_STREAM_READ);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return 1;
+}
+
+int readback_init(ReadbackRing* ring, int width, int height, int count) {
+    memset(ring, 0, sizeof(*ring));
+    if (count < 2) count = 2;
+    if (count > READBACK_MAX_SLOTS) count = READBACK_MAX_SLOTS;
+
+    ring->count = count;
+    readback_resize(ring, width, height);
+
+#ifdef GL_VERSION_4_4
+    ring->persistent = GLAD_GL_VERSION_4_4;
+#endif
+
+    mutex_init(&ring->lock);
+    cond_init(&ring->ready);
+
+    for (int i = 0; i < count; i++) {
+        if (!alloc_slot(ring, &ring->slots[i], ring->size)) {
+            readback_destroy(ring);
+            return 0;
+        }
+    }
+
+    log_info("Readback ring: %d PBOs (%s mapping)", count,
+             ring->persistent ? "persistent" : "per-frame");
+    return 1;
+}
+
+void readback_resize(ReadbackRing* ring, int width, int height) {
+    ring->width  = width;
+    ring->height = height;
+    ring->stride = (size_t)width * 4;
+    ring->size   = ring->stride * height;
+}
+
+bool readback_submit(ReadbackRing* ring) {
+    ReadbackSlot* s = &ring->slots[ring->write_index];
+    if (get_state(ring, s) != READBACK_FREE) {
+        ring->dropped++;
+        return false;
+    }
+    if (s->capacity < ring->size && !alloc_slot(ring, s, ring->size)) {
+        ring->dropped++;
+        return false;
+    }
+    s->width  = ring->width;
+    s->height = ring->height;
+    s->stride = ring->stride;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s->buffer);
+    glReadPixels(0, 0, ring->width, ring->height, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    s->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    s->timestamp_us = time_now_us();
+    glFlush();
+
+    set_state(ring, s, READBACK_PENDING);
+    ring->write_index = (ring->write_index + 1) % ring->count;
+    return true;
+}
+
+static void complete_slot(ReadbackRing* ring, ReadbackSlot* s) {
+    glDeleteSync(s->fence);
+    s->fence = NULL;
+    if (!ring->persistent && !map_slot(s, 0))
+        log_error("PBO map failed, frame will be skipped");
+    set_state(ring, s, READBACK_READY);
+}
+
+void readback_poll(ReadbackRing* ring) {
+    for (int i = 0; i < ring->count; i++) {
+        ReadbackSlot*     s     = &ring->slots[i];
+        ReadbackSlotState state = get_state(ring, s);
+
+        if (state == READBACK_PENDING) {
+            GLenum r = glClientWaitSync(s->fence, 0, 0);
+            if (r == GL_ALREADY_SIGNALED || r == GL_CONDITION_SATISFIED)
+                complete_slot(ring, s);
+        } else if (state == READBACK_DONE) {
+            if (!ring->persistent && s->mapped) unmap_slot(s);
+            set_state(ring, s, READBACK_FREE);
+        }
+    }
+}
+
+const unsigned char* readback_wait(ReadbackRing* ring, int* slot, int* stride,
+                                   long long* timestamp_us) {
+    mutex_lock(&ring->lock);
+    for (;;) {
+        ReadbackSlot* s = &ring->slots[ring->read_index];
+        while (!ring->closed && s->state != READBACK_READY)
+            cond_wait(&ring->ready, &ring->lock);
+        if (s->state != READBACK_READY) {
+            mutex_unlock(&ring->lock);
+            return NULL;
+        }
+
+        int index = ring->read_index;
+        ring->read_index = (ring->read_index + 1) % ring->count;
+        if (!s->mapped) {
+            s->state = READBACK_DONE;
+            continue;
+        }
+
+        s->state = READBACK_ENCODING;
+        mutex_unlock(&ring->lock);
+
+        *slot         = index;
+        *stride       = -(int)s->stride;
+        *timestamp_us = s->timestamp_us;
+        return s->mapped + s->stride * (s->height - 1);
+    }
+}
+
+void readback_release(ReadbackRing* ring, int slot) {
+    set_state(ring, &ring->slots[slot], READBACK_DONE);
+}
+
+void readback_frame_size(const ReadbackRing* ring, int slot, int* width, int* height) {
+    *width  = ring->slots[slot].width;
+    *height = ring->slots[slot].height;
+}
+
+int readback_queued(ReadbackRing* ring) {
+    int queued = 0;
+    mutex_lock(&ring->lock);
+    for (int i = 0; i < ring->count; i++)
+        if (ring->slots[i].state == READBACK_READY) queued++;
+    mutex_unlock(&ring->lock);
+    return queued;
+}
+
+void readback_close(ReadbackRing* ring) {
+    for (int n = 0; n < ring->count; n++) {
+        int i = (ring->write_index + n) % ring->count;
+        ReadbackSlot* s = &ring->slots[i];
+        if (get_state(ring, s) != READBACK_PENDING) continue;
+
+        GLenum r = glClientWaitSync(s->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                    1000000000ull);
+        if (r == GL_ALREADY_SIGNALED || r == GL_CONDITION_SATISFIED) {
+            complete_slot(ring, s);
+        } else {
+            glDeleteSync(s->fence);
+            s->fence = NULL;
+            set_state(ring, s, READBACK_FREE);
+        }
+    }
+
+    mutex_lock(&ring->lock);
+    ring->closed = true;
+    mutex_unlock(&ring->lock);
+    cond_broadcast(&ring->ready);
+}
+
+void readback_destroy(ReadbackRing* ring) {
+    for (int i = 0; i < ring->count; i++) {
+        ReadbackSlot* s = &ring->slots[i];
+        if (s->fence) glDeleteSync(s->fence);
+        if (s->mapped) unmap_slot(s);
+        if (s->buffer) glDeleteBuffers(1, &s->buffer);
+        s->buffer = 0;
+        s->fence  = NULL;
+    }
+    cond_destroy(&ring->ready);
+    mutex_destroy(&ring->lock);
+}
@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include <string.h>
+#include "roi.h"
+#include "jobs.h"
+#include "logger.h"
+
+int roi_init(RoiTracker* roi, int width, int height) {
+    memset(roi, 0, sizeof(*roi));
+    roi->width  = width;
+    roi->height = height;
+    roi->cols   = (width + ROI_TILE - 1) / ROI_TILE;
+    roi->rows   = (height + ROI_TILE - 1) / ROI_TILE;
+    roi->dirty  = calloc((size_t)roi->cols * roi->rows, 1);
+    if (!roi->dirty || !frame_alloc(&roi->prev, width, height)) {
+        log_error("Failed to allocate ROI tracker for %dx%d", width, height);
+        roi_free(roi);
+        return 0;
+    }
+    return 1;
+}
+
+void roi_free(RoiTracker* roi) {
+    if (roi->frames)
+        log_info("ROI: %.1f%% of tiles changed per frame on average",
+                 100.0 * roi->dirty_total / ((double)roi->frames * roi->cols * roi->rows));
+    free(roi->dirty);
+    frame_free(&roi->prev);
+    memset(roi, 0, sizeof(*roi));
+}
+
+typedef struct {
+    RoiTracker*          roi;
+    const unsigned char* src;
+    int                  stride;
+} RoiJob;
+
+// One row of tiles. A static tile costs a full compare; a changed one stops
+// at the first differing line and is then copied for the next frame.
+static void update_tile_row(void* ctx, int row) {
+    const RoiJob* job = ctx;
+    RoiTracker*   roi = job->roi;
+    const int y0 = row * ROI_TILE;
+    const int y1 = y0 + ROI_TILE < roi->height ? y0 + ROI_TILE : roi->height;
+
+    for (int col = 0; col < roi->cols; col++) {
+        const int    x0    = col * ROI_TILE;
+        const size_t bytes = (size_t)((x0 + ROI_TILE < roi->width ? ROI_TILE : roi->width - x0) * 4);
+        bool changed = !roi->primed;
+        for (int y = y0; y < y1 && !changed; y++)
+            changed = memcmp(job->src + (ptrdiff_t)y * job->stride + x0 * 4,
+                             roi->prev.data + (size_t)y * roi->prev.stride + x0 * 4, bytes) != 0;
+
+        roi->dirty[row * roi->cols + col] = changed;
+        if (!changed) continue;
+        for (int y = y0; y < y1; y++)
+            memcpy(roi->prev.data + (size_t)y * roi->prev.stride + x0 * 4,
+                   job->src + (ptrdiff_t)y * job->stride + x0 * 4, bytes);
+    }
+}
+
+int roi_update(RoiTracker* roi, const unsigned char* bgra, int stride) {
+    RoiJob job = { roi, bgra, stride };
+    jobs_parallel_for(roi->rows, update_tile_row, &job);
+    roi->primed = true;
+
+    int count = 0;
+    for (int i = 0; i < roi->cols * roi->rows; i++)
+        count += roi->dirty[i];
+    roi->dirty_count = count;
+    roi->dirty_total += count;
+    roi->frames++;
+    return count;
+}
@@ -0,0 +1,164 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scale.h"
+#include "frame_alloc.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCALE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// (x + 4) / 9 for x <= 9 * 255, exact over that range
+#define DIV9(x) ((((unsigned)(x) + 4) * 7282u) >> 16)
+
+ScaleMode scale_pick_mode(int src_w, int src_h, int dst_w, int dst_h) {
+    if (src_w == dst_w && src_h == dst_h)           return SCALE_NONE;
+    if (src_w == dst_w * 2 && src_h == dst_h * 2)   return SCALE_HALF;
+    if (src_w * 2 == dst_w * 3 && src_h * 2 == dst_h * 3) return SCALE_TWO_THIRDS;
+    return SCALE_GENERIC;
+}
+
+const char* scale_mode_name(ScaleMode mode) {
+    switch (mode) {
+    case SCALE_NONE:       return "none";
+    case SCALE_HALF:       return "box 1:2";
+    case SCALE_TWO_THIRDS: return "area 2:3";
+    default:               return "swscale";
+    }
+}
+
+static void half_row(const uint8_t* r0, const uint8_t* r1, uint8_t* dst, int dst_w) {
+    int x = 0;
+#ifdef SCALE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two  = _mm_set1_epi16(2);
+    for (; x + 4 <= dst_w; x += 4) {
+        __m128i out[2];
+        for (int k = 0; k < 2; k++) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(r0 + (x * 2 + k * 4) * 4));
+            __m128i b = _mm_loadu_si128((const __m128i*)(r1 + (x * 2 + k * 4) * 4));
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+            lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+            hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+            __m128i sum = _mm_unpacklo_epi64(lo, hi);
+            out[k] = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+        }
+        _mm_storeu_si128((__m128i*)(dst + x * 4), _mm_packus_epi16(out[0], out[1]));
+    }
+#endif
+    for (; x < dst_w; x++) {
+        const uint8_t* a = r0 + x * 8;
+        const uint8_t* b = r1 + x * 8;
+        for (int c = 0; c < 4; c++)
+            dst[x * 4 + c] = (uint8_t)((a[c] + a[c + 4] + b[c] + b[c + 4] + 2) >> 2);
+    }
+}
+
+// Vertical 2:1 weighting of two rows into 16-bit sums (weights sum to 3).
+static void two_thirds_vertical(const uint8_t* heavy, const uint8_t* light,
+                                uint16_t* out, int bytes) {
+    int i = 0;
+#ifdef SCALE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i h = _mm_loadu_si128((const __m128i*)(heavy + i));
+        __m128i l = _mm_loadu_si128((const __m128i*)(light + i));
+        __m128i hl = _mm_unpacklo_epi8(h, zero), hh = _mm_unpackhi_epi8(h, zero);
+        __m128i ll = _mm_unpacklo_epi8(l, zero), lh = _mm_unpackhi_epi8(l, zero);
+        _mm_storeu_si128((__m128i*)(out + i),
+                         _mm_add_epi16(_mm_add_epi16(hl, hl), ll));
+        _mm_storeu_si128((__m128i*)(out + i + 8),
+                         _mm_add_epi16(_mm_add_epi16(hh, hh), lh));
+    }
+#endif
+    for (; i < bytes; i++)
+        out[i] = (uint16_t)(heavy[i] * 2 + light[i]);
+}
+
+// Horizontal 3 -> 2 over the vertical sums, then divide by 9.
+static void two_thirds_horizontal(const uint16_t* v, uint8_t* dst, int dst_w) {
+    int x = 0;
+#ifdef SCALE_SSE2
+    const __m128i four = _mm_set1_epi16(4);
+    const __m128i div9 = _mm_set1_epi16((short)7282);
+    for (; x + 4 <= dst_w; x += 4) {
+        __m128i out[2];
+        for (int k = 0; k < 2; k++) {
+            const uint16_t* g = v + (x / 2 + k) * 12;
+            __m128i a = _mm_loadu_si128((const __m128i*)g);       // p0 | p1
+            __m128i b = _mm_loadu_si128((const __m128i*)(g + 4)); // p1 | p2
+            __m128i c = _mm_unpacklo_epi64(a, _mm_srli_si128(b, 8)); // p0 | p2
+            __m128i s = _mm_add_epi16(_mm_add_epi16(a, b), c);
+            out[k] = _mm_mulhi_epu16(_mm_add_epi16(s, four), div9);
+        }
+        _mm_storeu_si128((__m128i*)(dst + x * 4), _mm_packus_epi16(out[0], out[1]));
+    }
+#endif
+    for (; x < dst_w; x += 2) {
+        const uint16_t* g = v + (x / 2) * 12;
+        for (int c = 0; c < 4; c++) {
+            dst[x * 4 + c] = (uint8_t)DIV9(g[c] * 2 + g[c + 4]);
+            if (x + 1 < dst_w)
+                dst[x * 4 + 4 + c] = (uint8_t)DIV9(g[c + 4] + g[c + 8] * 2);
+        }
+    }
+}
+
+size_t scale_scratch_size(ScaleMode mode, int dst_w) {
+    // One row of vertical sums, plus the overread of the last SSE2 group.
+    if (mode == SCALE_TWO_THIRDS)
+        return sizeof(uint16_t) * (size_t)(dst_w * 3 / 2) * 4 + 16;
+    return 0;
+}
+
+static void two_thirds(const uint8_t* src, int src_stride,
+                       uint8_t* dst, int dst_stride, int dst_w, int y0, int y1,
+                       uint16_t* v) {
+    const int src_w = dst_w * 3 / 2;
+    for (int y = y0 & ~1; y + 1 < y1; y += 2) {
+        const uint8_t* r0 = src + (ptrdiff_t)(y / 2 * 3) * src_stride;
+        const uint8_t* r1 = r0 + src_stride;
+        const uint8_t* r2 = r1 + src_stride;
+
+        two_thirds_vertical(r0, r1, v, src_w * 4);
+        two_thirds_horizontal(v, dst + (ptrdiff_t)y * dst_stride, dst_w);
+        two_thirds_vertical(r2, r1, v, src_w * 4);
+        two_thirds_horizontal(v, dst + (ptrdiff_t)(y + 1) * dst_stride, dst_w);
+    }
+}
+
+void scale_bgra_rows(ScaleMode mode,
+                     const uint8_t* src, int src_stride,
+                     uint8_t* dst, int dst_stride, int dst_w, int y0, int y1,
+                     void* scratch) {
+    switch (mode) {
+    case SCALE_HALF:
+        for (int y = y0; y < y1; y++) {
+            const uint8_t* r0 = src + (ptrdiff_t)(y * 2) * src_stride;
+            half_row(r0, r0 + src_stride, dst + (ptrdiff_t)y * dst_stride, dst_w);
+        }
+        break;
+    case SCALE_TWO_THIRDS:
+        two_thirds(src, src_stride, dst, dst_stride, dst_w, y0, y1, scratch);
+        break;
+    case SCALE_NONE:
+        for (int y = y0; y < y1; y++)
+            memcpy(dst + (ptrdiff_t)y * dst_stride, src + (ptrdiff_t)y * src_stride,
+                   (size_t)dst_w * 4);
+        break;
+    default:
+        break;
+    }
+}
+
+void scale_bgra(ScaleMode mode,
+                const uint8_t* src, int src_stride,
+                uint8_t* dst, int dst_stride, int dst_w, int dst_h) {
+    const size_t size = scale_scratch_size(mode, dst_w);
+    void* scratch = size ? mem_aligned_alloc(size, FRAME_ALIGN) : NULL;
+    if (size && !scratch) return;
+    scale_bgra_rows(mode, src, src_stride, dst, dst_stride, dst_w, 0, dst_h, scratch);
+    mem_aligned_free(scratch);
+}
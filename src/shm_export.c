@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <string.h>
+#include "shm_export.h"
+#include "castr_shm.h"
+#include "jobs.h"
+#include "logger.h"
+#include "threading.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define SHM_EXPORT_SLOTS 4
+// Ring names skipped on Windows while a crashed producer's readers hold them
+#define SHM_EXPORT_GENERATION_TRIES 16
+
+typedef struct {
+    unsigned char* base;
+    size_t         size;
+    char           name[256];
+#ifdef _WIN32
+    HANDLE         mapping;
+#endif
+} ShmObject;
+
+static struct {
+    ShmObject          dir_object;
+    CastrShmDirectory* dir;
+    ShmObject          ring;
+    CastrShmHeader*    header;
+    char               name[128];
+    char               format[8];
+    unsigned long long published;
+} g_shm;
+
+static size_t align_up(size_t v) {
+    return (v + CASTR_SHM_ALIGN - 1) / CASTR_SHM_ALIGN * CASTR_SHM_ALIGN;
+}
+
+#ifdef _WIN32
+#define SHM_PREFIX "Local\\castr-"
+
+// 1 on success, -1 if the name is still held by someone, 0 on failure.
+static int create_object(ShmObject* o, size_t size) {
+    o->size    = size;
+    o->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                    (DWORD)((unsigned long long)size >> 32),
+                                    (DWORD)size, o->name);
+    if (!o->mapping) return 0;
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(o->mapping);
+        return -1;
+    }
+    o->base = MapViewOfFile(o->mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!o->base) {
+        CloseHandle(o->mapping);
+        return 0;
+    }
+    return 1;
+}
+
+// The name goes away with the last handle, readers' included.
+static void destroy_object(ShmObject* o) {
+    UnmapViewOfFile(o->base);
+    CloseHandle(o->mapping);
+}
+
+// Windows reports a live directory as already existing.
+static bool directory_in_use(const char* name) {
+    (void)name;
+    return false;
+}
+
+static unsigned current_pid(void) {
+    return (unsigned)GetCurrentProcessId();
+}
+#else
+#define SHM_PREFIX "/castr-"
+
+static int create_object(ShmObject* o, size_t size) {
+    o->size = size;
+    int fd = shm_open(o->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) return errno == EEXIST ? -1 : 0;
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        shm_unlink(o->name);
+        return 0;
+    }
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        shm_unlink(o->name);
+        return 0;
+    }
+    o->base = p;
+    return 1;
+}
+
+// Readers still mapping it keep their copy.
+static void destroy_object(ShmObject* o) {
+    munmap(o->base, o->size);
+    shm_unlink(o->name);
+}
+
+// A directory whose producer is still running, as Windows reports it.
+static bool directory_in_use(const char* name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return false;
+    CastrShmDirectory d;
+    const bool live = pread(fd, &d, sizeof(d), 0) == (ssize_t)sizeof(d) &&
+                      d.magic == CASTR_SHM_DIR_MAGIC && !d.closed && d.producer_pid &&
+                      (kill((pid_t)d.producer_pid, 0) == 0 || errno == EPERM);
+    close(fd);
+    return live;
+}
+
+static unsigned current_pid(void) {
+    return (unsigned)getpid();
+}
+#endif
+
+// NV12 subsamples 2x2, so an odd last row or column is left out.
+static void export_size(bool nv12, int* width, int* height) {
+    if (nv12) {
+        *width  &= ~1;
+        *height &= ~1;
+    }
+}
+
+// A ring at the first free generation from `generation` on, made current
+// in the directory once its header is complete.
+static int open_ring(uint32_t generation, int width, int height) {
+    const bool nv12 = !strcmp(g_shm.format, "nv12");
+    export_size(nv12, &width, &height);
+    if (width <= 0 || height <= 0) {
+        log_error("Shared memory export: no frame at %dx%d %s", width, height, g_shm.format);
+        return 0;
+    }
+    const size_t stride = align_up((size_t)width * (nv12 ? 1 : 4));
+    const size_t frame  = nv12 ? stride * height * 3 / 2 : stride * height;
+    const size_t slot   = align_up(CASTR_SHM_ALIGN + frame);
+    const size_t offset = align_up(sizeof(CastrShmHeader));
+    const size_t size   = offset + slot * SHM_EXPORT_SLOTS;
+
+    ShmObject* o = &g_shm.ring;
+    int r = -1;
+    for (int i = 0; r < 0 && i < SHM_EXPORT_GENERATION_TRIES; i++, generation++) {
+        memset(o, 0, sizeof(*o));
+        snprintf(o->name, sizeof(o->name), SHM_PREFIX "%s.%u", g_shm.name, generation);
+#ifndef _WIN32
+        // Left by a producer that crashed; this NAME's directory is ours.
+        shm_unlink(o->name);
+#endif
+        r = create_object(o, size);
+    }
+    generation--;
+    if (r <= 0) {
+        log_error("Failed to create shared memory %s (%zu bytes)", o->name, size);
+        memset(o, 0, sizeof(*o));
+        return 0;
+    }
+
+    // Fault everything in now rather than on the first published frames.
+    memset(o->base, 0, size);
+
+    CastrShmHeader* h = (CastrShmHeader*)o->base;
+    h->format       = nv12 ? CASTR_SHM_NV12 : CASTR_SHM_BGRA;
+    h->width        = (uint32_t)width;
+    h->height       = (uint32_t)height;
+    h->stride       = (uint32_t)stride;
+    h->slot_count   = SHM_EXPORT_SLOTS;
+    h->slot_offset  = (uint32_t)offset;
+    h->slot_size    = slot;
+    h->frame_size   = frame;
+    h->producer_pid = current_pid();
+    h->generation   = generation;
+    h->version      = CASTR_SHM_VERSION;
+    atomic_fence();
+    h->magic        = CASTR_SHM_MAGIC;
+    g_shm.header    = h;
+
+    atomic_store_i32((atomic_i32*)&g_shm.dir->generation, (int)generation);
+
+    log_info("Shared memory export: %s, %dx%d %s, %d slots, %.1f MB", o->name,
+             width, height, g_shm.format, SHM_EXPORT_SLOTS, size / 1048576.0);
+    return 1;
+}
+
+static void close_ring(void) {
+    atomic_store_i32((atomic_i32*)&g_shm.header->closed, 1);
+    destroy_object(&g_shm.ring);
+    memset(&g_shm.ring, 0, sizeof(g_shm.ring));
+    g_shm.header = NULL;
+}
+
+int shm_export_open(const char* name, const char* format, int width, int height) {
+    memset(&g_shm, 0, sizeof(g_shm));
+    snprintf(g_shm.name, sizeof(g_shm.name), "%s", name);
+    snprintf(g_shm.format, sizeof(g_shm.format), "%s", format);
+
+    ShmObject* d = &g_shm.dir_object;
+    snprintf(d->name, sizeof(d->name), SHM_PREFIX "%s", name);
+    if (directory_in_use(d->name)) {
+        log_error("Shared memory %s is already in use", d->name);
+        return 0;
+    }
+#ifndef _WIN32
+    // A producer that crashed leaves its directory behind.
+    shm_unlink(d->name);
+#endif
+    int r = create_object(d, sizeof(CastrShmDirectory));
+    if (r <= 0) {
+        if (r < 0)
+            log_error("Shared memory %s is already in use", d->name);
+        else
+            log_error("Failed to create shared memory %s", d->name);
+        memset(&g_shm, 0, sizeof(g_shm));
+        return 0;
+    }
+    g_shm.dir = (CastrShmDirectory*)d->base;
+    g_shm.dir->producer_pid = current_pid();
+    g_shm.dir->version      = CASTR_SHM_VERSION;
+
+    if (!open_ring(0, width, height)) {
+        destroy_object(d);
+        memset(&g_shm, 0, sizeof(g_shm));
+        return 0;
+    }
+    atomic_fence();
+    g_shm.dir->magic = CASTR_SHM_DIR_MAGIC;
+    return 1;
+}
+
+typedef struct {
+    const unsigned char* src;
+    int                  src_stride;
+    unsigned char*       dst;
+    size_t               dst_stride;
+    int                  width, height;
+    bool                 nv12;
+} PublishJob;
+
+// BT.601 limited range, chroma from the 2x2 average.
+static void bgra_to_nv12_rows(const PublishJob* job, int y0, int y1) {
+    unsigned char* uv_plane = job->dst + job->dst_stride * job->height;
+    for (int y = y0; y < y1; y += 2) {
+        const unsigned char* s0 = job->src + (ptrdiff_t)y * job->src_stride;
+        const unsigned char* s1 = s0 + job->src_stride;
+        unsigned char* d0 = job->dst + job->dst_stride * y;
+        unsigned char* d1 = d0 + job->dst_stride;
+        unsigned char* uv = uv_plane + job->dst_stride * (y / 2);
+
+        for (int x = 0; x < job->width; x += 2) {
+            int b = 0, g = 0, r = 0;
+            const unsigned char* px[4] = { s0 + x * 4, s0 + x * 4 + 4, s1 + x * 4, s1 + x * 4 + 4 };
+            unsigned char* out[4] = { d0 + x, d0 + x + 1, d1 + x, d1 + x + 1 };
+            for (int i = 0; i < 4; i++) {
+                *out[i] = (unsigned char)(((66 * px[i][2] + 129 * px[i][1] + 25 * px[i][0] + 128) >> 8) + 16);
+                b += px[i][0];
+                g += px[i][1];
+                r += px[i][2];
+            }
+            b = (b + 2) / 4;
+            g = (g + 2) / 4;
+            r = (r + 2) / 4;
+            uv[x]     = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            uv[x + 1] = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+}
+
+static void publish_rows(void* ctx, int y0, int y1) {
+    const PublishJob* job = ctx;
+    if (job->nv12) {
+        bgra_to_nv12_rows(job, y0, y1);
+        return;
+    }
+    for (int y = y0; y < y1; y++)
+        memcpy(job->dst + job->dst_stride * y,
+               job->src + (ptrdiff_t)y * job->src_stride, (size_t)job->width * 4);
+}
+
+void shm_export_publish(const unsigned char* bgra, int stride, long long timestamp_us) {
+    CastrShmHeader* h = g_shm.header;
+    if (!h) return;
+
+    const uint64_t seq  = h->latest + 1;
+    CastrShmSlot*  slot = (CastrShmSlot*)(g_shm.ring.base + h->slot_offset +
+                                               (seq % h->slot_count) * h->slot_size);
+
+    // Odd while writing; readers that copied across this see the change.
+    atomic_store_i64((atomic_i64*)&slot->lock, (long long)(seq * 2 - 1));
+    atomic_fence();
+    slot->timestamp_us = timestamp_us;
+
+    PublishJob job = {
+        .src        = bgra,
+        .src_stride = stride,
+        .dst        = (unsigned char*)slot + CASTR_SHM_ALIGN,
+        .dst_stride = h->stride,
+        .width      = (int)h->width,
+        .height     = (int)h->height,
+        .nv12       = h->format == CASTR_SHM_NV12,
+    };
+    jobs_parallel_rows(job.height, 2, publish_rows, &job);
+
+    atomic_store_i64((atomic_i64*)&slot->lock, (long long)(seq * 2));
+    atomic_store_i64((atomic_i64*)&h->latest, (long long)seq);
+    g_shm.published++;
+}
+
+int shm_export_resize(int width, int height) {
+    CastrShmHeader* h = g_shm.header;
+    if (!h) return 1;
+    export_size(h->format == CASTR_SHM_NV12, &width, &height);
+    if ((int)h->width == width && (int)h->height == height) return 1;
+
+    // The old ring keeps its name until the last reader lets go of it, so
+    // the new one always takes the next generation.
+    const uint32_t next = h->generation + 1;
+    close_ring();
+    if (!open_ring(next, width, height)) {
+        log_warn("Shared memory export stopped at the resize to %dx%d", width, height);
+        shm_export_close();
+        return 0;
+    }
+    return 1;
+}
+
+void shm_export_close(void) {
+    if (!g_shm.dir) return;
+    if (g_shm.header)
+        close_ring();
+    atomic_store_i32((atomic_i32*)&g_shm.dir->closed, 1);
+    log_info("Shared memory export: %llu frames published", g_shm.published);
+    destroy_object(&g_shm.dir_object);
+    memset(&g_shm, 0, sizeof(g_shm));
+}
@@ -0,0 +1,492 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+#include "snapshot.h"
+#include "frame_alloc.h"
+#include "jobs.h"
+#include "logger.h"
+#include "threading.h"
+#include "utils.h"
+
+#define SNAPSHOT_FRAMES 2
+
+typedef enum {
+    FORMAT_UNKNOWN,
+    FORMAT_QOI,
+    FORMAT_PNG,
+    FORMAT_JPEG,
+} SnapshotFormat;
+
+// A copy of one canvas frame. `refs` is 0 while the encoder thread may
+// refill it; the queue holds a reference from the copy until the snapshot
+// thread has written the file.
+typedef struct {
+    atomic_i32  refs;
+    FrameBuffer fb;
+    long long   timestamp_us;
+    char        path[512];
+} SnapshotFrame;
+
+static struct {
+    SnapshotConfig cfg;
+    char           pattern[512];
+    unsigned       sequence;
+    long long      next_due_us;
+    char           requested[512];
+
+    SnapshotFrame  frames[SNAPSHOT_FRAMES];
+    SnapshotFrame* queue[SNAPSHOT_FRAMES];
+    int            head, count;
+    bool           running;
+    Mutex          lock;
+    Cond           ready;
+    Thread         thread;
+
+    // Snapshot thread
+    struct SwsContext* sws;
+    AVFrame*           converted;
+    AVCodecContext*    codec_ctx;
+    SnapshotFormat     codec_format;
+    int64_t            codec_pts;
+    AVPacket*          pkt;
+    uint8_t*           qoi;
+    size_t             qoi_capacity;
+
+    atomic_i64     written, dropped, failed;
+    atomic_i64     encode_us, encode_max_us;
+    atomic_i32     depth, depth_max; // queue length, for stats
+    long long      last_written, last_encode_us;
+} g_snap;
+
+static SnapshotFormat format_of(const char* path) {
+    const char* dot = strrchr(path, '.');
+    if (!dot) return FORMAT_UNKNOWN;
+    if (!strcmp(dot, ".qoi")) return FORMAT_QOI;
+    if (!strcmp(dot, ".png")) return FORMAT_PNG;
+    if (!strcmp(dot, ".jpg") || !strcmp(dot, ".jpeg")) return FORMAT_JPEG;
+    return FORMAT_UNKNOWN;
+}
+
+// Conversions in the pattern: "%%" or "%[0-9]*d", -1 for anything else.
+static int count_conversions(const char* path) {
+    int n = 0;
+    for (const char* p = path; *p; p++) {
+        if (*p != '%') continue;
+        if (p[1] == '%') {
+            p++;
+            continue;
+        }
+        p++;
+        while (*p >= '0' && *p <= '9') p++;
+        if (*p != 'd') return -1;
+        n++;
+    }
+    return n;
+}
+
+int snapshot_path_ok(const char* path) {
+    if (format_of(path) == FORMAT_UNKNOWN) {
+        log_error("Snapshot format not known from the extension: %s (use .qoi, .png or .jpg)", path);
+        return 0;
+    }
+    int n = count_conversions(path);
+    if (n < 0 || n > 1 || strlen(path) >= sizeof(g_snap.pattern)) {
+        log_error("Invalid snapshot path (at most one %%d counter): %s", path);
+        return 0;
+    }
+    return 1;
+}
+
+// QOI, 3 channels. https://qoiformat.org/qoi-specification.pdf
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+
+static uint8_t* put_be32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+    return p + 4;
+}
+
+static size_t qoi_encode(const uint8_t* rgb, int stride, int width, int height, uint8_t* out) {
+    uint8_t* p = out;
+    memcpy(p, "qoif", 4);
+    p = put_be32(p + 4, (uint32_t)width);
+    p = put_be32(p, (uint32_t)height);
+    *p++ = 3; // channels
+    *p++ = 0; // sRGB
+
+    uint8_t index[64][3] = {{0}};
+    uint8_t pr = 0, pg = 0, pb = 0;
+    int run = 0;
+    for (int y = 0; y < height; y++) {
+        const uint8_t* px = rgb + (ptrdiff_t)y * stride;
+        for (int x = 0; x < width; x++, px += 3) {
+            const uint8_t r = px[0], g = px[1], b = px[2];
+            if (r == pr && g == pg && b == pb) {
+                if (++run == 62) {
+                    *p++ = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+            if (run) {
+                *p++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            // Alpha is always 255: 255 * 11 in the hash.
+            const int slot = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+            if (index[slot][0] == r && index[slot][1] == g && index[slot][2] == b) {
+                *p++ = QOI_OP_INDEX | slot;
+            } else {
+                index[slot][0] = r;
+                index[slot][1] = g;
+                index[slot][2] = b;
+
+                const int dr = (int8_t)(r - pr), dg = (int8_t)(g - pg), db = (int8_t)(b - pb);
+                const int dr_dg = dr - dg, db_dg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    *p++ = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                           db_dg >= -8 && db_dg <= 7) {
+                    *p++ = QOI_OP_LUMA | (dg + 32);
+                    *p++ = (uint8_t)((dr_dg + 8) << 4 | (db_dg + 8));
+                } else {
+                    *p++ = QOI_OP_RGB;
+                    *p++ = r;
+                    *p++ = g;
+                    *p++ = b;
+                }
+            }
+            pr = r;
+            pg = g;
+            pb = b;
+        }
+    }
+    if (run)
+        *p++ = QOI_OP_RUN | (run - 1);
+
+    static const uint8_t end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    memcpy(p, end, sizeof(end));
+    return (size_t)(p + sizeof(end) - out);
+}
+
+// Written under a temporary name and renamed, so that anything watching a
+// fixed snapshot path never reads half an image.
+static int write_file(const char* path, const uint8_t* data, size_t size) {
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE* f = fopen(tmp, "wb");
+    if (!f) {
+        log_error("Cannot write snapshot %s", tmp);
+        return 0;
+    }
+    int ok = fwrite(data, 1, size, f) == size;
+    ok = fclose(f) == 0 && ok;
+#ifdef _WIN32
+    if (ok) remove(path);
+#endif
+    if (!ok || rename(tmp, path) != 0) {
+        log_error("Failed to write snapshot %s", path);
+        remove(tmp);
+        return 0;
+    }
+    return 1;
+}
+
+// PNG and MJPEG contexts are kept while the size and format stay the same.
+static int open_codec(SnapshotFormat format, int width, int height) {
+    AVCodecContext* ctx = g_snap.codec_ctx;
+    if (ctx && g_snap.codec_format == format && ctx->width == width && ctx->height == height)
+        return 1;
+    avcodec_free_context(&g_snap.codec_ctx);
+
+    const AVCodec* codec = avcodec_find_encoder(format == FORMAT_PNG ? AV_CODEC_ID_PNG
+                                                                     : AV_CODEC_ID_MJPEG);
+    if (!codec || !(ctx = avcodec_alloc_context3(codec))) {
+        log_error("No %s encoder in this libavcodec", format == FORMAT_PNG ? "PNG" : "JPEG");
+        return 0;
+    }
+    ctx->width     = width;
+    ctx->height    = height;
+    ctx->time_base = (AVRational){ 1, 25 };
+    if (format == FORMAT_PNG) {
+        ctx->pix_fmt           = AV_PIX_FMT_RGB24;
+        ctx->compression_level = 1; // zlib level; thumbnails favour speed
+    } else {
+        ctx->pix_fmt     = AV_PIX_FMT_YUVJ420P;
+        ctx->color_range = AVCOL_RANGE_JPEG;
+        ctx->flags      |= AV_CODEC_FLAG_QSCALE;
+    }
+    if (avcodec_open2(ctx, codec, NULL) < 0) {
+        log_error("Failed to open the %s encoder", codec->name);
+        avcodec_free_context(&ctx);
+        return 0;
+    }
+    g_snap.codec_ctx    = ctx;
+    g_snap.codec_format = format;
+    return 1;
+}
+
+static int encode_av(SnapshotFormat format, const char* path) {
+    AVFrame* f = g_snap.converted;
+    if (!open_codec(format, f->width, f->height)) return 0;
+
+    if (format == FORMAT_JPEG) {
+        // Quality 100 is qscale 2 (the best MJPEG goes), 1 is qscale 31.
+        const int qscale = 2 + (100 - g_snap.cfg.jpeg_quality) * 29 / 99;
+        f->quality = FF_QP2LAMBDA * qscale;
+    }
+    // Both encoders are intra-only without delay: each frame sent comes
+    // straight back as one packet, so the context stays usable.
+    f->pts = g_snap.codec_pts++;
+    int ok = avcodec_send_frame(g_snap.codec_ctx, f) >= 0 &&
+             avcodec_receive_packet(g_snap.codec_ctx, g_snap.pkt) >= 0;
+    if (ok) {
+        ok = write_file(path, g_snap.pkt->data, (size_t)g_snap.pkt->size);
+        av_packet_unref(g_snap.pkt);
+    } else {
+        log_error("Failed to encode snapshot %s", path);
+        avcodec_free_context(&g_snap.codec_ctx);
+    }
+    return ok;
+}
+
+static int write_snapshot(const SnapshotFrame* frame) {
+    const SnapshotFormat format = format_of(frame->path);
+    const int out_w = g_snap.cfg.width  > 0 ? g_snap.cfg.width  : frame->fb.width;
+    const int out_h = g_snap.cfg.height > 0 ? g_snap.cfg.height : frame->fb.height;
+    const enum AVPixelFormat pix_fmt = format == FORMAT_JPEG ? AV_PIX_FMT_YUVJ420P
+                                                             : AV_PIX_FMT_RGB24;
+
+    AVFrame* f = g_snap.converted;
+    if (!f || f->width != out_w || f->height != out_h || f->format != pix_fmt) {
+        av_frame_free(&g_snap.converted);
+        f = av_frame_alloc();
+        if (!f) return 0;
+        f->width  = out_w;
+        f->height = out_h;
+        f->format = pix_fmt;
+        if (av_frame_get_buffer(f, 0) < 0) {
+            av_frame_free(&f);
+            return 0;
+        }
+        g_snap.converted = f;
+    }
+
+    // Scaled and converted in one pass; area averaging for thumbnails.
+    const int flags = out_w < frame->fb.width ? SWS_AREA : SWS_BILINEAR;
+    g_snap.sws = sws_getCachedContext(g_snap.sws, frame->fb.width, frame->fb.height,
+                                      AV_PIX_FMT_BGRA, out_w, out_h, pix_fmt, flags,
+                                      NULL, NULL, NULL);
+    if (!g_snap.sws) {
+        log_error("No conversion for a %dx%d snapshot", out_w, out_h);
+        return 0;
+    }
+    const uint8_t* src[4] = { frame->fb.data };
+    const int src_stride[4] = { frame->fb.stride };
+    sws_scale(g_snap.sws, src, src_stride, 0, frame->fb.height, f->data, f->linesize);
+
+    if (format != FORMAT_QOI)
+        return encode_av(format, frame->path);
+
+    const size_t worst = (size_t)out_w * out_h * 4 + 14 + 8;
+    if (worst > g_snap.qoi_capacity) {
+        free(g_snap.qoi);
+        g_snap.qoi = malloc(worst);
+        g_snap.qoi_capacity = g_snap.qoi ? worst : 0;
+        if (!g_snap.qoi) return 0;
+    }
+    size_t size = qoi_encode(f->data[0], f->linesize[0], out_w, out_h, g_snap.qoi);
+    return write_file(frame->path, g_snap.qoi, size);
+}
+
+static void frame_unref(SnapshotFrame* frame) {
+    atomic_add_i32(&frame->refs, -1);
+}
+
+static void snapshot_thread_func(void* arg) {
+    (void)arg;
+    for (;;) {
+        mutex_lock(&g_snap.lock);
+        while (!g_snap.count && g_snap.running)
+            cond_wait(&g_snap.ready, &g_snap.lock);
+        if (!g_snap.count) {
+            mutex_unlock(&g_snap.lock);
+            return;
+        }
+        SnapshotFrame* frame = g_snap.queue[g_snap.head];
+        g_snap.head = (g_snap.head + 1) % SNAPSHOT_FRAMES;
+        g_snap.count--;
+        atomic_store_i32(&g_snap.depth, g_snap.count);
+        mutex_unlock(&g_snap.lock);
+
+        long long start = time_now_us();
+        if (write_snapshot(frame))
+            atomic_add_i64(&g_snap.written, 1);
+        else
+            atomic_add_i64(&g_snap.failed, 1);
+        long long elapsed = time_now_us() - start;
+        atomic_add_i64(&g_snap.encode_us, elapsed);
+        if (elapsed > atomic_load_i64(&g_snap.encode_max_us))
+            atomic_store_i64(&g_snap.encode_max_us, elapsed);
+        frame_unref(frame);
+    }
+}
+
+int snapshot_start(const SnapshotConfig* cfg, int width, int height) {
+    memset(&g_snap, 0, sizeof(g_snap));
+    g_snap.cfg = *cfg;
+    if (cfg->path) {
+        snprintf(g_snap.pattern, sizeof(g_snap.pattern), "%s", cfg->path);
+    }
+
+    // Allocated (and pre-faulted) now when snapshots are periodic, so the
+    // first one costs the encoder thread no more than a copy.
+    for (int i = 0; i < SNAPSHOT_FRAMES && width > 0; i++) {
+        if (!frame_alloc(&g_snap.frames[i].fb, width, height)) {
+            for (int j = 0; j < i; j++)
+                frame_free(&g_snap.frames[j].fb);
+            return 0;
+        }
+    }
+
+    g_snap.pkt = av_packet_alloc();
+    mutex_init(&g_snap.lock);
+    cond_init(&g_snap.ready);
+    g_snap.running = true;
+    if (!g_snap.pkt || !thread_create(&g_snap.thread, snapshot_thread_func, NULL)) {
+        log_error("Failed to start snapshot thread");
+        g_snap.running = false;
+        av_packet_free(&g_snap.pkt);
+        for (int i = 0; i < SNAPSHOT_FRAMES; i++)
+            frame_free(&g_snap.frames[i].fb);
+        mutex_destroy(&g_snap.lock);
+        cond_destroy(&g_snap.ready);
+        return 0;
+    }
+    return 1;
+}
+
+void snapshot_request(const char* path) {
+    if (!g_snap.running) return;
+    snprintf(g_snap.requested, sizeof(g_snap.requested), "%s", path);
+}
+
+typedef struct {
+    const unsigned char* src;
+    int                  src_stride;
+    FrameBuffer*         dst;
+} CopyJob;
+
+static void copy_rows(void* ctx, int y0, int y1) {
+    const CopyJob* job = ctx;
+    for (int y = y0; y < y1; y++)
+        memcpy(job->dst->data + (size_t)job->dst->stride * y,
+               job->src + (ptrdiff_t)y * job->src_stride, (size_t)job->dst->width * 4);
+}
+
+void snapshot_offer(const unsigned char* bgra, int stride, int width, int height,
+                    long long timestamp_us) {
+    if (!g_snap.running) return;
+
+    const char* pattern;
+    if (g_snap.requested[0]) {
+        pattern = g_snap.requested;
+    } else if (g_snap.pattern[0] && g_snap.cfg.interval_sec > 0 &&
+               timestamp_us >= g_snap.next_due_us) {
+        const long long interval = (long long)(g_snap.cfg.interval_sec * 1000000.0);
+        g_snap.next_due_us = g_snap.next_due_us ? g_snap.next_due_us + interval
+                                                : timestamp_us + interval;
+        if (g_snap.next_due_us <= timestamp_us)
+            g_snap.next_due_us = timestamp_us + interval;
+        pattern = g_snap.pattern;
+    } else {
+        return;
+    }
+    // snapshot_path_ok allowed at most one %d, which takes the counter.
+    char path[512];
+    snprintf(path, sizeof(path), pattern, ++g_snap.sequence);
+    g_snap.requested[0] = '\0';
+
+    SnapshotFrame* frame = NULL;
+    for (int i = 0; i < SNAPSHOT_FRAMES && !frame; i++)
+        if (atomic_load_i32(&g_snap.frames[i].refs) == 0)
+            frame = &g_snap.frames[i];
+    if (!frame) {
+        atomic_add_i64(&g_snap.dropped, 1);
+        return;
+    }
+    if (frame->fb.width != width || frame->fb.height != height) {
+        frame_free(&frame->fb);
+        if (!frame_alloc(&frame->fb, width, height)) {
+            atomic_add_i64(&g_snap.dropped, 1);
+            return;
+        }
+    }
+
+    CopyJob job = { bgra, stride, &frame->fb };
+    jobs_parallel_rows(height, 1, copy_rows, &job);
+    frame->timestamp_us = timestamp_us;
+    memcpy(frame->path, path, sizeof(frame->path));
+    atomic_store_i32(&frame->refs, 1);
+
+    mutex_lock(&g_snap.lock);
+    g_snap.queue[(g_snap.head + g_snap.count) % SNAPSHOT_FRAMES] = frame;
+    g_snap.count++;
+    atomic_store_i32(&g_snap.depth, g_snap.count);
+    if (g_snap.count > atomic_load_i32(&g_snap.depth_max))
+        atomic_store_i32(&g_snap.depth_max, g_snap.count);
+    cond_signal(&g_snap.ready);
+    mutex_unlock(&g_snap.lock);
+}
+
+void snapshot_log_stats(void) {
+    if (!g_snap.running) return;
+
+    const long long written   = atomic_load_i64(&g_snap.written);
+    const long long encode_us = atomic_load_i64(&g_snap.encode_us);
+    log_info("Snapshots: %lld written, %lld dropped, %lld failed, %.1f ms to encode (max %.1f), "
+             "queue %d (max %d)",
+             written, atomic_load_i64(&g_snap.dropped), atomic_load_i64(&g_snap.failed),
+             written > g_snap.last_written
+                 ? (encode_us - g_snap.last_encode_us) / 1000.0 / (written - g_snap.last_written)
+                 : 0.0,
+             atomic_load_i64(&g_snap.encode_max_us) / 1000.0,
+             atomic_load_i32(&g_snap.depth), atomic_load_i32(&g_snap.depth_max));
+    g_snap.last_written   = written;
+    g_snap.last_encode_us = encode_us;
+}
+
+void snapshot_stop(void) {
+    if (!g_snap.running) return;
+
+    mutex_lock(&g_snap.lock);
+    g_snap.running = false;
+    cond_signal(&g_snap.ready);
+    mutex_unlock(&g_snap.lock);
+    thread_join(g_snap.thread);
+
+    log_info("Snapshots: %lld written, %lld dropped, %lld failed",
+             atomic_load_i64(&g_snap.written), atomic_load_i64(&g_snap.dropped),
+             atomic_load_i64(&g_snap.failed));
+
+    sws_freeContext(g_snap.sws);
+    av_frame_free(&g_snap.converted);
+    avcodec_free_context(&g_snap.codec_ctx);
+    av_packet_free(&g_snap.pkt);
+    free(g_snap.qoi);
+    for (int i = 0; i < SNAPSHOT_FRAMES; i++)
+        frame_free(&g_snap.frames[i].fb);
+    cond_destroy(&g_snap.ready);
+    mutex_destroy(&g_snap.lock);
+    memset(&g_snap, 0, sizeof(g_snap));
+}
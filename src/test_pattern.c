@@ -0,0 +1,87 @@
+#include <stdbool.h>
+#include <string.h>
+#include "test_pattern.h"
+
+#define STAMP_BITS (TEST_STAMP_COLS * TEST_STAMP_ROWS)
+
+static uint16_t stamp_check(uint32_t id, uint64_t ts) {
+    uint64_t h = (uint64_t)id * 0x9E3779B97F4A7C15ull ^ ts * 0xC2B2AE3D27D4EB4Full;
+    return (uint16_t)(h ^ h >> 16 ^ h >> 32 ^ h >> 48);
+}
+
+static void stamp_bits(unsigned char bits[STAMP_BITS], uint32_t id, uint64_t ts) {
+    uint16_t check = stamp_check(id, ts);
+    int n = 0;
+    for (int i = 31; i >= 0; i--) bits[n++] = (id >> i) & 1;
+    for (int i = TEST_STAMP_TS_BITS - 1; i >= 0; i--) bits[n++] = (ts >> i) & 1;
+    for (int i = 15; i >= 0; i--) bits[n++] = (check >> i) & 1;
+}
+
+// Cell edges in pixels for a frame of `width`; shared by draw and read so
+// both agree after rescaling.
+static int cell_edge(int i, int width) {
+    return (int)((long long)i * width / 32);
+}
+
+void test_pattern_draw(unsigned char* bgra, int stride, int width, int height,
+                       uint32_t frame_id, long long timestamp_us) {
+    // Smooth gradients plus a moving bar: easy enough on the encoder that
+    // PSNR reflects the pipeline rather than the content.
+    const int bar_w = width / 16 > 0 ? width / 16 : 1;
+    const int bar_x = (int)((frame_id * 8u) % (unsigned)width);
+    for (int y = 0; y < height; y++) {
+        unsigned char* row = bgra + (long long)y * stride;
+        const unsigned char g = (unsigned char)(y * 255 / (height > 1 ? height - 1 : 1));
+        for (int x = 0; x < width; x++) {
+            bool bar = x >= bar_x && x < bar_x + bar_w;
+            row[x * 4 + 0] = (unsigned char)((x + y) / 4 + frame_id * 2);
+            row[x * 4 + 1] = bar ? 255 : g;
+            row[x * 4 + 2] = (unsigned char)(x * 255 / (width > 1 ? width - 1 : 1));
+            row[x * 4 + 3] = 255;
+        }
+    }
+
+    unsigned char bits[STAMP_BITS];
+    stamp_bits(bits, frame_id, (uint64_t)timestamp_us & ((1ull << TEST_STAMP_TS_BITS) - 1));
+    for (int r = 0; r < TEST_STAMP_ROWS; r++) {
+        for (int c = 0; c < TEST_STAMP_COLS; c++) {
+            const unsigned char v = bits[r * TEST_STAMP_COLS + c] ? 255 : 0;
+            const int x0 = cell_edge(c, width), x1 = cell_edge(c + 1, width);
+            const int y0 = cell_edge(r, width), y1 = cell_edge(r + 1, width);
+            for (int y = y0; y < y1 && y < height; y++)
+                memset(bgra + (long long)y * stride + x0 * 4, v, (size_t)(x1 - x0) * 4);
+        }
+    }
+}
+
+int test_pattern_read(const unsigned char* luma, int linesize, int width, int height,
+                      uint32_t* frame_id, long long* timestamp48) {
+    unsigned char bits[STAMP_BITS];
+    for (int r = 0; r < TEST_STAMP_ROWS; r++) {
+        for (int c = 0; c < TEST_STAMP_COLS; c++) {
+            // Average the middle half of the cell, away from blurred edges.
+            const int x0 = cell_edge(c, width), x1 = cell_edge(c + 1, width);
+            const int y0 = cell_edge(r, width), y1 = cell_edge(r + 1, width);
+            const int qx = (x1 - x0) / 4, qy = (y1 - y0) / 4;
+            int sum = 0, count = 0;
+            for (int y = y0 + qy; y < y1 - qy && y < height; y++)
+                for (int x = x0 + qx; x < x1 - qx; x++, count++)
+                    sum += luma[(long long)y * linesize + x];
+            if (!count) return 0;
+            bits[r * TEST_STAMP_COLS + c] = sum / count >= 128;
+        }
+    }
+
+    uint32_t id = 0;
+    uint64_t ts = 0;
+    uint16_t check = 0;
+    int n = 0;
+    for (int i = 0; i < 32; i++) id = id << 1 | bits[n++];
+    for (int i = 0; i < TEST_STAMP_TS_BITS; i++) ts = ts << 1 | bits[n++];
+    for (int i = 0; i < 16; i++) check = (uint16_t)(check << 1 | bits[n++]);
+    if (check != stamp_check(id, ts)) return 0;
+
+    *frame_id    = id;
+    *timestamp48 = (long long)ts;
+    return 1;
+}
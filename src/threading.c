@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <string.h>
+#include "threading.h"
+#include "logger.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#define HIGH_PRIORITY_NICE -10
+
+typedef struct {
+    ThreadFunc fn;
+    void*      arg;
+} ThreadStart;
+
+#ifdef _WIN32
+static unsigned __stdcall thread_main(void* p) {
+    ThreadStart start = *(ThreadStart*)p;
+    free(p);
+    start.fn(start.arg);
+    return 0;
+}
+
+int thread_create(Thread* thread, ThreadFunc fn, void* arg) {
+    ThreadStart* start = malloc(sizeof(ThreadStart));
+    if (!start) return 0;
+    start->fn  = fn;
+    start->arg = arg;
+
+    unsigned tid;
+    *thread = (Thread)_beginthreadex(NULL, 0, thread_main, start, 0, &tid);
+    if (!*thread) {
+        free(start);
+        return 0;
+    }
+    return 1;
+}
+
+void thread_join(Thread thread) {
+    WaitForSingleObject((HANDLE)thread, INFINITE);
+    CloseHandle((HANDLE)thread);
+}
+
+void thread_yield(void) {
+    SwitchToThread();
+}
+
+int thread_set_affinity(int cpu) {
+    if (cpu < 0 || cpu >= (int)(sizeof(DWORD_PTR) * 8) ||
+        !SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu)) {
+        log_warn("Could not pin thread to CPU %d (error %lu)", cpu, GetLastError());
+        return 0;
+    }
+    return 1;
+}
+
+int thread_set_priority(ThreadPriority priority) {
+    int level = priority == THREAD_PRIO_REALTIME ? THREAD_PRIORITY_TIME_CRITICAL :
+                priority == THREAD_PRIO_HIGH     ? THREAD_PRIORITY_HIGHEST :
+                                                   THREAD_PRIORITY_NORMAL;
+    if (!SetThreadPriority(GetCurrentThread(), level)) {
+        log_warn("Could not set thread priority (error %lu)", GetLastError());
+        return 0;
+    }
+    return 1;
+}
+
+int cpu_count(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+}
+
+void mutex_init(Mutex* m)    { InitializeSRWLock((PSRWLOCK)&m->impl); }
+void mutex_destroy(Mutex* m) { (void)m; }
+void mutex_lock(Mutex* m)    { AcquireSRWLockExclusive((PSRWLOCK)&m->impl); }
+void mutex_unlock(Mutex* m)  { ReleaseSRWLockExclusive((PSRWLOCK)&m->impl); }
+
+void cond_init(Cond* c)      { InitializeConditionVariable((PCONDITION_VARIABLE)&c->impl); }
+void cond_destroy(Cond* c)   { (void)c; }
+void cond_signal(Cond* c)    { WakeConditionVariable((PCONDITION_VARIABLE)&c->impl); }
+void cond_broadcast(Cond* c) { WakeAllConditionVariable((PCONDITION_VARIABLE)&c->impl); }
+
+void cond_wait(Cond* c, Mutex* m) {
+    SleepConditionVariableSRW((PCONDITION_VARIABLE)&c->impl, (PSRWLOCK)&m->impl, INFINITE, 0);
+}
+#else
+static void* thread_main(void* p) {
+    ThreadStart start = *(ThreadStart*)p;
+    free(p);
+    start.fn(start.arg);
+    return NULL;
+}
+
+int thread_create(Thread* thread, ThreadFunc fn, void* arg) {
+    ThreadStart* start = malloc(sizeof(ThreadStart));
+    if (!start) return 0;
+    start->fn  = fn;
+    start->arg = arg;
+
+    if (pthread_create(thread, NULL, thread_main, start) != 0) {
+        free(start);
+        return 0;
+    }
+    return 1;
+}
+
+void thread_join(Thread thread) {
+    pthread_join(thread, NULL);
+}
+
+void thread_yield(void) {
+    sched_yield();
+}
+
+int thread_set_affinity(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    int err = cpu >= 0 && cpu < CPU_SETSIZE
+        ? pthread_setaffinity_np(pthread_self(), sizeof(set), &set) : EINVAL;
+    if (err) {
+        log_warn("Could not pin thread to CPU %d: %s", cpu, strerror(err));
+        return 0;
+    }
+    return 1;
+#else
+    log_warn("Could not pin thread to CPU %d: not supported", cpu);
+    return 0;
+#endif
+}
+
+int thread_set_priority(ThreadPriority priority) {
+    int err = 0;
+    if (priority == THREAD_PRIO_REALTIME) {
+        struct sched_param param = { .sched_priority = sched_get_priority_min(SCHED_FIFO) };
+        err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    } else {
+        struct sched_param param = { .sched_priority = 0 };
+        err = pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+#ifdef __linux__
+        // Linux applies nice values per thread when given a thread ID.
+        pid_t tid = (pid_t)syscall(SYS_gettid);
+        if (!err && setpriority(PRIO_PROCESS, (id_t)tid,
+                                priority == THREAD_PRIO_HIGH ? HIGH_PRIORITY_NICE : 0) != 0)
+            err = errno;
+#endif
+    }
+    if (err) {
+        log_warn("Could not set thread priority: %s", strerror(err));
+        return 0;
+    }
+    return 1;
+}
+
+int cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+void mutex_init(Mutex* m)    { pthread_mutex_init(m, NULL); }
+void mutex_destroy(Mutex* m) { pthread_mutex_destroy(m); }
+void mutex_lock(Mutex* m)    { pthread_mutex_lock(m); }
+void mutex_unlock(Mutex* m)  { pthread_mutex_unlock(m); }
+
+void cond_init(Cond* c)           { pthread_cond_init(c, NULL); }
+void cond_destroy(Cond* c)        { pthread_cond_destroy(c); }
+void cond_wait(Cond* c, Mutex* m) { pthread_cond_wait(c, m); }
+void cond_signal(Cond* c)         { pthread_cond_signal(c); }
+void cond_broadcast(Cond* c)      { pthread_cond_broadcast(c); }
+#endif
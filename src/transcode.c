@@ -0,0 +1,609 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/audio_fifo.h>
+#include <libavutil/opt.h>
+#include <libswscale/swscale.h>
+#include "transcode.h"
+#include "jobs.h"
+#include "logger.h"
+#include "utils.h"
+
+#define TRANSCODE_MAX_SEGMENTS 256
+#define TRANSCODE_MIN_SEGMENT  2.0 // seconds; shorter segments waste keyframes
+#define TRANSCODE_PATH_MAX     1024
+
+// Segment i covers video pts [bounds[i], bounds[i + 1]). Every bound is a
+// keyframe in the input, so each segment decodes on its own.
+typedef struct {
+    const TranscodeConfig *cfg;
+    int64_t bounds[TRANSCODE_MAX_SEGMENTS + 1];
+    int     count;
+    bool    has_audio;
+    int     encoder_threads;
+    char    paths[TRANSCODE_MAX_SEGMENTS + 1][TRANSCODE_PATH_MAX]; // last is audio
+    int     ok[TRANSCODE_MAX_SEGMENTS + 1];
+} TranscodePlan;
+
+typedef struct {
+    AVFormatContext *fmt;
+    AVCodecContext  *enc;
+    AVStream        *stream;
+    AVPacket        *pkt;
+    bool             started;
+} SegmentOutput;
+
+static AVFormatContext *open_input(const char *path, int *video, int *audio) {
+    AVFormatContext *in = NULL;
+    if (avformat_open_input(&in, path, NULL, NULL) < 0) {
+        log_error("Could not open %s", path);
+        return NULL;
+    }
+    if (avformat_find_stream_info(in, NULL) < 0) {
+        log_error("Could not read stream info from %s", path);
+        avformat_close_input(&in);
+        return NULL;
+    }
+    *video = av_find_best_stream(in, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (audio)
+        *audio = av_find_best_stream(in, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    return in;
+}
+
+// Only `keep` is demuxed; the rest of the file is skipped.
+static void discard_others(AVFormatContext *in, int keep) {
+    for (unsigned i = 0; i < in->nb_streams; i++)
+        in->streams[i]->discard = (int)i == keep ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+}
+
+static AVCodecContext *open_decoder(const AVStream *st) {
+    const AVCodec *codec = avcodec_find_decoder(st->codecpar->codec_id);
+    if (!codec) return NULL;
+    AVCodecContext *ctx = avcodec_alloc_context3(codec);
+    if (!ctx) return NULL;
+    if (avcodec_parameters_to_context(ctx, st->codecpar) < 0) {
+        avcodec_free_context(&ctx);
+        return NULL;
+    }
+    ctx->pkt_timebase = st->time_base;
+    ctx->thread_count = 1;
+    if (avcodec_open2(ctx, codec, NULL) < 0)
+        avcodec_free_context(&ctx);
+    return ctx;
+}
+
+static int begin_output(SegmentOutput *out, const char *path) {
+    avformat_alloc_output_context2(&out->fmt, NULL, NULL, path);
+    out->pkt = av_packet_alloc();
+    return out->fmt && out->pkt;
+}
+
+static int start_output(SegmentOutput *out, const char *path) {
+    out->stream = avformat_new_stream(out->fmt, NULL);
+    if (!out->stream) return 0;
+    avcodec_parameters_from_context(out->stream->codecpar, out->enc);
+    out->stream->time_base = out->enc->time_base;
+
+    if (!(out->fmt->oformat->flags & AVFMT_NOFILE) &&
+        avio_open(&out->fmt->pb, path, AVIO_FLAG_WRITE) < 0) {
+        log_error("Could not open file: %s", path);
+        return 0;
+    }
+    out->started = avformat_write_header(out->fmt, NULL) >= 0;
+    return out->started;
+}
+
+static int drain(SegmentOutput *out) {
+    int ret;
+    while ((ret = avcodec_receive_packet(out->enc, out->pkt)) >= 0) {
+        av_packet_rescale_ts(out->pkt, out->enc->time_base, out->stream->time_base);
+        out->pkt->stream_index = out->stream->index;
+        if (av_interleaved_write_frame(out->fmt, out->pkt) < 0) return 0;
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF;
+}
+
+static void close_output(SegmentOutput *out, bool ok) {
+    if (out->started && ok) av_write_trailer(out->fmt);
+    if (out->fmt && !(out->fmt->oformat->flags & AVFMT_NOFILE))
+        avio_closep(&out->fmt->pb);
+    avformat_free_context(out->fmt);
+    avcodec_free_context(&out->enc);
+    av_packet_free(&out->pkt);
+}
+
+static AVCodecContext *open_video_encoder(const TranscodePlan *plan, const AVCodecContext *dec,
+                                          AVRational time_base, AVRational fps,
+                                          bool global_header) {
+    const TranscodeConfig *cfg = plan->cfg;
+    const AVCodec *codec = avcodec_find_encoder_by_name(cfg->codec);
+    if (!codec) {
+        log_error("Codec %s not found", cfg->codec);
+        return NULL;
+    }
+
+    AVCodecContext *ctx = avcodec_alloc_context3(codec);
+    if (!ctx) return NULL;
+    ctx->width = dec->width;
+    ctx->height = dec->height;
+    ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    ctx->time_base = time_base;
+    ctx->framerate = fps;
+    ctx->gop_size = cfg->gop;
+    ctx->thread_count = plan->encoder_threads;
+    if (global_header)
+        ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    AVDictionary *opts = NULL;
+    if (cfg->preset)
+        av_dict_set(&opts, "preset", cfg->preset, 0);
+    if (cfg->bitrate_kbps > 0) {
+        ctx->bit_rate = (int64_t)cfg->bitrate_kbps * 1000;
+        ctx->rc_max_rate = ctx->bit_rate;
+        ctx->rc_buffer_size = (int)(ctx->bit_rate * 2);
+    } else {
+        av_dict_set_int(&opts, "crf", cfg->crf, 0);
+    }
+    // The joined stream only carries the first segment's header, so every
+    // segment repeats its parameter sets in-band.
+    if (av_opt_find(ctx->priv_data, "x264-params", NULL, 0, 0))
+        av_dict_set(&opts, "x264-params", "repeat-headers=1", 0);
+
+    int ret = avcodec_open2(ctx, codec, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        log_error("Could not open codec %s", cfg->codec);
+        avcodec_free_context(&ctx);
+    }
+    return ctx;
+}
+
+static int encode_video_segment(TranscodePlan *plan, int index) {
+    const int64_t start = plan->bounds[index], end = plan->bounds[index + 1];
+    const char *path = plan->paths[index];
+    SegmentOutput out = {0};
+    AVCodecContext *dec = NULL;
+    AVFrame *frame = av_frame_alloc(), *yuv = NULL;
+    AVPacket *pkt = av_packet_alloc();
+    struct SwsContext *sws = NULL;
+    bool reading = true;
+    int vi, ok = 0;
+
+    AVFormatContext *in = open_input(plan->cfg->input, &vi, NULL);
+    if (!in || !frame || !pkt) goto done;
+    AVStream *st = in->streams[vi];
+    discard_others(in, vi);
+
+    dec = open_decoder(st);
+    if (!dec || !begin_output(&out, path)) goto done;
+    out.enc = open_video_encoder(plan, dec, st->time_base, av_guess_frame_rate(in, st, NULL),
+                                 out.fmt->oformat->flags & AVFMT_GLOBALHEADER);
+    if (!out.enc || !start_output(&out, path)) goto done;
+
+    if (dec->pix_fmt != AV_PIX_FMT_YUV420P) {
+        sws = sws_getContext(dec->width, dec->height, dec->pix_fmt,
+                             dec->width, dec->height, AV_PIX_FMT_YUV420P,
+                             SWS_POINT, NULL, NULL, NULL);
+        yuv = av_frame_alloc();
+        if (!sws || !yuv) goto done;
+        yuv->format = AV_PIX_FMT_YUV420P;
+        yuv->width = dec->width;
+        yuv->height = dec->height;
+        if (av_frame_get_buffer(yuv, 0) < 0) goto done;
+    }
+
+    if (av_seek_frame(in, vi, start, AVSEEK_FLAG_BACKWARD) < 0) {
+        log_error("Segment %d: seek failed", index);
+        goto done;
+    }
+
+    while (reading) {
+        if (av_read_frame(in, pkt) < 0) {
+            avcodec_send_packet(dec, NULL);
+            reading = false;
+        } else if (pkt->stream_index != vi) {
+            av_packet_unref(pkt);
+            continue;
+        } else if (pkt->pts != AV_NOPTS_VALUE && pkt->pts >= end) {
+            av_packet_unref(pkt);
+            avcodec_send_packet(dec, NULL);
+            reading = false;
+        } else {
+            avcodec_send_packet(dec, pkt);
+            av_packet_unref(pkt);
+        }
+
+        while (avcodec_receive_frame(dec, frame) >= 0) {
+            int64_t pts = frame->best_effort_timestamp;
+            if (pts >= start && pts < end) {
+                AVFrame *src = frame;
+                if (sws) {
+                    if (av_frame_make_writable(yuv) < 0) goto done;
+                    sws_scale(sws, (const uint8_t *const *)frame->data, frame->linesize,
+                              0, dec->height, yuv->data, yuv->linesize);
+                    src = yuv;
+                }
+                src->pts = pts;
+                src->pict_type = AV_PICTURE_TYPE_NONE;
+                if (avcodec_send_frame(out.enc, src) < 0 || !drain(&out)) goto done;
+            }
+            av_frame_unref(frame);
+        }
+    }
+
+    avcodec_send_frame(out.enc, NULL);
+    ok = drain(&out);
+
+done:
+    close_output(&out, ok);
+    sws_freeContext(sws);
+    av_frame_free(&yuv);
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    avcodec_free_context(&dec);
+    avformat_close_input(&in);
+    if (!ok) log_error("Segment %d failed", index);
+    return ok;
+}
+
+static float sample_get(const AVFrame *f, int ch, int i, int channels) {
+    switch (f->format) {
+    case AV_SAMPLE_FMT_S16:  return ((const int16_t *)f->data[0])[i * channels + ch] / 32768.0f;
+    case AV_SAMPLE_FMT_S16P: return ((const int16_t *)f->extended_data[ch])[i] / 32768.0f;
+    case AV_SAMPLE_FMT_FLT:  return ((const float *)f->data[0])[i * channels + ch];
+    case AV_SAMPLE_FMT_FLTP: return ((const float *)f->extended_data[ch])[i];
+    default:                 return 0.0f;
+    }
+}
+
+static void sample_put(AVFrame *f, int ch, int i, int channels, float v) {
+    float s = v * 32767.0f;
+    int16_t s16 = (int16_t)(s > 32767.0f ? 32767 : s < -32768.0f ? -32768 : s);
+    switch (f->format) {
+    case AV_SAMPLE_FMT_S16:  ((int16_t *)f->data[0])[i * channels + ch] = s16; break;
+    case AV_SAMPLE_FMT_S16P: ((int16_t *)f->extended_data[ch])[i] = s16; break;
+    case AV_SAMPLE_FMT_FLT:  ((float *)f->data[0])[i * channels + ch] = v; break;
+    case AV_SAMPLE_FMT_FLTP: ((float *)f->extended_data[ch])[i] = v; break;
+    default: break;
+    }
+}
+
+static bool sample_fmt_supported(int fmt) {
+    return fmt == AV_SAMPLE_FMT_S16 || fmt == AV_SAMPLE_FMT_S16P ||
+           fmt == AV_SAMPLE_FMT_FLT || fmt == AV_SAMPLE_FMT_FLTP;
+}
+
+// Converts a decoded frame into the encoder's sample format in `dst`,
+// growing it as needed. castr writes s16 or float, so no resampler is needed.
+static int convert_samples(const AVFrame *src, AVFrame *dst, const AVCodecContext *enc) {
+    if (dst->nb_samples < src->nb_samples || !dst->data[0]) {
+        av_frame_unref(dst);
+        dst->format = enc->sample_fmt;
+        dst->nb_samples = src->nb_samples;
+        av_channel_layout_copy(&dst->ch_layout, &enc->ch_layout);
+        if (av_frame_get_buffer(dst, 0) < 0) return 0;
+    }
+    const int channels = enc->ch_layout.nb_channels;
+    for (int i = 0; i < src->nb_samples; i++)
+        for (int c = 0; c < channels; c++)
+            sample_put(dst, c, i, channels, sample_get(src, c, i, channels));
+    return 1;
+}
+
+static int send_audio(SegmentOutput *out, AVAudioFifo *fifo, AVFrame *chunk,
+                      int samples, int64_t *next_pts) {
+    chunk->nb_samples = samples;
+    if (av_frame_make_writable(chunk) < 0 ||
+        av_audio_fifo_read(fifo, (void **)chunk->data, samples) < samples)
+        return 0;
+    chunk->pts = *next_pts;
+    *next_pts += samples;
+    return avcodec_send_frame(out->enc, chunk) >= 0 && drain(out);
+}
+
+static int encode_audio_track(TranscodePlan *plan) {
+    const TranscodeConfig *cfg = plan->cfg;
+    const char *path = plan->paths[plan->count];
+    SegmentOutput out = {0};
+    AVCodecContext *dec = NULL;
+    AVFrame *frame = av_frame_alloc(), *conv = av_frame_alloc(), *chunk = av_frame_alloc();
+    AVPacket *pkt = av_packet_alloc();
+    AVAudioFifo *fifo = NULL;
+    int64_t next_pts = AV_NOPTS_VALUE;
+    bool reading = true;
+    int vi, ai, ok = 0;
+
+    AVFormatContext *in = open_input(cfg->input, &vi, &ai);
+    if (!in || ai < 0 || !frame || !conv || !chunk || !pkt) goto done;
+    AVStream *st = in->streams[ai];
+    discard_others(in, ai);
+
+    dec = open_decoder(st);
+    if (!dec || !sample_fmt_supported(dec->sample_fmt)) {
+        log_error("Unsupported audio in %s", cfg->input);
+        goto done;
+    }
+
+    const AVCodec *codec = avcodec_find_encoder_by_name(cfg->audio_codec);
+    if (!codec || !begin_output(&out, path)) {
+        log_error("Audio codec %s not found", cfg->audio_codec);
+        goto done;
+    }
+    out.enc = avcodec_alloc_context3(codec);
+    if (!out.enc) goto done;
+    out.enc->sample_rate = dec->sample_rate;
+    out.enc->time_base = (AVRational){1, dec->sample_rate};
+    out.enc->bit_rate = (int64_t)cfg->audio_bitrate_kbps * 1000;
+    out.enc->sample_fmt = codec->sample_fmts ? codec->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+    av_channel_layout_copy(&out.enc->ch_layout, &dec->ch_layout);
+    if (out.fmt->oformat->flags & AVFMT_GLOBALHEADER)
+        out.enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    if (!sample_fmt_supported(out.enc->sample_fmt) ||
+        avcodec_open2(out.enc, codec, NULL) < 0 || !start_output(&out, path)) {
+        log_error("Could not open audio codec %s", cfg->audio_codec);
+        goto done;
+    }
+
+    const int frame_size = out.enc->frame_size > 0 ? out.enc->frame_size : 1024;
+    fifo = av_audio_fifo_alloc(out.enc->sample_fmt, out.enc->ch_layout.nb_channels, frame_size * 2);
+    chunk->format = out.enc->sample_fmt;
+    chunk->nb_samples = frame_size;
+    chunk->sample_rate = out.enc->sample_rate;
+    av_channel_layout_copy(&chunk->ch_layout, &out.enc->ch_layout);
+    if (!fifo || av_frame_get_buffer(chunk, 0) < 0) goto done;
+
+    while (reading) {
+        if (av_read_frame(in, pkt) < 0) {
+            avcodec_send_packet(dec, NULL);
+            reading = false;
+        } else if (pkt->stream_index != ai) {
+            av_packet_unref(pkt);
+            continue;
+        } else {
+            avcodec_send_packet(dec, pkt);
+            av_packet_unref(pkt);
+        }
+
+        while (avcodec_receive_frame(dec, frame) >= 0) {
+            // Anchored once; the recorder already padded gaps with silence.
+            if (next_pts == AV_NOPTS_VALUE)
+                next_pts = av_rescale_q(frame->best_effort_timestamp, st->time_base,
+                                        out.enc->time_base);
+            if (!convert_samples(frame, conv, out.enc) ||
+                av_audio_fifo_write(fifo, (void **)conv->data, frame->nb_samples) < frame->nb_samples)
+                goto done;
+            av_frame_unref(frame);
+
+            while (av_audio_fifo_size(fifo) >= frame_size)
+                if (!send_audio(&out, fifo, chunk, frame_size, &next_pts)) goto done;
+        }
+    }
+
+    // The last frame may be short.
+    if (av_audio_fifo_size(fifo) > 0 &&
+        !send_audio(&out, fifo, chunk, av_audio_fifo_size(fifo), &next_pts))
+        goto done;
+    avcodec_send_frame(out.enc, NULL);
+    ok = drain(&out);
+
+done:
+    close_output(&out, ok);
+    if (fifo) av_audio_fifo_free(fifo);
+    av_frame_free(&frame);
+    av_frame_free(&conv);
+    av_frame_free(&chunk);
+    av_packet_free(&pkt);
+    avcodec_free_context(&dec);
+    avformat_close_input(&in);
+    if (!ok) log_error("Audio track failed");
+    return ok;
+}
+
+static void run_segment(void *ctx, int index) {
+    TranscodePlan *plan = ctx;
+    plan->ok[index] = index < plan->count ? encode_video_segment(plan, index)
+                                          : encode_audio_track(plan);
+}
+
+static int64_t first_keyframe(AVFormatContext *in, int vi, AVPacket *pkt) {
+    while (av_read_frame(in, pkt) >= 0) {
+        bool key = pkt->stream_index == vi && (pkt->flags & AV_PKT_FLAG_KEY);
+        int64_t pts = pkt->pts;
+        av_packet_unref(pkt);
+        if (key && pts != AV_NOPTS_VALUE) return pts;
+    }
+    return AV_NOPTS_VALUE;
+}
+
+// Seeks to evenly spaced targets and snaps each to the keyframe at or before
+// it, so neighbouring segments agree on their shared boundary.
+static int plan_segments(TranscodePlan *plan) {
+    const TranscodeConfig *cfg = plan->cfg;
+    int vi, ai;
+    AVFormatContext *in = open_input(cfg->input, &vi, &ai);
+    if (!in) return 0;
+    if (vi < 0) {
+        log_error("No video stream in %s", cfg->input);
+        avformat_close_input(&in);
+        return 0;
+    }
+    plan->has_audio = ai >= 0 && cfg->audio_codec;
+
+    AVStream *st = in->streams[vi];
+    double duration = in->duration != AV_NOPTS_VALUE ? in->duration / (double)AV_TIME_BASE : 0.0;
+    int workers = jobs_worker_count() + 1;
+
+    // Two segments per worker keeps everyone busy when segment costs vary.
+    double seg = cfg->segment_sec > 0 ? cfg->segment_sec
+               : duration > 0 ? duration / (workers * 2) : 10.0;
+    if (seg < TRANSCODE_MIN_SEGMENT) seg = TRANSCODE_MIN_SEGMENT;
+    int targets = duration > 0 ? (int)ceil(duration / seg) : 1;
+    if (targets > TRANSCODE_MAX_SEGMENTS) targets = TRANSCODE_MAX_SEGMENTS;
+
+    int64_t start = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+    AVPacket *pkt = av_packet_alloc();
+    plan->count = 0;
+    for (int k = 0; pkt && k < targets; k++) {
+        int64_t ts = start + av_rescale_q((int64_t)(k * seg * AV_TIME_BASE),
+                                          AV_TIME_BASE_Q, st->time_base);
+        if (av_seek_frame(in, vi, ts, AVSEEK_FLAG_BACKWARD) < 0) break;
+        int64_t key = first_keyframe(in, vi, pkt);
+        if (key == AV_NOPTS_VALUE) break;
+        if (plan->count == 0 || key > plan->bounds[plan->count - 1])
+            plan->bounds[plan->count++] = key;
+    }
+    plan->bounds[plan->count] = INT64_MAX;
+    av_packet_free(&pkt);
+    avformat_close_input(&in);
+
+    if (plan->count == 0) {
+        log_error("No keyframes found in %s", cfg->input);
+        return 0;
+    }
+
+    int concurrent = plan->count < workers ? plan->count : workers;
+    plan->encoder_threads = workers / concurrent > 1 ? workers / concurrent : 1;
+
+    for (int i = 0; i < plan->count; i++)
+        snprintf(plan->paths[i], TRANSCODE_PATH_MAX, "%s.part%03d.mkv", cfg->output, i);
+    snprintf(plan->paths[plan->count], TRANSCODE_PATH_MAX, "%s.audio.mkv", cfg->output);
+
+    log_info("Transcode: %.1f s in %d segments on %d workers (%d encoder threads each)%s",
+             duration, plan->count, workers, plan->encoder_threads,
+             plan->has_audio ? ", plus audio" : "");
+    return 1;
+}
+
+typedef struct {
+    AVFormatContext *in;
+    AVStream        *out_stream;
+    AVPacket        *pkt;
+    bool             valid;
+} JoinInput;
+
+static bool join_read(JoinInput *j) {
+    j->valid = false;
+    if (!j->in) return false;
+    if (av_read_frame(j->in, j->pkt) < 0) return false;
+    av_packet_rescale_ts(j->pkt, j->in->streams[0]->time_base, j->out_stream->time_base);
+    j->pkt->stream_index = j->out_stream->index;
+    j->valid = true;
+    return true;
+}
+
+static int64_t join_ts(const JoinInput *j) {
+    return j->pkt->dts != AV_NOPTS_VALUE ? j->pkt->dts : j->pkt->pts;
+}
+
+// Stream-copies the video segments back to back and interleaves the audio
+// track with them.
+static int join_segments(TranscodePlan *plan) {
+    const char *output = plan->cfg->output;
+    AVFormatContext *out = NULL;
+    JoinInput video = {0}, audio = {0};
+    int64_t last_dts = AV_NOPTS_VALUE;
+    int segment = 0, ok = 0;
+
+    avformat_alloc_output_context2(&out, NULL, NULL, output);
+    video.pkt = av_packet_alloc();
+    audio.pkt = av_packet_alloc();
+    if (!out || !video.pkt || !audio.pkt) goto done;
+
+    if (avformat_open_input(&video.in, plan->paths[0], NULL, NULL) < 0 ||
+        avformat_find_stream_info(video.in, NULL) < 0)
+        goto done;
+    video.out_stream = avformat_new_stream(out, NULL);
+    if (!video.out_stream) goto done;
+    avcodec_parameters_copy(video.out_stream->codecpar, video.in->streams[0]->codecpar);
+    video.out_stream->codecpar->codec_tag = 0;
+    video.out_stream->time_base = video.in->streams[0]->time_base;
+
+    if (plan->has_audio) {
+        if (avformat_open_input(&audio.in, plan->paths[plan->count], NULL, NULL) < 0 ||
+            avformat_find_stream_info(audio.in, NULL) < 0)
+            goto done;
+        audio.out_stream = avformat_new_stream(out, NULL);
+        if (!audio.out_stream) goto done;
+        avcodec_parameters_copy(audio.out_stream->codecpar, audio.in->streams[0]->codecpar);
+        audio.out_stream->codecpar->codec_tag = 0;
+        audio.out_stream->time_base = audio.in->streams[0]->time_base;
+    }
+
+    if (!(out->oformat->flags & AVFMT_NOFILE) &&
+        avio_open(&out->pb, output, AVIO_FLAG_WRITE) < 0) {
+        log_error("Could not open file: %s", output);
+        goto done;
+    }
+    if (avformat_write_header(out, NULL) < 0) goto done;
+
+    join_read(&video);
+    join_read(&audio);
+    while (video.valid || audio.valid) {
+        bool take_video = video.valid &&
+            (!audio.valid || av_compare_ts(join_ts(&video), video.out_stream->time_base,
+                                           join_ts(&audio), audio.out_stream->time_base) <= 0);
+        if (take_video) {
+            // Each segment's encoder starts its dts one reorder delay early;
+            // nudge any overlap with the previous segment forward.
+            AVPacket *p = video.pkt;
+            if (p->dts != AV_NOPTS_VALUE) {
+                if (last_dts != AV_NOPTS_VALUE && p->dts <= last_dts) p->dts = last_dts + 1;
+                if (p->pts != AV_NOPTS_VALUE && p->pts < p->dts) p->pts = p->dts;
+                last_dts = p->dts;
+            }
+            if (av_interleaved_write_frame(out, p) < 0) goto done;
+            while (!join_read(&video)) {
+                avformat_close_input(&video.in);
+                if (++segment >= plan->count) break;
+                if (avformat_open_input(&video.in, plan->paths[segment], NULL, NULL) < 0)
+                    goto done;
+            }
+        } else {
+            if (av_interleaved_write_frame(out, audio.pkt) < 0) goto done;
+            join_read(&audio);
+        }
+    }
+    ok = av_write_trailer(out) >= 0;
+
+done:
+    if (out && !(out->oformat->flags & AVFMT_NOFILE)) avio_closep(&out->pb);
+    avformat_free_context(out);
+    avformat_close_input(&video.in);
+    avformat_close_input(&audio.in);
+    av_packet_free(&video.pkt);
+    av_packet_free(&audio.pkt);
+    return ok;
+}
+
+int transcode_run(const TranscodeConfig *cfg) {
+    TranscodePlan *plan = calloc(1, sizeof(TranscodePlan));
+    if (!plan) return 0;
+    plan->cfg = cfg;
+
+    long long start = time_now_us();
+    int ok = plan_segments(plan);
+    if (ok) {
+        int tasks = plan->count + (plan->has_audio ? 1 : 0);
+        jobs_parallel_for(tasks, run_segment, plan);
+        for (int i = 0; i < tasks; i++)
+            ok &= plan->ok[i];
+    }
+
+    long long encoded = time_now_us();
+    if (ok) ok = join_segments(plan);
+
+    for (int i = 0; plan->count > 0 && i <= plan->count; i++)
+        remove(plan->paths[i]);
+
+    if (ok)
+        log_info("Transcoded %s -> %s in %.1f s (join %.1f s)", cfg->input, cfg->output,
+                 (time_now_us() - start) / 1e6, (time_now_us() - encoded) / 1e6);
+    else
+        log_error("Transcode of %s failed", cfg->input);
+    free(plan);
+    return ok;
+}
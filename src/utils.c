@@ -1,5 +1,11 @@
 #include "utils.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
 // Calculate factorial of n
 unsigned long long factorial(int n) {
     if (n < 0) return 0;
@@ -52,4 +58,30 @@ int gcd(int a, int b) {
         a = temp;
     }
     return a;
-}
\ No newline at end of file
+}
+
+// Monotonic clock in microseconds
+long long time_now_us(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (long long)(now.QuadPart / freq.QuadPart) * 1000000 +
+           (long long)(now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+void time_sleep_ms(int ms) {
+#ifdef _WIN32
+    Sleep(ms > 0 ? (DWORD)ms : 0);
+#else
+    if (ms < 0) ms = 0;
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000 };
+    nanosleep(&ts, NULL);
+#endif
+}